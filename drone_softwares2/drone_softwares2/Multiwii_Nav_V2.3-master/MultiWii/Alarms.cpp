@@ -101,6 +101,12 @@ Control Config.h configuration and valid choices
 #error "please check config.h"
 #endif
 
+#if defined (LOG_BLACKBOX) && !(defined(MWI_SDCARD) && defined(MEGA))
+#error "LOG_BLACKBOX needs MWI_SDCARD and a MEGA board"
+#error "LOG_BLACKBOX a besoin de MWI_SDCARD et d'une carte MEGA"
+#error "please check config.h"
+#endif
+
 #if (defined (MWI_SDCARD))&& !(defined(CSPIN))
 #error "If you wants to use SDCARD support, you must enable #define CSPIN 53"
 #error "Si vous voulez utiliser le support SDCARD, vous devez activer #define CSPIN 53"
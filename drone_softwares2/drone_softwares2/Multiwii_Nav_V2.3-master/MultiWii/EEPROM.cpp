@@ -8,17 +8,324 @@
 #include "MultiWii.h"
 #include "Alarms.h"
 #include "GPS.h"
+#if defined(MISSION_STAGE_SIZE)
+  #include <util/crc16.h>
+#endif
+#if defined(MSP_PARAMS)
+  #include <stddef.h>
+#endif
 
 void LoadDefaults(void);
 
+//Define variables for calculations of EEPROM positions
+#ifdef MULTIPLE_CONFIGURATION_PROFILES
+    #define PROFILES 3
+#else
+    #define PROFILES 1
+#endif
+#ifdef LOG_PERMANENT
+    #define PLOG_SIZE sizeof(plog)
+#else 
+    #define PLOG_SIZE 0
+#endif
+#if defined(LOG_FLIGHTS)
+    #define FLOG_SIZE (LOG_FLIGHTS * sizeof(flight_log_t))
+#else
+    #define FLOG_SIZE 0
+#endif
+
 uint8_t calculate_sum(uint8_t *cb , uint8_t siz) {
   uint8_t sum=0x55;  // checksum init
   while(--siz) sum += *cb++;  // calculate checksum (without checksum byte)
   return sum;
 }
 
+/* EEPROM access. A byte takes ~3.4ms to program: with EEPROM_WRITE_QUEUE the writes are queued and the EE_READY
+ * interrupt programs them one after the other, the caller only waits when the queue is full. The reads see the
+ * queued values. Bytes which already hold the value are not written. */
+#if defined(EEPROM_WRITE_QUEUE)
+static struct {
+  uint16_t addr;
+  uint8_t  value;
+} eepromQueue[EEPROM_WRITE_QUEUE];
+static volatile uint8_t eepromHead, eepromTail;   // moved by the writers / by the interrupt
+
+ISR(EE_READY_vect) {
+  uint8_t t = eepromTail;
+  if (t == eepromHead) {            // all written
+    EECR &= ~(1<<EERIE);
+    return;
+  }
+  EEAR = eepromQueue[t].addr;
+  EEDR = eepromQueue[t].value;
+  EECR |= (1<<EEMPE);
+  EECR |= (1<<EEPE);
+  if (++t == EEPROM_WRITE_QUEUE) t = 0;
+  eepromTail = t;
+}
+
+// value at addr, the newest queued one or the EEPROM content. The interrupt must be masked.
+static uint8_t eepromPeek(uint16_t addr) {
+  uint8_t i = eepromHead;
+  while (i != eepromTail) {
+    if (i == 0) i = EEPROM_WRITE_QUEUE;
+    i--;
+    if (eepromQueue[i].addr == addr) return eepromQueue[i].value;
+  }
+  while (EECR & (1<<EEPE)) ;        // the byte being programmed
+  EEAR = addr;
+  EECR |= (1<<EERE);
+  return EEDR;
+}
+
+static void eepromUnmask(void) {
+  if (eepromHead != eepromTail) EECR |= (1<<EERIE);
+}
+
+uint8_t eepromReadByte(uint16_t addr) {
+  uint8_t v;
+  EECR &= ~(1<<EERIE);
+  v = eepromPeek(addr);
+  eepromUnmask();
+  return v;
+}
+
+void eepromReadBlock(void *dst, uint16_t addr, uint16_t len) {
+  uint8_t *d = (uint8_t*)dst;
+  EECR &= ~(1<<EERIE);
+  while (len--) *d++ = eepromPeek(addr++);
+  eepromUnmask();
+}
+
+// no merging with a queued write to the same byte: the bytes reach the EEPROM in the order they were written
+void eepromWriteByte(uint16_t addr, uint8_t v) {
+  uint8_t h, next;
+  EECR &= ~(1<<EERIE);
+  if (eepromPeek(addr) == v) { eepromUnmask(); return; }
+  h = eepromHead;
+  next = h + 1;
+  if (next == EEPROM_WRITE_QUEUE) next = 0;
+  eepromUnmask();
+  while (next == eepromTail) ;      // full, an entry is freed every ~3.4ms
+  eepromQueue[h].addr = addr;
+  eepromQueue[h].value = v;
+  eepromHead = next;
+  EECR |= (1<<EERIE);
+}
+
+// true when everything written so far is in the EEPROM
+bool eepromCommitted(void) {
+  return eepromHead == eepromTail && !(EECR & (1<<EEPE));
+}
+#else
+uint8_t eepromReadByte(uint16_t addr) {
+  return eeprom_read_byte((uint8_t*)addr);
+}
+
+void eepromReadBlock(void *dst, uint16_t addr, uint16_t len) {
+  eeprom_read_block(dst, (void*)addr, len);
+}
+
+void eepromWriteByte(uint16_t addr, uint8_t v) {
+  if (eeprom_read_byte((uint8_t*)addr) != v) eeprom_write_byte((uint8_t*)addr, v);
+}
+
+bool eepromCommitted(void) {
+  return eeprom_is_ready();
+}
+#endif
+
+void eepromWriteBlock(uint16_t addr, const void *src, uint16_t len) {
+  const uint8_t *s = (const uint8_t*)src;
+  while (len--) eepromWriteByte(addr++, *s++);
+}
+
+#if defined(EEPROM_JOURNAL)
+/* global_conf, the conf profiles and GPS_conf are kept in a journal of records, a record holds only bytes which changed.
+ * The journal area (EEPROM_JOURNAL bytes from address 0) has two banks, the active one is the valid bank with the newest
+ * sequence number. When it is full, the current values are written to the other bank which becomes the active one:
+ * the writes go round the area instead of hitting the same bytes every time.
+ *   bank   : 'J', sequence, ~sequence, records, 0xFF
+ *   record : id<<5 | (length-1), offset, length bytes, sum
+ * The first byte of the first record of a write (and of a new bank) is written last, after all the other records
+ * of the write: a write cut by a power loss is not seen at boot, the struct keeps its old value. */
+#define JOURNAL_BANK      (EEPROM_JOURNAL / 2)
+#define JOURNAL_MAGIC     'J'
+#define JOURNAL_END       0xFF
+#define JOURNAL_MAX_LEN   32
+enum journalid {
+  JOURNAL_GLOBAL = 0,
+  JOURNAL_GPS,
+  JOURNAL_CONF            // + profile
+};
+#define JOURNAL_IDS       (JOURNAL_CONF + PROFILES)
+#if GPS
+  #define JOURNAL_GPS_SIZE  sizeof(gps_conf_struct)
+#else
+  #define JOURNAL_GPS_SIZE  0
+#endif
+#define JOURNAL_RECORDS(size) ((size) + 3 * (((size) + JOURNAL_MAX_LEN - 1) / JOURNAL_MAX_LEN))
+#define JOURNAL_SNAPSHOT  (3 + JOURNAL_RECORDS(sizeof(global_conf_t)) + JOURNAL_RECORDS(JOURNAL_GPS_SIZE) + PROFILES * JOURNAL_RECORDS(sizeof(conf_t)) + 1)
+
+// compile time checks: a negative array size if false
+typedef char journal_bank_too_small[JOURNAL_BANK >= JOURNAL_SNAPSHOT + 64 ? 1 : -1];     // all the settings and room for changes
+typedef char journal_over_plog[EEPROM_JOURNAL <= E2END - PLOG_SIZE - FLOG_SIZE - 4 ? 1 : -1];
+typedef char journal_struct_too_big[sizeof(conf_t) < 256 && JOURNAL_GPS_SIZE <= sizeof(conf_t) && sizeof(global_conf_t) <= sizeof(conf_t) ? 1 : -1];
+
+static uint16_t journalBank;    // address of the active bank
+static uint16_t journalEnd;     // address of the end marker, 0 before journalInit()
+static uint8_t  journalSeq;
+static uint16_t journalTxn;     // first record of the write in progress, 0: none
+static uint8_t  journalTxnHeader;
+
+static uint8_t journalSize(uint8_t id) {
+  if (id == JOURNAL_GLOBAL) return sizeof(global_conf_t);
+  if (id == JOURNAL_GPS) return JOURNAL_GPS_SIZE;
+  if (id >= JOURNAL_CONF && id < JOURNAL_IDS) return sizeof(conf_t);
+  return 0;
+}
+
+// sum of the record at addr, header to data
+static uint8_t journalSum(uint16_t addr, uint8_t len) {
+  uint8_t sum = 0x55;
+  len += 2;
+  while (len--) sum += eepromReadByte(addr++);
+  return sum;
+}
+
+static bool journalBankValid(uint16_t bank, uint8_t *seq) {
+  *seq = eepromReadByte(bank + 1);
+  return eepromReadByte(bank) == JOURNAL_MAGIC && eepromReadByte(bank + 2) == (uint8_t)~*seq;
+}
+
+static void journalCommitBank(uint16_t bank, uint8_t seq) {
+  eepromWriteByte(bank + 1, seq);
+  eepromWriteByte(bank + 2, ~seq);
+  eepromWriteByte(bank, JOURNAL_MAGIC);
+}
+
+// finds the active bank and the end of its valid records, an empty journal is started in bank 0
+static void journalInit() {
+  uint8_t s0, s1, h, len;
+  uint16_t a;
+  if (journalEnd) return;
+  bool v0 = journalBankValid(0, &s0), v1 = journalBankValid(JOURNAL_BANK, &s1);
+  if (!v0 && !v1) {
+    journalBank = 0; journalSeq = 0;
+    eepromWriteByte(3, JOURNAL_END);
+    journalCommitBank(0, 0);
+  } else if (v0 && (!v1 || (int8_t)(s0 - s1) > 0)) {
+    journalBank = 0; journalSeq = s0;
+  } else {
+    journalBank = JOURNAL_BANK; journalSeq = s1;
+  }
+  for (a = journalBank + 3; a + 3 < journalBank + JOURNAL_BANK; a += len + 3) {
+    h = eepromReadByte(a);
+    len = (h & 0x1F) + 1;
+    if (h == JOURNAL_END || a + len + 3 > journalBank + JOURNAL_BANK || journalSum(a, len) != eepromReadByte(a + len + 2)) break;
+  }
+  if (a < journalBank + JOURNAL_BANK) eepromWriteByte(a, JOURNAL_END);   // after a damaged record: the next write starts a clean end
+  journalEnd = a;
+}
+
+// applies the records of id found between bank and end to buf, false if there is none
+static bool journalReplay(uint16_t bank, uint16_t end, uint8_t id, uint8_t *buf, uint8_t size) {
+  bool found = false;
+  uint16_t a = bank + 3;
+  while (a < end) {
+    uint8_t h = eepromReadByte(a), len = (h & 0x1F) + 1, off = eepromReadByte(a + 1);
+    if ((h >> 5) == id && off + len <= size) {
+      eepromReadBlock(buf + off, a + 2, len);
+      found = true;
+    }
+    a += len + 3;
+  }
+  return found;
+}
+
+// defer: the header is kept for journalCommit() when it is the first record of the write
+static bool journalAppend(uint8_t id, uint8_t off, const uint8_t *data, uint8_t len, bool defer) {
+  uint16_t a = journalEnd;
+  uint8_t h = id << 5 | (len - 1), sum = 0x55 + h + off, i;
+  if (a + len + 4 > journalBank + JOURNAL_BANK) return false;
+  eepromWriteByte(a + 1, off);
+  for (i = 0; i < len; i++) {
+    eepromWriteByte(a + 2 + i, data[i]);
+    sum += data[i];
+  }
+  eepromWriteByte(a + 2 + len, sum);
+  eepromWriteByte(a + 3 + len, JOURNAL_END);
+  if (defer && journalTxn == 0) {
+    journalTxn = a;
+    journalTxnHeader = h;
+  } else {
+    eepromWriteByte(a, h);
+  }
+  journalEnd = a + 3 + len;
+  return true;
+}
+
+static void journalCommit() {
+  if (journalTxn) eepromWriteByte(journalTxn, journalTxnHeader);   // the whole write is valid from now on
+  journalTxn = 0;
+}
+
+// writes all the settings to the other bank, with buf for id
+static void journalCompact(uint8_t id, const uint8_t *buf, uint8_t size) {
+  uint8_t tmp[sizeof(conf_t)];
+  uint16_t oldBank = journalBank, oldEnd = journalTxn ? journalTxn : journalEnd;   // the uncommitted records of this write are not replayed
+  uint8_t k, off, n;
+  journalTxn = 0;                          // the records of this write in the old bank are left invalid
+  journalBank = oldBank ? 0 : JOURNAL_BANK;
+  journalEnd = journalBank + 3;
+  eepromWriteByte(journalBank, 0);        // not valid until it is complete
+  for (k = 0; k < JOURNAL_IDS; k++) {
+    const uint8_t *src = tmp;
+    n = journalSize(k);
+    if (k == id) { src = buf; n = size; }
+    else if (n == 0 || !journalReplay(oldBank, oldEnd, k, tmp, n)) continue;
+    for (off = 0; off < n; off += JOURNAL_MAX_LEN) journalAppend(k, off, src + off, n - off < JOURNAL_MAX_LEN ? n - off : JOURNAL_MAX_LEN, false);
+  }
+  journalCommitBank(journalBank, ++journalSeq);
+}
+
+static void journalRead(uint8_t id, void *buf, uint8_t size) {
+  journalInit();
+  memset(buf, 0, size);                    // fails the checksum when nothing was stored
+  journalReplay(journalBank, journalEnd, id, (uint8_t*)buf, size);
+}
+
+// appends the bytes of buf which differ from the journal, runs closer than a record header are merged
+static void journalWrite(uint8_t id, const void *data, uint8_t size) {
+  uint8_t old[sizeof(conf_t)];
+  const uint8_t *buf = (const uint8_t*)data;
+  uint8_t i = 0, start, last;
+  journalInit();
+  bool found = journalReplay(journalBank, journalEnd, id, old, size);
+  while (i < size) {
+    if (found && old[i] == buf[i]) { i++; continue; }
+    start = last = i;
+    while (i < size && i - start < JOURNAL_MAX_LEN) {
+      if (!found || old[i] != buf[i]) last = i;
+      else if (i - last > 3) break;
+      i++;
+    }
+    i = last + 1;
+    if (!journalAppend(id, start, buf + start, last - start + 1, true)) {
+      journalCompact(id, buf, size);
+      return;
+    }
+  }
+  journalCommit();
+}
+#endif
+
 void readGlobalSet() {
-  eeprom_read_block((void*)&global_conf, (void*)0, sizeof(global_conf));
+  #if defined(EEPROM_JOURNAL)
+    journalRead(JOURNAL_GLOBAL, &global_conf, sizeof(global_conf));
+  #else
+    eepromReadBlock(&global_conf, 0, sizeof(global_conf));
+  #endif
   if(calculate_sum((uint8_t*)&global_conf, sizeof(global_conf)) != global_conf.checksum) {
     global_conf.currentSet = 0;
     global_conf.accZero[ROLL] = 5000;    // for config error signalization
@@ -32,7 +339,11 @@ bool readEEPROM() {
   #else
     global_conf.currentSet=0;
   #endif
-  eeprom_read_block((void*)&conf, (void*)(global_conf.currentSet * sizeof(conf) + sizeof(global_conf)), sizeof(conf));
+  #if defined(EEPROM_JOURNAL)
+    journalRead(JOURNAL_CONF + global_conf.currentSet, &conf, sizeof(conf));
+  #else
+    eepromReadBlock(&conf, global_conf.currentSet * sizeof(conf) + sizeof(global_conf), sizeof(conf));
+  #endif
   if(calculate_sum((uint8_t*)&conf, sizeof(conf)) != conf.checksum) {
     blinkLED(6,100,3);    
     #if defined(BUZZER)
@@ -69,7 +380,11 @@ bool readEEPROM() {
 
 void writeGlobalSet(uint8_t b) {
   global_conf.checksum = calculate_sum((uint8_t*)&global_conf, sizeof(global_conf));
-  eeprom_write_block((const void*)&global_conf, (void*)0, sizeof(global_conf));
+  #if defined(EEPROM_JOURNAL)
+    journalWrite(JOURNAL_GLOBAL, &global_conf, sizeof(global_conf));
+  #else
+    eepromWriteBlock(0, &global_conf, sizeof(global_conf));
+  #endif
   if (b == 1) blinkLED(15,20,1);
   #if defined(BUZZER)
     alarmArray[7] = 1; 
@@ -84,7 +399,11 @@ void writeParams(uint8_t b) {
     global_conf.currentSet=0;
   #endif
   conf.checksum = calculate_sum((uint8_t*)&conf, sizeof(conf));
-  eeprom_write_block((const void*)&conf, (void*)(global_conf.currentSet * sizeof(conf) + sizeof(global_conf)), sizeof(conf));
+  #if defined(EEPROM_JOURNAL)
+    journalWrite(JOURNAL_CONF + global_conf.currentSet, &conf, sizeof(conf));
+  #else
+    eepromWriteBlock(global_conf.currentSet * sizeof(conf) + sizeof(global_conf), &conf, sizeof(conf));
+  #endif
 
 #if GPS
   writeGPSconf();		//Write GPS parameters
@@ -220,7 +539,7 @@ void LoadDefaults() {
 #ifdef LOG_PERMANENT 
 #ifndef LOG_PERMANENT_SD_ONLY
 void readPLog(void) {
-  eeprom_read_block((void*)&plog, (void*)(E2END - 4 - sizeof(plog)), sizeof(plog));
+  eepromReadBlock(&plog, E2END - 4 - sizeof(plog), sizeof(plog));
   if(calculate_sum((uint8_t*)&plog, sizeof(plog)) != plog.checksum) {
     blinkLED(9,100,3);
     #if defined(BUZZER)
@@ -235,35 +554,117 @@ void readPLog(void) {
 }
 void writePLog(void) {
   plog.checksum = calculate_sum((uint8_t*)&plog, sizeof(plog));
-  eeprom_write_block((const void*)&plog, (void*)(E2END - 4 - sizeof(plog)), sizeof(plog));
+  eepromWriteBlock(E2END - 4 - sizeof(plog), &plog, sizeof(plog));
 }
 #endif
 #endif
 
-#if GPS
+#if defined(LOG_FLIGHTS)
+/* Flight summaries: a ring of LOG_FLIGHTS records just below the permanent log, the newest one has the highest number.
+ * A record is written in one go at disarm with its checksum last, a power cut can't damage the older ones. */
+#define FLOG_START (E2END - 4 - PLOG_SIZE - FLOG_SIZE)
 
-//Define variables for calculations of EEPROM positions
-#ifdef MULTIPLE_CONFIGURATION_PROFILES
-    #define PROFILES 3
-#else
-    #define PROFILES 1
-#endif
-#ifdef LOG_PERMANENT
-    #define PLOG_SIZE sizeof(plog)
-#else 
-    #define PLOG_SIZE 0
+static flight_log_t flightNow;    // the flight in progress
+static uint32_t flightStart;      // millis() at arming
+static int16_t  flightFailsafe;   // counters at arming
+static int16_t  flightI2C;
+static uint16_t flightPower;
+
+static bool flightLogSlot(uint8_t slot, flight_log_t *rec) {
+  eepromReadBlock(rec, FLOG_START + slot * sizeof(flight_log_t), sizeof(flight_log_t));
+  return rec->number != 0 && calculate_sum((uint8_t*)rec, sizeof(flight_log_t)) == rec->checksum;
+}
+
+// slot of the newest record and its number, LOG_FLIGHTS when the ring is empty
+static uint8_t flightLogNewest(uint16_t *number) {
+  flight_log_t rec;
+  uint8_t i, newest = LOG_FLIGHTS;
+  for (i = 0; i < LOG_FLIGHTS; i++) {
+    if (!flightLogSlot(i, &rec)) continue;
+    if (newest == LOG_FLIGHTS || (int16_t)(rec.number - *number) > 0) {
+      newest = i;
+      *number = rec.number;
+    }
+  }
+  return newest;
+}
+
+void flightLogStart(void) {
+  memset(&flightNow, 0, sizeof(flightNow));
+  flightNow.minVbat = 255;
+  flightNow.minSats = 255;
+  flightStart    = millis();
+  flightFailsafe = failsafeEvents;
+  flightI2C      = i2c_errors_count;
+  flightPower    = analog.intPowerMeterSum;
+}
+
+void flightLogUpdate(void) {
+  if (cycleTime > flightNow.maxCycleTime) flightNow.maxCycleTime = cycleTime;
+  if (analog.amperage > flightNow.maxAmperage) flightNow.maxAmperage = analog.amperage;
+  #if defined(VBAT)
+    if (analog.vbat > NO_VBAT && analog.vbat < flightNow.minVbat) flightNow.minVbat = analog.vbat;
+  #endif
+  #if GPS
+    if (f.GPS_FIX) {
+      if (GPS_numSat < flightNow.minSats) flightNow.minSats = GPS_numSat;
+      if (GPS_numSat > flightNow.maxSats) flightNow.maxSats = GPS_numSat;
+      if (GPS_speed > flightNow.maxSpeed) flightNow.maxSpeed = GPS_speed;
+      if (f.GPS_FIX_HOME && GPS_distanceToHome > flightNow.maxDistance) flightNow.maxDistance = GPS_distanceToHome;
+    }
+  #endif
+}
+
+void flightLogStore(void) {
+  uint16_t number = 0;
+  uint8_t slot = flightLogNewest(&number) + 1;
+  int16_t failsafe = failsafeEvents - flightFailsafe;
+
+  if (slot >= LOG_FLIGHTS) slot = 0;
+  if (++number == 0) number = 1;
+  flightNow.number    = number;
+  flightNow.duration  = (millis() - flightStart) / 1000;
+  flightNow.powerSum  = analog.intPowerMeterSum - flightPower;
+  flightNow.i2cErrors = i2c_errors_count - flightI2C;
+  flightNow.failsafe  = (failsafe > 255) ? 255 : failsafe;
+  if (flightNow.minVbat == 255) flightNow.minVbat = 0;
+  if (flightNow.minSats == 255) flightNow.minSats = 0;
+  flightNow.checksum = calculate_sum((uint8_t*)&flightNow, sizeof(flightNow));
+  eepromWriteBlock(FLOG_START + slot * sizeof(flight_log_t), &flightNow, sizeof(flightNow));
+  #if defined(MWI_SDCARD)
+    writeFlightLogToSD(&flightNow);
+  #endif
+}
+
+bool flightLogRead(uint8_t index, flight_log_t *rec) {
+  uint16_t number = 0;
+  uint8_t slot = flightLogNewest(&number);
+  if (slot == LOG_FLIGHTS || index >= LOG_FLIGHTS) return false;
+  slot = (slot + LOG_FLIGHTS - index) % LOG_FLIGHTS;
+  return flightLogSlot(slot, rec) && rec->number == (uint16_t)(number - index);
+}
 #endif
 
+#if GPS
+
 //Store gps_config
 
 void writeGPSconf(void) {
 	GPS_conf.checksum = calculate_sum((uint8_t*)&GPS_conf, sizeof(GPS_conf));
-	eeprom_write_block( (void*)&GPS_conf, (void*) (PROFILES * sizeof(conf) + sizeof(global_conf)), sizeof(GPS_conf) );
+#if defined(EEPROM_JOURNAL)
+	journalWrite(JOURNAL_GPS, &GPS_conf, sizeof(GPS_conf));
+#else
+	eepromWriteBlock(PROFILES * sizeof(conf) + sizeof(global_conf), &GPS_conf, sizeof(GPS_conf));
+#endif
 	}    
 
 //Recall gps_configuration
 bool recallGPSconf(void) {
-	eeprom_read_block((void*)&GPS_conf, (void*)(PROFILES * sizeof(conf) + sizeof(global_conf)), sizeof(GPS_conf));
+#if defined(EEPROM_JOURNAL)
+	journalRead(JOURNAL_GPS, &GPS_conf, sizeof(GPS_conf));
+#else
+	eepromReadBlock(&GPS_conf, PROFILES * sizeof(conf) + sizeof(global_conf), sizeof(GPS_conf));
+#endif
 	if(calculate_sum((uint8_t*)&GPS_conf, sizeof(GPS_conf)) != GPS_conf.checksum)
 		{
 		loadGPSdefaults();
@@ -315,33 +716,422 @@ void loadGPSdefaults(void) {
 }
 
 
+//EEPROM address of a given WP
+#if defined(EEPROM_JOURNAL)
+  #define WP_EEPROM_START EEPROM_JOURNAL
+#else
+  #define WP_EEPROM_START (PROFILES * sizeof(conf) + sizeof(global_conf) + sizeof(GPS_conf))
+#endif
+static uint16_t wpAddress(uint8_t wp_number) {
+	return WP_EEPROM_START + (sizeof(mission_step)*wp_number);
+}
+
+#if defined(MISSION_RAM)
+mission_cache_t mission_cache;
+
+// A step the navigation can run: known action, a jump goes to a step of the mission (checked once its last step is known)
+static bool missionStepValid(mission_step_struct *step) {
+	switch (step->action) {
+		case MISSION_WAYPOINT:
+		case MISSION_HOLD_UNLIM:
+		case MISSION_HOLD_TIME:
+		case MISSION_RTH:
+		case MISSION_SET_POI:
+		case MISSION_SET_HEADING:
+		case MISSION_LAND:
+			return true;
+		case MISSION_JUMP:
+			return step->parameter1 > 0;
+	}
+	return false;
+}
+
+static void missionCacheCopy(uint8_t index, mission_step_struct *step) {
+	mission_ram_step_t *r = &mission_cache.step[index];
+	r->pos[LAT]   = step->pos[LAT];
+	r->pos[LON]   = step->pos[LON];
+	r->altitude   = step->altitude;
+	r->parameter1 = step->parameter1;
+	r->parameter2 = step->parameter2;
+	r->parameter3 = step->parameter3;
+	r->action     = step->action;
+	r->flag       = step->flag;
+}
+
+// The whole mission is checked in the background, MISSION_CHECK_TIME us per cycle,
+// and again from the start after every change of the mission
+#define MISSION_CHECK_TIME  200		// us per cycle
+#define MISSION_CHECK_ARMED 2000	// us missionCacheLoad() may spend on the check at arming, the background check does the rest
+enum {
+	MISSION_CHECK_RUNNING = 0,
+	MISSION_CHECK_OK,
+	MISSION_CHECK_FAILED
+};
+static uint8_t     mission_check_state;
+static wp_number_t mission_check_n;		//Steps checked
+static wp_number_t mission_check_jump;	//Highest jump target
+
+static void missionCheckRestart() {
+	mission_cache.last   = 0;
+	mission_cache.count  = 0;
+	mission_cache.wanted = 0;
+	mission_check_state  = MISSION_CHECK_RUNNING;
+	mission_check_n      = 0;
+	mission_check_jump   = 0;
+}
+
+// Reads more steps for budget us, from 1 up to the end of the mission (end flag, or a step after which the navigation stops)
+static uint8_t missionCheck(uint16_t budget) {
+	mission_step_struct step;
+	uint16_t start = micros();
+	wp_number_t n, max = GPS_conf.max_wp_number;
+#if defined(MISSION_SD)
+	if (f.SDCARD) max = 0xFFFF;
+#endif
+#if defined(MISSION_STAGE_SIZE)
+	if (mission_stage.state == MISSION_STAGE_FLUSHING) return MISSION_CHECK_RUNNING;	//Checked once it is all written
+#endif
+	while (mission_check_state == MISSION_CHECK_RUNNING) {
+		if ((uint16_t)(micros() - start) > budget) break;
+		n = mission_check_n + 1;
+		if (mission_check_n == max || !readWP(n, &step) || step.number != n || !missionStepValid(&step)) {
+			mission_check_state = MISSION_CHECK_FAILED;
+			break;
+		}
+		mission_check_n = n;
+		if (step.action == MISSION_JUMP && (wp_number_t)step.parameter1 > mission_check_jump) mission_check_jump = step.parameter1;
+		if (step.flag == MISSION_FLAG_END || step.action == MISSION_RTH || step.action == MISSION_LAND || step.action == MISSION_HOLD_UNLIM)
+			mission_check_state = (mission_check_jump <= n) ? MISSION_CHECK_OK : MISSION_CHECK_FAILED;
+	}
+	return mission_check_state;
+}
+
+// Armed, a mission which passes only now (checked after arming, or changed in flight) is read in RAM here
+void missionCacheCheck() {
+	if (missionCheck(MISSION_CHECK_TIME) != MISSION_CHECK_OK) return;
+	if (f.ARMED && mission_cache.last == 0) missionCacheLoad();
+}
+
+static void missionCacheFill(wp_number_t first) {
+	mission_step_struct step;
+	uint8_t i = 0;
+	while (i < MISSION_RAM && (uint32_t)first + i <= mission_cache.last && readWP(first + i, &step)) missionCacheCopy(i++, &step);
+	mission_cache.first = first;
+	mission_cache.count = i;
+}
+
+// At arming: goes on with the check for MISSION_CHECK_ARMED us at most and reads the first steps in RAM once it passed.
+// Only a mission which passes is flown, until then missionCacheStep() fails.
+bool missionCacheLoad() {
+	mission_cache.last   = 0;
+	mission_cache.wanted = 0;
+	if (missionCheck(MISSION_CHECK_ARMED) != MISSION_CHECK_OK) return false;
+	mission_cache.last = mission_check_n;
+	missionCacheFill(1);
+	return true;
+}
+
+// Step from RAM, none while the mission is not checked (see missionCacheCheck)
+static bool missionCacheStep(wp_number_t number, mission_step_struct *step) {
+	if (mission_cache.last == 0) return false;
+	if (number == 0 || number > mission_cache.last) return false;
+	if (number < mission_cache.first || number >= mission_cache.first + mission_cache.count) missionCacheFill(number);	//Jump outside of the window (long missions only)
+	if (number < mission_cache.first || number >= mission_cache.first + mission_cache.count) return false;
+	mission_ram_step_t *r = &mission_cache.step[number - mission_cache.first];
+	step->number     = number;
+	step->pos[LAT]   = r->pos[LAT];
+	step->pos[LON]   = r->pos[LON];
+	step->altitude   = r->altitude;
+	step->parameter1 = r->parameter1;
+	step->parameter2 = r->parameter2;
+	step->parameter3 = r->parameter3;
+	step->action     = r->action;
+	step->flag       = r->flag;
+	step->checksum   = calculate_sum((uint8_t*)step, sizeof(mission_step_struct));
+	if (number - mission_cache.first >= MISSION_RAM / 2 && mission_cache.first + mission_cache.count <= mission_cache.last)
+		mission_cache.wanted = number;		//Half of the window used: the next one starts at this step
+	return true;
+}
+
+void missionCachePrefetch() {
+	if (mission_cache.wanted == 0) return;
+	missionCacheFill(mission_cache.wanted);
+	mission_cache.wanted = 0;
+}
+#endif
+
 //Stores the WP data in the wp struct in the EEPROM
 void storeWP() {
 
-	if (mission_step.number >254) return;
 	mission_step.checksum = calculate_sum((uint8_t*)&mission_step, sizeof(mission_step));
-	eeprom_write_block((void*)&mission_step, (void*)(PROFILES * sizeof(conf) + sizeof(global_conf) + sizeof(GPS_conf) +(sizeof(mission_step)*mission_step.number)),sizeof(mission_step));
+#if defined(MISSION_RAM)
+	missionCheckRestart();		//Checked again before it is flown
+#endif
+#if defined(MISSION_SD)
+	if (f.SDCARD) { missionSDWrite(&mission_step); return; }
+#endif
+	if (mission_step.number >254) return;
+	eepromWriteBlock(wpAddress(mission_step.number), &mission_step, sizeof(mission_step));
 }
 
 // Read the given number of WP from the eeprom, supposedly we can use this during flight.
 // Returns true when reading is successfull and returns false if there were some error (for example checksum)
-bool recallWP(uint8_t wp_number) {
+bool recallWP(wp_number_t wp_number) {
+#if defined(MISSION_RAM)
+	if (f.ARMED) return missionCacheStep(wp_number, &mission_step);
+#endif
+	return readWP(wp_number, &mission_step);
+}
+
+bool readWP(wp_number_t wp_number, mission_step_struct *step) {
+#if defined(MISSION_SD)
+	if (f.SDCARD) return missionSDRead(wp_number, step);
+#endif
 	if (wp_number > 254) return false;
 
-	eeprom_read_block((void*)&mission_step, (void*)(PROFILES * sizeof(conf) + sizeof(global_conf)+sizeof(GPS_conf)+(sizeof(mission_step)*wp_number)), sizeof(mission_step));
-	if(calculate_sum((uint8_t*)&mission_step, sizeof(mission_step)) != mission_step.checksum) return false;
+	eepromReadBlock(step, wpAddress(wp_number), sizeof(mission_step_struct));
+	if(calculate_sum((uint8_t*)step, sizeof(mission_step_struct)) != step->checksum) return false;
+
+	return true;
+}
+
+#if defined(MISSION_STAGE_SIZE)
+mission_stage_t mission_stage;
+
+// Opens a new stage, an older one which is not being written is dropped
+bool missionStageBegin(uint8_t first, uint8_t count) {
+	if (f.ARMED || NAV_state != NAV_STATE_NONE || mission_stage.state == MISSION_STAGE_FLUSHING) return false;
+	if (first == 0 || count == 0 || count > MISSION_STAGE_SIZE || (uint16_t)first + count - 1 > GPS_conf.max_wp_number) return false;
+	memset(mission_stage.received, 0, sizeof(mission_stage.received));
+	mission_stage.first   = first;
+	mission_stage.count   = count;
+	mission_stage.flushed = 0;
+	mission_stage.pos     = 0;
+	mission_stage.state   = MISSION_STAGE_LOADING;
+	return true;
+}
+
+mission_step_struct *missionStageStep(uint8_t index) {
+	if (mission_stage.state != MISSION_STAGE_LOADING || index >= mission_stage.count) return 0;
+	mission_stage.received[index>>3] |= 1<<(index&7);
+	return &mission_stage.step[index];
+}
+
+static uint16_t crc16_block(uint16_t crc, const void *data, uint8_t len) {
+	const uint8_t *p = (const uint8_t*)data;
+	while (len--) crc = _crc_xmodem_update(crc, *p++);
+	return crc;
+}
 
+// crc is the CRC16 (XMODEM) of all the steps, in the MSP_SET_WP field order: action, lat, lon, altitude, parameter1-3, flag
+bool missionStageCommit(uint16_t crc) {
+	uint16_t c = 0;
+	if (mission_stage.state != MISSION_STAGE_LOADING) return false;
+	for (uint8_t i=0; i<mission_stage.count; i++) {
+		mission_step_struct *s = &mission_stage.step[i];
+		if (!(mission_stage.received[i>>3] & (1<<(i&7)))) { mission_stage.state = MISSION_STAGE_ERROR; return false; }
+		c = crc16_block(c, &s->action, 1);
+		c = crc16_block(c, s->pos, 8);
+		c = crc16_block(c, &s->altitude, 4);
+		c = crc16_block(c, &s->parameter1, 6);
+		c = crc16_block(c, &s->flag, 1);
+	}
+	if (c != crc) { mission_stage.state = MISSION_STAGE_ERROR; return false; }
+	for (uint8_t i=0; i<mission_stage.count; i++) {
+		mission_stage.step[i].number   = mission_stage.first + i;
+		mission_stage.step[i].checksum = calculate_sum((uint8_t*)&mission_stage.step[i], sizeof(mission_step_struct));
+	}
+	mission_stage.state = MISSION_STAGE_FLUSHING;
+#if defined(MISSION_RAM)
+	missionCheckRestart();
+#endif
 	return true;
 }
 
+// Writes at most one byte per call and only when the EEPROM is ready, so it never waits for the ~3.4ms write cycle.
+// Bytes which are already right are skipped.
+void missionStageFlush(void) {
+#if defined(MISSION_SD)
+	if (mission_stage.state == MISSION_STAGE_FLUSHING && !f.ARMED && f.SDCARD) {	// one step per call on the card
+		missionSDWrite(&mission_stage.step[mission_stage.flushed]);
+		if (++mission_stage.flushed >= mission_stage.count) mission_stage.state = MISSION_STAGE_DONE;
+		return;
+	}
+#endif
+	if (mission_stage.state != MISSION_STAGE_FLUSHING || f.ARMED || !eepromCommitted()) return;
+	if (mission_stage.flushed >= mission_stage.count) { mission_stage.state = MISSION_STAGE_DONE; return; }	// last byte is in
+	uint8_t *src = (uint8_t*)&mission_stage.step[mission_stage.flushed];
+	uint16_t dst = wpAddress(mission_stage.first + mission_stage.flushed);
+	while (mission_stage.pos < sizeof(mission_step_struct)) {
+		uint8_t p = mission_stage.pos++;
+		if (eepromReadByte(dst+p) != src[p]) { eepromWriteByte(dst+p, src[p]); break; }
+	}
+	if (mission_stage.pos >= sizeof(mission_step_struct)) {
+		mission_stage.pos = 0;
+		mission_stage.flushed++;
+	}
+}
+#endif
+
 // Returns the maximum WP number that can be stored in the EEPROM, calculated from conf and plog sizes, and the eeprom size
 uint8_t getMaxWPNumber() {
+#if defined(MISSION_SD)
+	if (f.SDCARD) return 254;	// all that MSP_SET_WP can address, MSP_SET_WP16 goes beyond
+#endif
 
-	uint16_t first_avail = PROFILES*sizeof(conf) + sizeof(global_conf)+sizeof(GPS_conf)+ 1; //Add one byte for addtnl separation
-	uint16_t last_avail  = E2END - PLOG_SIZE - 4;										  //keep the last 4 bytes intakt
+	uint16_t first_avail = WP_EEPROM_START + 1; //Add one byte for addtnl separation
+	uint16_t last_avail  = E2END - PLOG_SIZE - FLOG_SIZE - 4;							  //keep the last 4 bytes intakt
 	uint16_t wp_num = (last_avail-first_avail)/sizeof(mission_step);
 	if (wp_num>254) wp_num = 254;
 	return wp_num;
 }
 #endif
 
+
+#if defined(MSP_PARAMS)
+/* Parameter table for MSP_PARAM_LIST / MSP_PARAM / MSP_SET_PARAM: one setting at a time instead of the whole struct.
+ * The ids never change, a new parameter takes a free id. The table must stay sorted by id.
+ *   0- 29 : P, I, D of the PIDs (3*PID item + 0/1/2)
+ *  30- 63 : rc tuning, trims and misc settings of the current profile
+ *  64- 95 : servos (64 + 4*servo + min/max/middle/rate)
+ * 128-159 : navigation (GPS_conf)
+ * The new values are in RAM only, MSP_EEPROM_WRITE saves them. */
+#define PARAM_CONF(id, type, field, min, max, scale) {id, type, offsetof(conf_t, field), min, max, scale}
+#define PARAM_NAV(id, type, field, min, max, scale)  {id, PARAM_GPS|(type), offsetof(gps_conf_struct, field), min, max, scale}
+#define PARAM_NAVBIT(id, byte, bit)                  {id, PARAM_GPS|(PARAM_BIT0+(bit)), byte, 0, 1, 0}
+#define PARAM_PID(item, sp, si, sd) \
+  PARAM_CONF(3*(item),   PARAM_U8, pid[item].P8, 0, 255, sp), \
+  PARAM_CONF(3*(item)+1, PARAM_U8, pid[item].I8, 0, 255, si), \
+  PARAM_CONF(3*(item)+2, PARAM_U8, pid[item].D8, 0, 255, sd)
+#define PARAM_SERVO(i) \
+  PARAM_CONF(64+4*(i),   PARAM_S16, servoConf[i].min,    1000, 2000, 0), \
+  PARAM_CONF(64+4*(i)+1, PARAM_S16, servoConf[i].max,    1000, 2000, 0), \
+  PARAM_CONF(64+4*(i)+2, PARAM_S16, servoConf[i].middle, 0,    2000, 0), \
+  PARAM_CONF(64+4*(i)+3, PARAM_S8,  servoConf[i].rate,   -100, 100,  0)
+
+const param_desc_t PROGMEM paramTable[] = {
+  PARAM_PID(PIDROLL,  1, 3, 0),
+  PARAM_PID(PIDPITCH, 1, 3, 0),
+  PARAM_PID(PIDYAW,   1, 3, 0),
+  PARAM_PID(PIDALT,   1, 3, 0),
+  PARAM_PID(PIDPOS,   2, 2, 0),
+  PARAM_PID(PIDPOSR,  1, 2, 3),
+  PARAM_PID(PIDNAVR,  1, 2, 3),
+  PARAM_PID(PIDLEVEL, 1, 2, 0),
+  PARAM_PID(PIDMAG,   1, 0, 0),
+  PARAM_PID(PIDVEL,   1, 3, 0),
+  PARAM_CONF(30, PARAM_U8,  rcRate8,       0, 250, 2),
+  PARAM_CONF(31, PARAM_U8,  rcExpo8,       0, 100, 2),
+  PARAM_CONF(32, PARAM_U8,  rollPitchRate, 0, 100, 2),
+  PARAM_CONF(33, PARAM_U8,  yawRate,       0, 100, 2),
+  PARAM_CONF(34, PARAM_U8,  dynThrPID,     0, 100, 2),
+  PARAM_CONF(35, PARAM_U8,  thrMid8,       0, 100, 2),
+  PARAM_CONF(36, PARAM_U8,  thrExpo8,      0, 100, 2),
+  PARAM_CONF(37, PARAM_S16, angleTrim[ROLL],  -500, 500, 1),
+  PARAM_CONF(38, PARAM_S16, angleTrim[PITCH], -500, 500, 1),
+  PARAM_CONF(39, PARAM_U8,  powerTrigger1, 0, 255, 0),
+  PARAM_CONF(40, PARAM_S16, minthrottle,   1000, 2000, 0),
+#if MAG
+  PARAM_CONF(41, PARAM_S16, mag_declination, -1800, 1800, 1),
+#endif
+#if defined(FAILSAFE)
+  PARAM_CONF(42, PARAM_S16, failsafe_throttle, 1000, 2000, 0),
+#endif
+#if defined(VBAT)
+  PARAM_CONF(43, PARAM_U8,  vbatscale,       0, 255, 0),
+  PARAM_CONF(44, PARAM_U8,  vbatlevel_warn1, 0, 255, 1),
+  PARAM_CONF(45, PARAM_U8,  vbatlevel_warn2, 0, 255, 1),
+  PARAM_CONF(46, PARAM_U8,  vbatlevel_crit,  0, 255, 1),
+#endif
+#if defined(POWERMETER)
+  PARAM_CONF(47, PARAM_U8,  pint2ma,       0, 255, 0),
+#endif
+#if defined(POWERMETER_HARD)
+  PARAM_CONF(48, PARAM_U16, psensornull,   0, 1023, 0),
+#endif
+#if defined(MMGYRO)
+  PARAM_CONF(49, PARAM_U8,  mmgyro,        1, MMGYROVECTORLENGTH, 0),
+#endif
+#if defined(ARMEDTIMEWARNING)
+  PARAM_CONF(50, PARAM_U16, armedtimewarning, 0, 32767, 0),
+#endif
+#if defined(GOVERNOR_P)
+  PARAM_CONF(51, PARAM_S16, governorP,     0, 255, 0),
+  PARAM_CONF(52, PARAM_S16, governorD,     0, 255, 0),
+#endif
+#if defined(GYRO_SMOOTHING)
+  PARAM_CONF(53, PARAM_U8,  Smoothing[0],  0, 255, 0),
+  PARAM_CONF(54, PARAM_U8,  Smoothing[1],  0, 255, 0),
+  PARAM_CONF(55, PARAM_U8,  Smoothing[2],  0, 255, 0),
+#endif
+  PARAM_SERVO(0), PARAM_SERVO(1), PARAM_SERVO(2), PARAM_SERVO(3),
+  PARAM_SERVO(4), PARAM_SERVO(5), PARAM_SERVO(6), PARAM_SERVO(7),
+#if GPS
+  PARAM_NAVBIT(128, 0, 0),    // filtering
+  PARAM_NAVBIT(129, 0, 1),    // lead_filter
+  PARAM_NAVBIT(130, 0, 2),    // dont_reset_home_at_arm
+  PARAM_NAVBIT(131, 0, 3),    // nav_controls_heading
+  PARAM_NAVBIT(132, 0, 4),    // nav_tail_first
+  PARAM_NAVBIT(133, 0, 5),    // nav_rth_takeoff_heading
+  PARAM_NAVBIT(134, 0, 6),    // slow_nav
+  PARAM_NAVBIT(135, 0, 7),    // wait_for_rth_alt
+  PARAM_NAVBIT(136, 1, 0),    // ignore_throttle
+  PARAM_NAVBIT(137, 1, 1),    // takeover_baro
+  PARAM_NAV(138, PARAM_U16, wp_radius,        0, 5000,  0),
+  PARAM_NAV(139, PARAM_U16, safe_wp_distance, 0, 10000, 0),
+  PARAM_NAV(140, PARAM_U16, nav_max_altitude, 0, 1000,  0),
+  PARAM_NAV(141, PARAM_U16, nav_speed_max,    10, 2000, 0),
+  PARAM_NAV(142, PARAM_U16, nav_speed_min,    10, 2000, 0),
+  PARAM_NAV(143, PARAM_U8,  crosstrack_gain,  0, 255,   2),
+  PARAM_NAV(144, PARAM_U16, nav_bank_max,     500, 4500, 2),
+  PARAM_NAV(145, PARAM_U16, rth_altitude,     0, 1000,  0),
+  PARAM_NAV(146, PARAM_U8,  land_speed,       50, 255,  0),
+  PARAM_NAV(147, PARAM_U16, fence,            0, 10000, 0),
+#endif
+};
+
+uint8_t paramCount(void) {
+  return sizeof(paramTable) / sizeof(paramTable[0]);
+}
+
+void paramDesc(uint8_t index, param_desc_t *d) {
+  memcpy_P(d, &paramTable[index], sizeof(*d));
+}
+
+bool paramFind(uint8_t id, param_desc_t *d) {
+  for (uint8_t i = 0; i < paramCount(); i++) {
+    paramDesc(i, d);
+    if (d->id == id) return true;
+    if (d->id > id) break;
+  }
+  return false;
+}
+
+static uint8_t *paramAddr(const param_desc_t *d) {
+#if GPS
+  if (d->type & PARAM_GPS) return (uint8_t*)&GPS_conf + d->offset;
+#endif
+  return (uint8_t*)&conf + d->offset;
+}
+
+int16_t paramGet(const param_desc_t *d) {
+  uint8_t *p = paramAddr(d), t = d->type & ~PARAM_GPS;
+  if (t >= PARAM_BIT0) return (*p >> (t - PARAM_BIT0)) & 1;
+  if (t == PARAM_U8) return *p;
+  if (t == PARAM_S8) return (int8_t)*p;
+  return *(int16_t*)p;        // the U16 are limited to 32767 in the table
+}
+
+bool paramSet(const param_desc_t *d, int16_t v) {
+  uint8_t *p = paramAddr(d), t = d->type & ~PARAM_GPS;
+  if (v < d->min || v > d->max) return false;
+  if (t >= PARAM_BIT0) {
+    if (v) *p |= 1 << (t - PARAM_BIT0); else *p &= ~(1 << (t - PARAM_BIT0));
+  } else if (t == PARAM_U8 || t == PARAM_S8) {
+    *p = v;
+  } else {
+    *(int16_t*)p = v;
+  }
+  return true;
+}
+#endif
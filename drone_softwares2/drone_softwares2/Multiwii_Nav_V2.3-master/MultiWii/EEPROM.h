@@ -9,14 +9,48 @@ void writeParams(uint8_t b);
 void LoadDefaults();
 void readPLog(void);
 void writePLog(void);
+#if defined(LOG_FLIGHTS)
+void flightLogStart(void);									// at arming
+void flightLogUpdate(void);									// every cycle while armed
+void flightLogStore(void);									// at disarm, appends the summary of the flight
+bool flightLogRead(uint8_t index, flight_log_t *rec);		// index 0 is the last flight, false when there is no such record
+#endif
 uint8_t calculate_sum(uint8_t *cb, uint8_t siz);
+uint8_t eepromReadByte(uint16_t addr);						// EEPROM access, with EEPROM_WRITE_QUEUE the writes return at once
+void eepromReadBlock(void *dst, uint16_t addr, uint16_t len);	// and the reads see the values not written yet
+void eepromWriteByte(uint16_t addr, uint8_t v);
+void eepromWriteBlock(uint16_t addr, const void *src, uint16_t len);
+bool eepromCommitted(void);									// true when all the writes are in the EEPROM
+#if defined(MSP_PARAMS)
+uint8_t paramCount(void);									// Entries in the parameter table
+void paramDesc(uint8_t index, param_desc_t *d);				// Descriptor of the index-th entry
+bool paramFind(uint8_t id, param_desc_t *d);					// Descriptor of a parameter id, false when it isn't compiled in
+int16_t paramGet(const param_desc_t *d);
+bool paramSet(const param_desc_t *d, int16_t v);				// false when v is out of min..max
+#endif
 #if defined(GPS)
 //EEPROM functions for storing and restoring waypoints 
 
 void storeWP(void);							// Stores the WP data in the wp struct in the EEPROM
-bool recallWP(uint8_t);						// Read the given number of WP from the eeprom, supposedly we can use this during flight.
+bool recallWP(wp_number_t);						// Read the given number of WP from the eeprom, supposedly we can use this during flight.
 											// Returns true when reading is successfull and returns false if there were some error (for example checksum)
 uint8_t getMaxWPNumber(void);				// Returns the maximum WP number that can be stored in the EEPROM, calculated from conf and plog sizes, and the eeprom size
+bool readWP(wp_number_t wp_number, mission_step_struct *step);	// Same as recallWP, but to any struct (mission_step is left untouched)
+
+#if defined(MISSION_STAGE_SIZE)
+extern mission_stage_t mission_stage;
+bool missionStageBegin(uint8_t first, uint8_t count);	// Opens a RAM stage for the WPs first..first+count-1
+mission_step_struct *missionStageStep(uint8_t index);	// Staged step to fill, NULL when index is outside the open stage
+bool missionStageCommit(uint16_t crc);					// Checks the whole stage and starts the background write
+void missionStageFlush(void);							// Background EEPROM writer, called every cycle
+#endif
+
+#if defined(MISSION_RAM)
+extern mission_cache_t mission_cache;
+void missionCacheCheck(void);							// Checks a few steps of the mission every cycle, loads it in RAM once checked while armed
+bool missionCacheLoad(void);							// Goes on with the check and keeps the first steps in RAM, at arming
+void missionCachePrefetch(void);						// Reads the next window of a long mission, while flying to a waypoint
+#endif
 
 void loadGPSdefaults(void);
 void writeGPSconf(void) ;
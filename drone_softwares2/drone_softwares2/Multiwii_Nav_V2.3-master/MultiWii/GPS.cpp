@@ -5,8 +5,10 @@
 #include "GPS.h"
 #include "Serial.h"
 #include "Sensors.h"
+#include "IMU.h"
 #include "MultiWii.h"
 #include "EEPROM.h"
+#include "SDcard.h"
 #include <math.h>
 
 #if GPS
@@ -22,16 +24,28 @@ bool UBLOX_parse_gps(void);
 #if defined(MTK_BINARY16) || defined(MTK_BINARY19)
 bool GPS_MTK_newFrame(uint8_t data);
 #endif
-void GPS_bearing(int32_t* lat1, int32_t* lon1, int32_t* lat2, int32_t* lon2, int32_t* bearing);
-void GPS_distance_cm(int32_t* lat1, int32_t* lon1, int32_t* lat2, int32_t* lon2,uint32_t* dist);
+void GPS_bearing(int32_t* from, int32_t* to, int32_t* bearing);
+void GPS_distance_cm(int32_t* from, int32_t* to, uint32_t* dist);
 static void GPS_calc_velocity(void);
-static void GPS_calc_location_error( int32_t* target_lat, int32_t* target_lng, int32_t* gps_lat, int32_t* gps_lng );
+static void GPS_calc_location_error(int32_t* target, int32_t* pos);
 static void GPS_calc_poshold(void);
 static uint16_t GPS_calc_desired_speed(uint16_t max_speed, bool _slow);
 static void GPS_calc_nav_rate(uint16_t max_speed);
+static void GPS_poshold_pid(float dt);
+static void GPS_nav_rate_pid(float dt);
+#if defined(INS_NAV)
+static void GPS_ins_correct(void);
+#endif
+#if defined(GPS_SERIAL)
+static void GPS_detect(void);
+#endif
 int32_t wrap_18000(int32_t ang);
 static bool check_missed_wp(void);
 void GPS_calc_longitude_scaling(int32_t lat);
+static void GPS_set_origin(int32_t* coord);
+static void GPS_to_local(int32_t* coord, int32_t* local);
+static void GPS_update_local_targets(void);
+static uint8_t GPS_local_shift(uint32_t x, uint32_t y);
 static void GPS_update_crosstrack(void);
 int32_t wrap_36000(int32_t ang);
 uint8_t land_detect;							//Detect land
@@ -59,8 +73,10 @@ uint8_t land_detect;							//Detect land
 // Set up gps lag
 #if defined(UBLOX) || defined (MTK_BINARY19)
 #define GPS_LAG 0.5f                          //UBLOX GPS has a smaller lag than MTK and other
+#define INS_GPS_DELAY 2                       //Age of a position fix for the INS, in 100ms steps
 #else
 #define GPS_LAG 1.0f                          //We assumes that MTK GPS has a 1 sec lag
+#define INS_GPS_DELAY 5
 #endif  
 
 static int32_t  GPS_coord_lead[2];              // Lead filtered gps coordinates
@@ -168,6 +184,21 @@ static float  dTnav;            // Delta Time in milliseconds for navigation com
 static int16_t actual_speed[2] = {0,0};
 static float GPS_scaleLonDown; // this is used to offset the shrinking longitude as we go towards the poles
 
+// Local navigation frame, cm north ([LAT]) and east ([LON]) of GPS_origin
+#define GPS_CM_PER_LAT    36477     // Q15, 1.11318845 cm per lat*10^7
+#define GPS_LAT_PER_CM    29436     // Q15, the inverse: error[] stays in lat*10^7 units for the PID gains
+#define GPS_SCALE_REFRESH 1000000   // lat*10^7, 0.1deg = 11km
+
+static int32_t  GPS_origin[2];
+static int32_t  GPS_scale_lat;      // latitude of the longitude scaling
+static int32_t  GPS_cm_per_lon;     // Q15, GPS_CM_PER_LAT*cos(GPS_scale_lat), 0 until the origin is set
+static int32_t  GPS_local[2];       // copter, updated with every good GPS read
+static int32_t  GPS_local_lead[2];  // lead filtered copter
+static int32_t  GPS_home_local[2];
+static int32_t  GPS_WP_local[2];
+static int32_t  GPS_FROM_local[2];
+static int32_t  GPS_track[2];       // Q15 unit vector FROM -> WP, for the crosstrack error
+
 // The difference between the desired rate of travel and the actual rate of travel
 // updated after GPS read - 5-10hz
 static int16_t rate_error[2];
@@ -177,6 +208,44 @@ static int32_t error[2];
 static int32_t GPS_WP[2];
 static int32_t GPS_FROM[2]; //the pervious waypoint for precise track following
 
+#if defined(UBLOX_PVT)
+#define UBLOX_SPEED_ACCURACY 500        // mm/s, the receiver velocity is used below this speed accuracy
+#define GPS_VEL_SCALE (1.0f/1.11318845f) // cm/s to lat*10^7/s, the unit of actual_speed
+static int16_t GPS_velocity[2];         // receiver velocity north/east in cm/s, from NAV-PVT
+static uint8_t GPS_velocity_ok;         // the last NAV-PVT had a fix and a good speed accuracy
+#endif
+
+#if defined(INS_NAV)
+////////////////////////////////////////////////////////////////////////////////
+// Inertial navigation, see GPS_ins_nav
+// Positions are in the units of error[]: lat/lon * 10^7 relative to ins_origin, lon scaled down
+////////////////////////////////////////////////////////////////////////////////
+#define INS_K1        (3.0f/INS_NAV)                        // 3rd order complementary filter gains
+#define INS_K2        (3.0f/(INS_NAV*INS_NAV))
+#define INS_K3        (1.0f/(INS_NAV*INS_NAV*INS_NAV))
+#define INS_ACC_SCALE (1.0f/1.11318845f)                    // cm/s^2 to lat*10^7/s^2
+#define INS_KV        0.2f                                  // part of the receiver velocity error corrected with each fix
+#define INS_BIAS_MAX  50.0f                                 // acc bias limit, about 0.05G
+#define INS_RESET     5000                                  // restart from the GPS above this error (55m)
+
+#define INS_CTRL_NONE    0
+#define INS_CTRL_POSHOLD 1
+#define INS_CTRL_RATE    2
+
+static uint8_t ins_valid;
+static int32_t ins_origin[2];
+static float   ins_pos[2];
+static float   ins_vel[2];
+static float   ins_bias[2];
+static float   ins_error[2];                       // GPS - estimate, updated with every good GPS read
+static float   ins_hist[INS_GPS_DELAY][2];         // estimated positions of the last INS_GPS_DELAY*100ms
+#if defined(UBLOX_PVT)
+static float   ins_hist_vel[INS_GPS_DELAY][2];     // and velocities
+#endif
+static uint8_t ins_hist_index;
+static uint8_t ins_controller;                     // nav controller run by GPS_ins_nav at 50Hz
+#endif
+
 ////////////////////////////////////////////////////////////////////////////////
 // Location & Navigation
 ////////////////////////////////////////////////////////////////////////////////
@@ -472,9 +541,6 @@ void SerialGpsPrint(const char PROGMEM * str) {
   char b;
   while(str && (b = pgm_read_byte(str++))) {
     SerialWrite(GPS_SERIAL, b); 
-#if defined(UBLOX)
-    delay(5);
-#endif      
     }
   }
 #endif
@@ -486,77 +552,107 @@ const uint8_t UBLOX_INIT[] PROGMEM = {                          // PROGMEM array
   0xB5,0x62,0x06,0x01,0x03,0x00,0xF0,0x00,0x00,0xFA,0x0F,
   0xB5,0x62,0x06,0x01,0x03,0x00,0xF0,0x02,0x00,0xFC,0x13,
   0xB5,0x62,0x06,0x01,0x03,0x00,0xF0,0x04,0x00,0xFE,0x17,
+#if defined(UBLOX_PVT)
+  0xB5,0x62,0x06,0x01,0x03,0x00,0x01,0x02,0x00,0x0D,0x46,                            //disable POSLLH
+  0xB5,0x62,0x06,0x01,0x03,0x00,0x01,0x03,0x00,0x0E,0x48,                            //disable STATUS
+  0xB5,0x62,0x06,0x01,0x03,0x00,0x01,0x06,0x00,0x11,0x4E,                            //disable SOL
+  0xB5,0x62,0x06,0x01,0x03,0x00,0x01,0x12,0x00,0x1D,0x66,                            //disable VELNED
+  0xB5,0x62,0x06,0x01,0x03,0x00,0x01,0x07,0x01,0x13,0x51,                            //set PVT MSG rate
+#else
   0xB5,0x62,0x06,0x01,0x03,0x00,0x01,0x02,0x01,0x0E,0x47,                            //set POSLLH MSG rate
   0xB5,0x62,0x06,0x01,0x03,0x00,0x01,0x03,0x01,0x0F,0x49,                            //set STATUS MSG rate
   0xB5,0x62,0x06,0x01,0x03,0x00,0x01,0x06,0x01,0x12,0x4F,                            //set SOL MSG rate
   0xB5,0x62,0x06,0x01,0x03,0x00,0x01,0x12,0x01,0x1E,0x67,                            //set VELNED MSG rate
+#endif
   0xB5,0x62,0x06,0x16,0x08,0x00,0x03,0x07,0x03,0x00,0x51,0x08,0x00,0x00,0x8A,0x41,   //set WAAS to EGNOS
+#if defined(UBLOX_PVT)
+  0xB5, 0x62, 0x06, 0x08, 0x06, 0x00, 0x64, 0x00, 0x01, 0x00, 0x01, 0x00, 0x7A, 0x12 //set rate to 10Hz
+#else
   0xB5, 0x62, 0x06, 0x08, 0x06, 0x00, 0xC8, 0x00, 0x01, 0x00, 0x01, 0x00, 0xDE, 0x6A //set rate to 5Hz
+#endif
   };
 #endif
 
+////////////////////////////////////////////////////////////////////////////////////
+// GPS detection and configuration
+// It runs from GPS_NewData, one short step per call, so the boot does not wait for the GPS
+// and a GPS connected later (or that lost its configuration) is found without a reboot.
+//
+#define GPS_DETECT_BAUD      0    // sending the baudrate command at each speed of init_speed[]
+#define GPS_DETECT_CONFIG    1    // sending the configuration at GPS_BAUD, one message per call
+#define GPS_DETECT_WAIT      2    // waiting for a valid frame
+#define GPS_DETECT_DONE      3
+
+#define GPS_DETECT_SETTLE    200  // ms for the receiver to change its baudrate
+#define GPS_DETECT_ACK_TIME  250  // ms to wait for the ACK of a UBX configuration message
+#define GPS_DETECT_RETRY     3    // sends of a configuration message before starting again from the baudrate
+#define GPS_DETECT_WAIT_TIME 3000 // ms without a valid frame before starting again
+#define GPS_DETECT_LOST_TIME 5000 // ms without a frame, when not armed, before detecting again
+#define GPS_PROMINI_DETECT   5000 // ms after the boot to find a GPS, then the port goes back to MSP
+
+static uint8_t  GPS_detect_state;
+static uint8_t  GPS_detect_step;  // baudrate index, then configuration message (byte offset in UBLOX_INIT)
+static uint8_t  GPS_detect_retry;
+static uint8_t  GPS_detect_sent;  // a UBX configuration message waits for its ACK
+static uint32_t GPS_detect_timer; // millis() when the current wait ends
+
 void GPS_SerialInit(void) {
   SerialOpen(GPS_SERIAL,GPS_BAUD);
-  delay(1000);
+  GPS_detect_state = GPS_DETECT_BAUD;
+  GPS_detect_step = 0;
+  }
+
+#if defined(UBLOX) || defined(INIT_MTK_GPS)
+static void GPS_send_baud_command(void) {
 #if defined(UBLOX)
-  for(uint8_t i=0;i<5;i++){
-    SerialOpen(GPS_SERIAL,init_speed[i]);          // switch UART speed for sending SET BAUDRATE command (NMEA mode)
 #if (GPS_BAUD==19200)
-    SerialGpsPrint(PSTR("$PUBX,41,1,0003,0001,19200,0*23\r\n"));     // 19200 baud - minimal speed for 5Hz update rate
+  SerialGpsPrint(PSTR("$PUBX,41,1,0003,0001,19200,0*23\r\n"));     // 19200 baud - minimal speed for 5Hz update rate
 #endif  
 #if (GPS_BAUD==38400)
-    SerialGpsPrint(PSTR("$PUBX,41,1,0003,0001,38400,0*26\r\n"));     // 38400 baud
+  SerialGpsPrint(PSTR("$PUBX,41,1,0003,0001,38400,0*26\r\n"));     // 38400 baud
 #endif  
 #if (GPS_BAUD==57600)
-    SerialGpsPrint(PSTR("$PUBX,41,1,0003,0001,57600,0*2D\r\n"));     // 57600 baud
+  SerialGpsPrint(PSTR("$PUBX,41,1,0003,0001,57600,0*2D\r\n"));     // 57600 baud
 #endif  
 #if (GPS_BAUD==115200)
-    SerialGpsPrint(PSTR("$PUBX,41,1,0003,0001,115200,0*1E\r\n"));    // 115200 baud
+  SerialGpsPrint(PSTR("$PUBX,41,1,0003,0001,115200,0*1E\r\n"));    // 115200 baud
 #endif  
-    while(!SerialTXfree(GPS_SERIAL)) delay(10);
-    }
-  delay(200);
-  SerialOpen(GPS_SERIAL,GPS_BAUD);  
-  for(uint8_t i=0; i<sizeof(UBLOX_INIT); i++) {                        // send configuration data in UBX protocol
-    SerialWrite(GPS_SERIAL, pgm_read_byte(UBLOX_INIT+i));
-    delay(5); //simulating a 38400baud pace (or less), otherwise commands are not accepted by the device.
-    }
-#elif defined(INIT_MTK_GPS)                              // MTK GPS setup
-  for(uint8_t i=0;i<5;i++){
-    SerialOpen(GPS_SERIAL,init_speed[i]);                // switch UART speed for sending SET BAUDRATE command
+#else
 #if (GPS_BAUD==19200)
-    SerialGpsPrint(PSTR("$PMTK251,19200*22\r\n"));     // 19200 baud - minimal speed for 5Hz update rate
+  SerialGpsPrint(PSTR("$PMTK251,19200*22\r\n"));     // 19200 baud - minimal speed for 5Hz update rate
 #endif  
 #if (GPS_BAUD==38400)
-    SerialGpsPrint(PSTR("$PMTK251,38400*27\r\n"));     // 38400 baud
+  SerialGpsPrint(PSTR("$PMTK251,38400*27\r\n"));     // 38400 baud
 #endif  
 #if (GPS_BAUD==57600)
-    SerialGpsPrint(PSTR("$PMTK251,57600*2C\r\n"));     // 57600 baud
+  SerialGpsPrint(PSTR("$PMTK251,57600*2C\r\n"));     // 57600 baud
 #endif  
 #if (GPS_BAUD==115200)
-    SerialGpsPrint(PSTR("$PMTK251,115200*1F\r\n"));    // 115200 baud
+  SerialGpsPrint(PSTR("$PMTK251,115200*1F\r\n"));    // 115200 baud
 #endif  
-    while(!SerialTXfree(GPS_SERIAL)) delay(80);
-    }
-
-  SerialGpsPrint(MTK_NAVTHRES_OFF);
-  while(!SerialTXfree(GPS_SERIAL)) delay(80);
-  SerialGpsPrint(SBAS_ON);
-  while(!SerialTXfree(GPS_SERIAL)) delay(80);
-  SerialGpsPrint(WAAS_ON);
-  while(!SerialTXfree(GPS_SERIAL)) delay(80);
-  SerialGpsPrint(SBAS_TEST_MODE);
-  while(!SerialTXfree(GPS_SERIAL)) delay(80);
-  SerialGpsPrint(MTK_OUTPUT_5HZ);           // 5 Hz update rate
+#endif
+  }
+#endif
 
+#if defined(INIT_MTK_GPS) && !defined(UBLOX)
+// MTK configuration sentences in sending order, 0 after the last
+static const char * GPS_mtk_config(uint8_t step) {
+  switch (step) {
+    case 0: return MTK_NAVTHRES_OFF;
+    case 1: return SBAS_ON;
+    case 2: return WAAS_ON;
+    case 3: return SBAS_TEST_MODE;
+    case 4: return MTK_OUTPUT_5HZ;           // 5 Hz update rate
 #if defined(NMEA)
-  SerialGpsPrint(MTK_SET_NMEA_SENTENCES); // only GGA and RMC sentence
-#endif     
+    case 5: return MTK_SET_NMEA_SENTENCES;   // only GGA and RMC sentence
+#endif
 #if defined(MTK_BINARY19) || defined(MTK_BINARY16)
-  SerialGpsPrint(MTK_SET_BINARY);
+    case 5: return MTK_SET_BINARY;
 #endif
-#endif  //elif init_mtk_gps
+    }
+  return 0;
   }
+#endif
 
 //Main GPS nav loop. Called by the task scheduler
 void GPS_NewData(void) {
@@ -568,6 +664,7 @@ void GPS_NewData(void) {
       GPS_Process_data();
       }
     }
+  GPS_detect();
   
   // Check for stalled GPS, if no frames seen for 1.2sec then consider it LOST
   if ((millis() - GPS_last_frame_seen) > 1200)
@@ -619,6 +716,14 @@ void GPS_Process_data()
         }
       }
 
+    //Position in the local frame, the scaling follows large latitude changes only
+    if (GPS_cm_per_lon == 0) GPS_set_origin(GPS_coord);
+    if (abs(GPS_coord[LAT] - GPS_scale_lat) > GPS_SCALE_REFRESH) {
+      GPS_calc_longitude_scaling(GPS_coord[LAT]);
+      GPS_update_local_targets();
+      }
+    GPS_to_local(GPS_coord, GPS_local);
+
     //dTnav calculation
     //Time for calculating x,y speed and navigation pids
     dTnav = (float)(millis() - nav_loopTimer)/ 1000.0;
@@ -628,8 +733,8 @@ void GPS_Process_data()
     dTnav = min(dTnav, 1.0);  
 
     //calculate distance and bearings for gui and other stuff continously - From home to copter
-    GPS_bearing(&GPS_coord[LAT],&GPS_coord[LON],&GPS_home[LAT],&GPS_home[LON],&dir);
-    GPS_distance_cm(&GPS_coord[LAT],&GPS_coord[LON],&GPS_home[LAT],&GPS_home[LON],&dist);
+    GPS_bearing(GPS_local,GPS_home_local,&dir);
+    GPS_distance_cm(GPS_local,GPS_home_local,&dist);
     GPS_distanceToHome = dist/100;
     GPS_directionToHome = dir/100;
 
@@ -647,22 +752,28 @@ void GPS_Process_data()
 
     //calculate the current velocity based on gps coordinates continously to get a valid speed at the moment when we start navigating
     GPS_calc_velocity();        
+#if defined(INS_NAV)
+    GPS_ins_correct();          //Correct the inertial estimate, it replaces actual_speed when valid
+#endif
 
     //Navigation state engine
     if (f.GPS_mode != GPS_MODE_NONE)    //ok we are navigating ###0002 
       { 
+#if defined(INS_NAV)
+      ins_controller = INS_CTRL_NONE;               //Set again by GPS_calc_poshold or GPS_calc_nav_rate below
+#endif
 
       //do gps nav calculations here, these are common for nav and poshold  
-      GPS_bearing(&GPS_coord[LAT],&GPS_coord[LON],&GPS_WP[LAT],&GPS_WP[LON],&target_bearing);
+      GPS_bearing(GPS_local,GPS_WP_local,&target_bearing);
       if (GPS_conf.lead_filter)
         {
-        GPS_distance_cm(&GPS_coord_lead[LAT],&GPS_coord_lead[LON],&GPS_WP[LAT],&GPS_WP[LON],&wp_distance);
-        GPS_calc_location_error(&GPS_WP[LAT],&GPS_WP[LON],&GPS_coord_lead[LAT],&GPS_coord_lead[LON]);
+        GPS_distance_cm(GPS_local_lead,GPS_WP_local,&wp_distance);
+        GPS_calc_location_error(GPS_WP_local,GPS_local_lead);
         }
       else
         {
-        GPS_distance_cm(&GPS_coord[LAT],&GPS_coord[LON],&GPS_WP[LAT],&GPS_WP[LON],&wp_distance);
-        GPS_calc_location_error(&GPS_WP[LAT],&GPS_WP[LON],&GPS_coord[LAT],&GPS_coord[LON]);
+        GPS_distance_cm(GPS_local,GPS_WP_local,&wp_distance);
+        GPS_calc_location_error(GPS_WP_local,GPS_local);
         }
 
       // Adjust altitude 
@@ -780,6 +891,12 @@ void GPS_Process_data()
           speed = GPS_calc_desired_speed(GPS_conf.nav_speed_max, GPS_conf.slow_nav); 
           GPS_calc_nav_rate(speed);
           GPS_adjust_heading();
+          #if defined(MISSION_SD)
+            missionSDPrefetch();								//Reads the next steps from the card while flying to this one
+          #endif
+          #if defined(MISSION_RAM)
+            missionCachePrefetch();								//Next window of a mission longer than MISSION_RAM
+          #endif
 
           if ((wp_distance <= GPS_conf.wp_radius) || check_missed_wp())			//This decides what happen when we reached the WP coordinates
             {         
@@ -926,8 +1043,10 @@ void GPS_adjust_heading()
       magHold = wrap_18000((GPS_directionToPoi*100)-18000)/100;
     else 
       {
-      GPS_bearing(&GPS_coord[LAT],&GPS_coord[LON],&GPS_poi[LAT],&GPS_poi[LON],&GPS_directionToPoi);
-      GPS_distance_cm(&GPS_coord[LAT],&GPS_coord[LON],&GPS_poi[LAT],&GPS_poi[LON],&wp_distance);
+      int32_t poi[2];
+      GPS_to_local(GPS_poi,poi);
+      GPS_bearing(GPS_local,poi,&GPS_directionToPoi);
+      GPS_distance_cm(GPS_local,poi,&wp_distance);
       magHold = GPS_directionToPoi /100;
       }
     }
@@ -1095,15 +1214,6 @@ int16_t constrain_int16(int16_t amt, int16_t low, int16_t high) {
   return ((amt)<(low)?(low):((amt)>(high)?(high):(amt)));
   }
 ////////////////////////////////////////////////////////////////////////////////////
-// this is used to offset the shrinking longitude as we go towards the poles
-// It's ok to calculate this once per waypoint setting, since it changes a little within the reach of a multicopter
-//
-void GPS_calc_longitude_scaling(int32_t lat) {
-
-  GPS_scaleLonDown = cos(lat * 1.0e-7f * 0.01745329251f);
-  }
-
-////////////////////////////////////////////////////////////////////////////////////
 // Sets the waypoint to navigate, reset neccessary variables and calculate initial values
 //
 void GPS_set_next_wp(int32_t* lat_to, int32_t* lon_to, int32_t* lat_from, int32_t* lon_from) {
@@ -1114,14 +1224,27 @@ void GPS_set_next_wp(int32_t* lat_to, int32_t* lon_to, int32_t* lat_from, int32_
   GPS_FROM[LAT] = *lat_from;
   GPS_FROM[LON] = *lon_from;
 
-  GPS_calc_longitude_scaling(*lat_to);
+  if (GPS_cm_per_lon == 0) GPS_set_origin(GPS_FROM);
+  GPS_to_local(GPS_WP, GPS_WP_local);
+  GPS_to_local(GPS_FROM, GPS_FROM_local);
 
-  GPS_bearing(&GPS_FROM[LAT],&GPS_FROM[LON],&GPS_WP[LAT],&GPS_WP[LON],&target_bearing);
-  GPS_distance_cm(&GPS_FROM[LAT],&GPS_FROM[LON],&GPS_WP[LAT],&GPS_WP[LON],&wp_distance);
-  GPS_calc_location_error(&GPS_WP[LAT],&GPS_WP[LON],&GPS_FROM[LAT],&GPS_FROM[LON]);
+  GPS_bearing(GPS_FROM_local,GPS_WP_local,&target_bearing);
+  GPS_distance_cm(GPS_FROM_local,GPS_WP_local,&wp_distance);
+  GPS_calc_location_error(GPS_WP_local,GPS_FROM_local);
   waypoint_speed_gov = GPS_conf.nav_speed_min;
   original_target_bearing = target_bearing;
 
+  //unit vector of the track line
+  int32_t dn = GPS_WP_local[LAT] - GPS_FROM_local[LAT];
+  int32_t de = GPS_WP_local[LON] - GPS_FROM_local[LON];
+  uint8_t s = GPS_local_shift(abs(dn), abs(de));
+  int32_t len = wp_distance >> s;
+  if (len) {
+    GPS_track[LAT] = (dn >> s) * 32767 / len;
+    GPS_track[LON] = (de >> s) * 32767 / len;
+    }
+  else GPS_track[LAT] = GPS_track[LON] = 0;
+
   }
 
 ////////////////////////////////////////////////////////////////////////////////////
@@ -1135,23 +1258,94 @@ static bool check_missed_wp(void) {
   }
 
 ////////////////////////////////////////////////////////////////////////////////////
-// Get distance between two points in cm
-// Get bearing from pos1 to pos2, returns an 1deg = 100 precision
+// Local navigation frame
+// Every position is converted once to cm north ([LAT]) and east ([LON]) of GPS_origin, the home position
+// (or the first fix before home is set). Bearing, distance, crosstrack and location error are integer math
+// on these offsets. The Q15 scaling is refreshed only when the latitude moves by GPS_SCALE_REFRESH.
+//
+// (a*q)>>15 without overflow, for |a| < 2^29 and |q| < 2^16
+static int32_t GPS_mul_q15(int32_t a, int32_t q) {
+  return (a >> 15) * q + (((a & 0x7FFF) * q) >> 15);
+  }
+
+static void GPS_to_local(int32_t* coord, int32_t* local) {
+  local[LAT] = GPS_mul_q15(coord[LAT] - GPS_origin[LAT], GPS_CM_PER_LAT);
+  local[LON] = GPS_mul_q15(coord[LON] - GPS_origin[LON], GPS_cm_per_lon);
+  }
+
+static void GPS_update_local_targets(void) {
+  if (f.GPS_FIX_HOME) GPS_to_local(GPS_home, GPS_home_local);   // GPS_home is not a position before (0,0 is out of GPS_mul_q15 range)
+  GPS_to_local(GPS_WP, GPS_WP_local);
+  GPS_to_local(GPS_FROM, GPS_FROM_local);
+  }
+
+void GPS_calc_longitude_scaling(int32_t lat) {
+  GPS_scaleLonDown = cos(lat * 1.0e-7f * 0.01745329251f);
+  GPS_cm_per_lon = GPS_CM_PER_LAT * GPS_scaleLonDown;
+  GPS_scale_lat = lat;
+  }
 
-void GPS_bearing(int32_t* lat1, int32_t* lon1, int32_t* lat2, int32_t* lon2, int32_t* bearing) {
+static void GPS_set_origin(int32_t* coord) {
+  GPS_origin[LAT] = coord[LAT];
+  GPS_origin[LON] = coord[LON];
+  GPS_calc_longitude_scaling(coord[LAT]);
+  GPS_update_local_targets();
+  }
+
+// Home moved from outside (MSP WP#0): distance, direction and fence follow it
+void GPS_set_home(int32_t* coord) {
+  GPS_home[LAT] = coord[LAT];
+  GPS_home[LON] = coord[LON];
+  if (f.GPS_FIX_HOME) GPS_to_local(GPS_home, GPS_home_local);
+  }
 
-  int32_t off_x = *lon2 - *lon1;
-  int32_t off_y = (*lat2 - *lat1) / GPS_scaleLonDown;
+// Shift count that brings both components below 2^15
+static uint8_t GPS_local_shift(uint32_t x, uint32_t y) {
+  uint8_t s = 0;
+  x |= y;
+  while (x >> s > 0x7FFF) s++;
+  return s;
+  }
 
-  *bearing = 9000 + atan2(-off_y, off_x) * 5729.57795f;      //Convert the output redians to 100xdeg
-  if (*bearing < 0) *bearing += 36000;
+static uint16_t GPS_isqrt(uint32_t n) {
+  uint32_t root = 0, bit = 1UL << 30;
+  while (bit > n) bit >>= 2;
+  while (bit) {
+    if (n >= root + bit) {n -= root + bit; root = (root >> 1) + bit;}
+    else root >>= 1;
+    bit >>= 2;
+    }
+  return root;
   }
 
-void GPS_distance_cm(int32_t* lat1, int32_t* lon1, int32_t* lat2, int32_t* lon2,uint32_t* dist) {
+// Get distance between two points in cm
+void GPS_distance_cm(int32_t* from, int32_t* to, uint32_t* dist) {
+  uint32_t dn = abs(to[LAT] - from[LAT]);
+  uint32_t de = abs(to[LON] - from[LON]);
+  uint8_t s = GPS_local_shift(dn, de);
+  dn >>= s; de >>= s;
+  *dist = (uint32_t)GPS_isqrt(dn*dn + de*de) << s;
+  }
 
-  float dLat = (float)(*lat2 - *lat1);                                    // difference of latitude in 1/10 000 000 degrees
-  float dLon = (float)(*lon2 - *lon1) * GPS_scaleLonDown; //x
-  *dist = sqrt(sq(dLat) + sq(dLon)) * 1.11318845f;
+// Get bearing from pos1 to pos2, returns an 1deg = 100 precision
+// atan(r) = 45r + r(1-r)(14.02+3.80r) deg on the first octant, max error 0.09deg
+void GPS_bearing(int32_t* from, int32_t* to, int32_t* bearing) {
+  int32_t n = to[LAT] - from[LAT];
+  int32_t e = to[LON] - from[LON];
+  uint32_t an = abs(n), ae = abs(e);
+  uint8_t s = GPS_local_shift(an, ae);
+  int32_t ang = 0;
+
+  an >>= s; ae >>= s;
+  if (an | ae) {
+    uint32_t r = (an < ae ? an << 15 : ae << 15) / max(an, ae);     // Q15, 0..1
+    uint32_t rr = (r * (32768 - r)) >> 15;
+    ang = ((4500 * r) >> 15) + ((rr * (1402 + ((380 * r) >> 15))) >> 15);
+    if (ae > an) ang = 9000 - ang;
+    }
+  if (n < 0) ang = 18000 - ang;
+  if (e < 0) ang = 36000 - ang;
+  *bearing = wrap_36000(ang);
   }
 
 //*******************************************************************************************************
@@ -1187,6 +1381,13 @@ static void GPS_calc_velocity(void){
     }
   init=1;
 
+#if defined(UBLOX_PVT)
+  if (GPS_velocity_ok) {        // the receiver velocity has no differencing noise and no lag of one GPS period
+    actual_speed[_X] = GPS_velocity[LON] * GPS_VEL_SCALE;
+    actual_speed[_Y] = GPS_velocity[LAT] * GPS_VEL_SCALE;
+    }
+#endif
+
   last[LON] = GPS_coord[LON];
   last[LAT] = GPS_coord[LAT];
 
@@ -1194,28 +1395,125 @@ static void GPS_calc_velocity(void){
     {
     GPS_coord_lead[LON] = xLeadFilter.get_position(GPS_coord[LON], actual_speed[_X], GPS_LAG);
     GPS_coord_lead[LAT] = yLeadFilter.get_position(GPS_coord[LAT], actual_speed[_Y], GPS_LAG);
+    GPS_to_local(GPS_coord_lead, GPS_local_lead);
     }
 
   }
 
 ////////////////////////////////////////////////////////////////////////////////////
-// Calculate a location error between two gps coordinates
-// Because we are using lat and lon to do our distance errors here's a quick chart:
+// Calculate a location error between two local positions
+// The error is kept in lat*10^7 units, the PID gains are tuned for them. Here's a quick chart:
 //   100  = 1m
 //  1000  = 11m    = 36 feet
 //  1800  = 19.80m = 60 feet
 //  3000  = 33m
 // 10000  = 111m
 //
-static void GPS_calc_location_error( int32_t* target_lat, int32_t* target_lng, int32_t* gps_lat, int32_t* gps_lng ) {
-  error[LON] = (float)(*target_lng - *gps_lng) * GPS_scaleLonDown;  // X Error
-  error[LAT] = *target_lat - *gps_lat; // Y Error
+static void GPS_calc_location_error(int32_t* target, int32_t* pos) {
+  error[LON] = GPS_mul_q15(target[LON] - pos[LON], GPS_LAT_PER_CM);  // X Error
+  error[LAT] = GPS_mul_q15(target[LAT] - pos[LAT], GPS_LAT_PER_CM);  // Y Error
+  }
+
+#if defined(INS_NAV)
+////////////////////////////////////////////////////////////////////////////////////
+// Inertial navigation
+// The horizontal acc (north/east, from getEstimatedHorizontalAcc) is integrated at 50Hz in GPS_ins_nav
+// and corrected with the GPS position by a 3rd order complementary filter with a time constant of INS_NAV sec.
+// A fix is compared with the estimate of INS_GPS_DELAY*100ms before, when the receiver measured it.
+// With UBLOX_PVT a good receiver velocity also corrects the velocity, by INS_KV of its error per fix.
+// While the estimate is valid it gives actual_speed, and the poshold and nav rate PIDs run on it at 50Hz.
+//
+static void GPS_ins_correct(void) {
+  float p[2];
+  uint8_t axis, i;
+
+  if (ins_valid) {
+    p[LAT] = GPS_coord[LAT] - ins_origin[LAT];
+    p[LON] = (float)(GPS_coord[LON] - ins_origin[LON]) * GPS_scaleLonDown;
+    for (axis=0;axis<2;axis++) {
+      ins_error[axis] = p[axis] - ins_hist[ins_hist_index][axis];
+      if (abs(ins_error[axis]) > INS_RESET) ins_valid = 0;       // lost or far off, start again from the GPS
+#if defined(UBLOX_PVT)
+      if (GPS_velocity_ok) ins_vel[axis] += (actual_speed[axis] - ins_hist_vel[ins_hist_index][axis]) * INS_KV;
+#endif
+      }
+    }
+  if (!ins_valid) {
+    for (axis=0;axis<2;axis++) {
+      ins_origin[axis] = GPS_coord[axis];
+      ins_pos[axis]    = 0;
+      ins_vel[axis]    = actual_speed[axis];
+      ins_bias[axis]   = 0;
+      ins_error[axis]  = 0;
+      for (i=0;i<INS_GPS_DELAY;i++) {
+        ins_hist[i][axis] = 0;
+#if defined(UBLOX_PVT)
+        ins_hist_vel[i][axis] = ins_vel[axis];
+#endif
+        }
+      }
+    ins_valid = 1;
+    }
+  actual_speed[_X] = ins_vel[_X];
+  actual_speed[_Y] = ins_vel[_Y];
+  }
+
+void GPS_ins_nav(void) {
+  static uint32_t ins_timer;
+  static uint8_t  ins_hist_step;
+  float acc[2];
+  float dt;
+  uint8_t axis;
+
+  dt = (currentTime - ins_timer) * 1e-6f;
+  ins_timer = currentTime;
+  if (!getEstimatedHorizontalAcc(acc)) return;
+  if (!f.GPS_FIX || GPS_numSat < 5) ins_valid = 0;           // back to the GPS rate PIDs until the next good read
+  if (!ins_valid) return;
+  dt = constrain(dt, 0.0f, 0.1f);
+
+  for (axis=0;axis<2;axis++) {
+    ins_bias[axis] += ins_error[axis] * INS_K3 * dt;
+    ins_bias[axis]  = constrain(ins_bias[axis], -INS_BIAS_MAX, INS_BIAS_MAX);
+    ins_vel[axis]  += (acc[axis] * INS_ACC_SCALE + ins_bias[axis] + ins_error[axis] * INS_K2) * dt;
+    ins_pos[axis]  += (ins_vel[axis] + ins_error[axis] * INS_K1) * dt;
+    actual_speed[axis] = ins_vel[axis];
+    }
+  if (++ins_hist_step >= 5) {                                 // keep an estimate every 100ms
+    ins_hist_step = 0;
+    ins_hist[ins_hist_index][LAT] = ins_pos[LAT];
+    ins_hist[ins_hist_index][LON] = ins_pos[LON];
+#if defined(UBLOX_PVT)
+    ins_hist_vel[ins_hist_index][LAT] = ins_vel[LAT];
+    ins_hist_vel[ins_hist_index][LON] = ins_vel[LON];
+#endif
+    if (++ins_hist_index >= INS_GPS_DELAY) ins_hist_index = 0;
+    }
+
+  if (f.GPS_mode == GPS_MODE_NONE) return;
+  if (ins_controller == INS_CTRL_POSHOLD) {
+    error[LON] = (float)(GPS_WP[LON] - ins_origin[LON]) * GPS_scaleLonDown - ins_pos[LON];
+    error[LAT] = (float)(GPS_WP[LAT] - ins_origin[LAT]) - ins_pos[LAT];
+    GPS_poshold_pid(dt);
+    }
+  else if (ins_controller == INS_CTRL_RATE) {
+    GPS_nav_rate_pid(dt);
+    }
   }
+#endif
 
 ////////////////////////////////////////////////////////////////////////////////////
 // Calculate nav_lat and nav_lon from the x and y error and the speed
 //
 static void GPS_calc_poshold(void) {
+#if defined(INS_NAV)
+  ins_controller = INS_CTRL_POSHOLD;
+  if (ins_valid) return;                                      // GPS_ins_nav runs it at 50Hz
+#endif
+  GPS_poshold_pid(dTnav);
+  }
+
+static void GPS_poshold_pid(float dt) {
   int32_t d;
   int32_t target_speed;
   uint8_t axis;
@@ -1226,10 +1524,10 @@ static void GPS_calc_poshold(void) {
     rate_error[axis] = target_speed - actual_speed[axis]; // calc the speed error
 
     nav[axis]      =
-      get_P(rate_error[axis],                                               &poshold_ratePID_PARAM)
-      +get_I(rate_error[axis] + error[axis], &dTnav, &poshold_ratePID[axis], &poshold_ratePID_PARAM);
+      get_P(rate_error[axis],                                            &poshold_ratePID_PARAM)
+      +get_I(rate_error[axis] + error[axis], &dt, &poshold_ratePID[axis], &poshold_ratePID_PARAM);
 
-    d = get_D(error[axis],                    &dTnav, &poshold_ratePID[axis], &poshold_ratePID_PARAM);
+    d = get_D(error[axis],                    &dt, &poshold_ratePID[axis], &poshold_ratePID_PARAM);
 
     d = constrain(d, -2000, 2000);
 
@@ -1246,12 +1544,11 @@ static void GPS_calc_poshold(void) {
 ////////////////////////////////////////////////////////////////////////////////////
 // Calculate the desired nav_lat and nav_lon for distance flying such as RTH and WP
 //
+static int32_t nav_target_speed[2];             // set with every GPS read, used by GPS_nav_rate_pid
+
 static void GPS_calc_nav_rate( uint16_t max_speed)
   {
   float trig[2];
-  int32_t target_speed[2];
-  int32_t tilt;
-  uint8_t axis;
 
   GPS_update_crosstrack();
   int16_t cross_speed = crosstrack_error * (GPS_conf.crosstrack_gain / 100.0);  //check is it ok ?
@@ -1262,17 +1559,28 @@ static void GPS_calc_nav_rate( uint16_t max_speed)
   trig[_X] = cos(temp);
   trig[_Y] = sin(temp);
 
-  target_speed[_X] = max_speed * trig[_X] - cross_speed * trig[_Y];
-  target_speed[_Y] = cross_speed * trig[_X] + max_speed * trig[_Y];
+  nav_target_speed[_X] = max_speed * trig[_X] - cross_speed * trig[_Y];
+  nav_target_speed[_Y] = cross_speed * trig[_X] + max_speed * trig[_Y];
+
+#if defined(INS_NAV)
+  ins_controller = INS_CTRL_RATE;
+  if (ins_valid) return;                                      // GPS_ins_nav runs it at 50Hz
+#endif
+  GPS_nav_rate_pid(dTnav);
+  }
+
+static void GPS_nav_rate_pid(float dt)
+  {
+  uint8_t axis;
 
   for (axis=0;axis<2;axis++)
     {
-    rate_error[axis] = target_speed[axis] - actual_speed[axis];
+    rate_error[axis] = nav_target_speed[axis] - actual_speed[axis];
     rate_error[axis] = constrain(rate_error[axis],-1000,1000);
     nav[axis]      =
-      get_P(rate_error[axis],                        &navPID_PARAM)
-      +get_I(rate_error[axis], &dTnav, &navPID[axis], &navPID_PARAM)
-      +get_D(rate_error[axis], &dTnav, &navPID[axis], &navPID_PARAM);
+      get_P(rate_error[axis],                     &navPID_PARAM)
+      +get_I(rate_error[axis], &dt, &navPID[axis], &navPID_PARAM)
+      +get_D(rate_error[axis], &dt, &navPID[axis], &navPID_PARAM);
 
     //			nav[axis] = constrain(nav[axis],-NAV_BANK_MAX,NAV_BANK_MAX);
     nav[axis]  = constrain_int16(nav[axis], -GPS_conf.nav_bank_max, GPS_conf.nav_bank_max);
@@ -1285,8 +1593,11 @@ static void GPS_update_crosstrack(void)
   // Crosstrack Error
   // ----------------
   // If we are too far off or too close we don't do track following
-  float temp = (target_bearing - original_target_bearing) * RADX100;
-  crosstrack_error = sin(temp) * wp_distance;	 // Meters we are off track line
+  // Cross product of the copter to WP vector with the track direction, in cm
+  int32_t dn = GPS_WP_local[LAT] - GPS_local[LAT];
+  int32_t de = GPS_WP_local[LON] - GPS_local[LON];
+  int32_t cross = GPS_mul_q15(de, GPS_track[LAT]) - GPS_mul_q15(dn, GPS_track[LON]);
+  crosstrack_error = constrain(cross, -32767, 32767);	 // cm we are off track line
   }
 
 ////////////////////////////////////////////////////////////////////////////////////
@@ -1342,125 +1653,172 @@ bool GPS_newFrame(char c) {
   }
 
 #if defined(NMEA)
-/* This is a light implementation of a GPS frame decoding
-This should work with most of modern GPS devices configured to output NMEA frames.
-It assumes there are some NMEA GGA frames to decode on the serial bus
+/* NMEA frame decoding, driven by the nmea_fields[] table
+Any talker ID is accepted (GP, GN for multi constellation receivers, GL, GA, BD...): a sentence is
+identified by the last 3 letters of its first field.
+The number of a field listed in the table is built digit by digit as the characters come in, there is no copy
+of the field. The values go to nmea_data, and to the GPS variables only when the checksum is good.
 Here we use only the following data :
-- latitude
-- longitude
-- GPS fix is/is not ok
-- GPS num sat (4 is enough to be +/- reliable)
-- GPS altitude
-- GPS speed
+- GGA : latitude, longitude, GPS fix is/is not ok, GPS num sat, HDOP, GPS altitude
+- RMC or VTG : GPS speed, ground course
+- GSA : HDOP
+A good GGA is a new position for the navigation.
 */
-#define FRAME_GGA  1
-#define FRAME_RMC  2
+#define NMEA_GGA  1
+#define NMEA_RMC  2
+#define NMEA_VTG  3
+#define NMEA_GSA  4
+
+enum nmea_kind {
+  NMEA_NONE = 0,
+  NMEA_LAT,              // ddmm.mmmmm
+  NMEA_NS,
+  NMEA_LON,              // dddmm.mmmmm
+  NMEA_EW,
+  NMEA_FIX,
+  NMEA_SATS,
+  NMEA_HDOP,
+  NMEA_ALT,              // m
+  NMEA_SPEED,            // knots
+  NMEA_COURSE            // deg
+  };
 
-uint16_t grab_fields(char* src, uint8_t mult) {  // convert string to uint16
-  uint8_t i;
-  uint16_t tmp = 0;
+typedef struct {
+  uint8_t sentence;
+  uint8_t field;
+  uint8_t kind;
+  } nmea_field_t;
+
+const nmea_field_t nmea_fields[] PROGMEM = {   // sorted by sentence and field
+  {NMEA_GGA, 2, NMEA_LAT},  {NMEA_GGA, 3, NMEA_NS},   {NMEA_GGA, 4, NMEA_LON},  {NMEA_GGA, 5, NMEA_EW},
+  {NMEA_GGA, 6, NMEA_FIX},  {NMEA_GGA, 7, NMEA_SATS}, {NMEA_GGA, 8, NMEA_HDOP}, {NMEA_GGA, 9, NMEA_ALT},
+  {NMEA_RMC, 7, NMEA_SPEED},{NMEA_RMC, 8, NMEA_COURSE},
+  {NMEA_VTG, 1, NMEA_COURSE},{NMEA_VTG, 5, NMEA_SPEED},
+  {NMEA_GSA, 16, NMEA_HDOP}
+  };
+#define NMEA_FIELDS (sizeof(nmea_fields)/sizeof(nmea_fields[0]))
+
+// decimals kept in the number of each kind, the number is the value * 10^decimals
+const uint8_t nmea_decimals[] PROGMEM = {0, 5,0,5,0, 0,0,2,0, 1,1};
+
+static struct {
+  int32_t  lat, lon;
+  int32_t  alt;
+  uint16_t speed;        // cm/s
+  uint16_t course;       // deg*10
+  uint16_t hdop;         // *100
+  uint8_t  sats;
+  uint8_t  fix;
+  } nmea_data;
+
+static uint32_t nmea_coord(uint32_t n) {   // ddmm.mmmmm * 10^5 to deg * 10^7
+  uint32_t deg = (n / 10000000UL) * 10000000UL;
+  return deg + (n - deg) * 5 / 3;
+  }
 
-  for(i=0; src[i]!=0; i++) {
-    if(src[i] == '.') {
-      i++;
-      if(mult==0)   break;
-      else  src[i+mult] = 0;
-      }
-    tmp *= 10;
-    if(src[i] >='0' && src[i] <='9') tmp += src[i]-'0';
+static void nmea_store(uint8_t kind, uint32_t n, char first) {
+  switch (kind) {
+    case NMEA_LAT:    nmea_data.lat = nmea_coord(n); break;
+    case NMEA_NS:     if (first == 'S') nmea_data.lat = -nmea_data.lat; break;
+    case NMEA_LON:    nmea_data.lon = nmea_coord(n); break;
+    case NMEA_EW:     if (first == 'W') nmea_data.lon = -nmea_data.lon; break;
+    case NMEA_FIX:    nmea_data.fix = (n > 0); break;
+    case NMEA_SATS:   nmea_data.sats = n; break;
+    case NMEA_HDOP:   nmea_data.hdop = min(n, 9999); break;
+    case NMEA_ALT:    nmea_data.alt = (first == '-') ? 0 : n; break;
+    case NMEA_SPEED:  nmea_data.speed = (n * 5144L) / 1000L; break;   //gps speed in cm/s will be used for navigation
+    case NMEA_COURSE: nmea_data.course = n; break;                    //ground course deg*10
     }
-  return tmp;
   }
 
-uint8_t hex_c(uint8_t n) {    // convert '0'..'9','A'..'F' to 0..15
-  n -= '0';
-  if(n>9)  n -= 7;
-  n &= 0x0F;
-  return n;
-  } 
-
-#define DIGIT_TO_VAL(_x)        (_x - '0')
-uint32_t GPS_coord_to_degrees(char* s) {
-  char *p, *q;
-  uint8_t deg = 0, min = 0;
-  unsigned int frac_min = 0;
-  uint8_t i;
-
-  // scan for decimal point or end of field
-  for (p = s; isdigit(*p); p++) ;
-  q = s;
-
-  // convert degrees
-  while ((p - q) > 2) {
-    if (deg)
-      deg *= 10;
-    deg += DIGIT_TO_VAL(*q++);
-    }
-  // convert minutes
-  while (p > q) {
-    if (min)
-      min *= 10;
-    min += DIGIT_TO_VAL(*q++);
-    }
-  // convert fractional minutes
-  // expect up to four digits, result is in
-  // ten-thousandths of a minute
-  if (*p == '.') {
-    q = p + 1;
-    for (i = 0; i < 4; i++) {
-      frac_min *= 10;
-      if (isdigit(*q))
-        frac_min += *q++ - '0';
-      }
+static bool nmea_commit(uint8_t sentence) {
+  switch (sentence) {
+    case NMEA_GGA:
+      f.GPS_FIX = nmea_data.fix;
+      if (nmea_data.fix) {
+        GPS_coord[LAT] = nmea_data.lat;
+        GPS_coord[LON] = nmea_data.lon;
+        GPS_altitude   = nmea_data.alt;   // altitude in meters
+        }
+      GPS_numSat = nmea_data.sats;
+      GPS_hdop   = nmea_data.hdop;
+      return true;
+    case NMEA_RMC:
+    case NMEA_VTG:
+      GPS_speed         = nmea_data.speed;
+      GPS_ground_course = nmea_data.course;
+      break;
+    case NMEA_GSA:
+      GPS_hdop = nmea_data.hdop;
+      break;
     }
-  return deg * 10000000UL + (min * 1000000UL + frac_min*100UL) / 6;
+  return false;
   }
 
-
-
 bool GPS_NMEA_newFrame(char c) {
-  uint8_t frameOK = 0;
-  static uint8_t param = 0, offset = 0, parity = 0;
-  static char string[15];
-  static uint8_t checksum_param, frame = 0;
-
-  if (c == '$') {
-    param = 0; offset = 0; parity = 0;
-    } else if (c == ',' || c == '*') {
-      string[offset] = 0;
-      if (param == 0) { //frame identification
-        frame = 0;
-        if (string[0] == 'G' && string[1] == 'P' && string[2] == 'G' && string[3] == 'G' && string[4] == 'A') frame = FRAME_GGA;
-        if (string[0] == 'G' && string[1] == 'P' && string[2] == 'R' && string[3] == 'M' && string[4] == 'C') frame = FRAME_RMC;
-        } else if (frame == FRAME_GGA) {
-          if      (param == 2)                     {GPS_coord[LAT] = GPS_coord_to_degrees(string);}
-          else if (param == 3 && string[0] == 'S') GPS_coord[LAT] = -GPS_coord[LAT];
-          else if (param == 4)                     {GPS_coord[LON] = GPS_coord_to_degrees(string);}
-          else if (param == 5 && string[0] == 'W') GPS_coord[LON] = -GPS_coord[LON];
-          else if (param == 6)                     {f.GPS_FIX = (string[0]  > '0');}
-          else if (param == 7)                     {GPS_numSat = grab_fields(string,0);}
-          else if (param == 9)                     {GPS_altitude = grab_fields(string,0);}  // altitude in meters added by Mis
-        } else if (frame == FRAME_RMC) {
-          if      (param == 7)                     {GPS_speed = ((uint32_t)grab_fields(string,1)*5144L)/1000L;}  //gps speed in cm/s will be used for navigation
-          else if (param == 8)                     {GPS_ground_course = grab_fields(string,1); }                 //ground course deg*10 
-          }
-        param++; offset = 0;
-        if (c == '*') checksum_param=1;
-        else parity ^= c;
-    } else if (c == '\r' || c == '\n') {
-      if (checksum_param) { //parity checksum
-        uint8_t checksum = hex_c(string[0]);
-        checksum <<= 4;
-        checksum += hex_c(string[1]);
-        if (checksum == parity) frameOK = 1;
+  static uint8_t  sentence, field, kind, decimals, frac;
+  static uint8_t  next;            // next nmea_fields[] entry of the sentence
+  static uint8_t  parity, checksum, checksum_param;
+  static uint32_t id, num;
+  static char     first;
+  bool frameOK = false;
+
+  if (c > ',') {                   // the characters of a field (digits, '.', '-', letters) come first, they are the most frequent
+    if (checksum_param) {
+      if (checksum_param < 3) {
+        c -= '0';
+        if (c > 9) c -= 7;         // 'A'..'F'
+        checksum = (checksum << 4) | (c & 0x0F);
+        checksum_param++;
         }
-      checksum_param=0;
       } else {
-        if (offset < 15) string[offset++] = c;
-        if (!checksum_param) parity ^= c;
+        parity ^= c;
+        if (kind != NMEA_NONE) {
+          if (c >= '0' && c <= '9') {
+            if (frac == 0xFF) num = num * 10 + (c - '0');
+            else if (frac < decimals) {num = num * 10 + (c - '0'); frac++;}
+            }
+          else if (c == '.') frac = 0;
+          if (!first) first = c;
+          }
+        else if (field == 0) id = (id << 8) | (uint8_t)c;
       }
-    if (frame) GPS_Present = 1;
-    return frameOK && (frame==FRAME_GGA);
+    } else if (c == ',' || c == '*') {
+      if (field == 0) { //frame identification, whatever the talker
+        id &= 0xFFFFFF;
+        if      (id == 0x474741) sentence = NMEA_GGA;
+        else if (id == 0x524D43) sentence = NMEA_RMC;
+        else if (id == 0x565447) sentence = NMEA_VTG;
+        else if (id == 0x475341) sentence = NMEA_GSA;
+        for (next = 0; next < NMEA_FIELDS && pgm_read_byte(&nmea_fields[next].sentence) != sentence; next++) ;
+        } else if (kind != NMEA_NONE) {
+          if (frac == 0xFF) frac = 0;
+          while (frac < decimals) {num *= 10; frac++;}
+          nmea_store(kind, num, first);
+        }
+      field++;
+      kind = NMEA_NONE;
+      if (next < NMEA_FIELDS && pgm_read_byte(&nmea_fields[next].sentence) == sentence && pgm_read_byte(&nmea_fields[next].field) == field) {
+        kind = pgm_read_byte(&nmea_fields[next].kind);
+        decimals = pgm_read_byte(&nmea_decimals[kind]);
+        next++;
+        }
+      num = 0; frac = 0xFF; first = 0;
+      if (c == '*') {checksum_param = 1; checksum = 0;}
+      else parity ^= c;
+    } else if (c == '$') {
+      sentence = 0; field = 0; kind = NMEA_NONE; next = NMEA_FIELDS;
+      id = 0; parity = 0; checksum_param = 0;
+    } else if (c == '\r' || c == '\n') {
+      if (checksum_param == 3 && checksum == parity) { //parity checksum
+        GPS_Present = 1;
+        frameOK = nmea_commit(sentence);
+        }
+      checksum_param = 0;
+      sentence = 0;
+      kind = NMEA_NONE;
+    }
+  return frameOK;
   }
 #endif //NMEA
 
@@ -1511,6 +1869,40 @@ struct ubx_nav_velned {
   uint32_t speed_accuracy;
   uint32_t heading_accuracy;
   };
+struct ubx_nav_pvt {
+  uint32_t time;  // GPS msToW
+  uint16_t year;
+  uint8_t month;
+  uint8_t day;
+  uint8_t hour;
+  uint8_t min;
+  uint8_t sec;
+  uint8_t valid;
+  uint32_t time_accuracy;
+  int32_t time_nsec;
+  uint8_t fix_type;
+  uint8_t fix_status;
+  uint8_t flags2;
+  uint8_t satellites;
+  int32_t longitude;
+  int32_t latitude;
+  int32_t altitude_ellipsoid;
+  int32_t altitude_msl;
+  uint32_t horizontal_accuracy;
+  uint32_t vertical_accuracy;
+  int32_t ned_north;  // mm/s
+  int32_t ned_east;
+  int32_t ned_down;
+  int32_t speed_2d;
+  int32_t heading_2d;  // deg * 100000
+  uint32_t speed_accuracy;  // mm/s
+  uint32_t heading_accuracy;
+  uint16_t position_DOP;
+  uint8_t res[6];
+  int32_t heading_vehicle;
+  int16_t mag_dec;
+  uint16_t mag_accuracy;
+  };
 
 enum ubs_protocol_bytes {
   PREAMBLE1 = 0xb5,
@@ -1523,6 +1915,7 @@ enum ubs_protocol_bytes {
   MSG_POSLLH = 0x2,
   MSG_STATUS = 0x3,
   MSG_SOL = 0x6,
+  MSG_PVT = 0x7,
   MSG_VELNED = 0x12,
   MSG_CFG_PRT = 0x00,
   MSG_CFG_RATE = 0x08,
@@ -1557,12 +1950,20 @@ static uint8_t _class;
 static uint8_t _disable_counter;
 static uint8_t _fix_ok;
 
+// ACK expected by GPS_detect for a configuration message
+static uint8_t _ack_class;
+static uint8_t _ack_id;
+static uint8_t _ack_ok;
+
 // Receive buffer
 static union {
   ubx_nav_posllh posllh;
   //    ubx_nav_status status;
   ubx_nav_solution solution;
   ubx_nav_velned velned;
+#if defined(UBLOX_PVT)
+  ubx_nav_pvt pvt;
+#endif
   uint8_t bytes[];
   } _buffer;
 
@@ -1634,6 +2035,10 @@ bool GPS_UBLOX_newFrame(uint8_t data){
   }
 
 bool UBLOX_parse_gps(void) {
+  if (_class == CLASS_ACK) {
+    if (_msg_id == MSG_ACK_ACK && _buffer.bytes[0] == _ack_class && _buffer.bytes[1] == _ack_id) _ack_ok = 1;
+    return false;
+    }
   switch (_msg_id) {
     case MSG_POSLLH:
       //i2c_dataset.time                = _buffer.posllh.time;
@@ -1655,6 +2060,25 @@ bool UBLOX_parse_gps(void) {
       GPS_speed         = _buffer.velned.speed_2d;  // cm/s
       GPS_ground_course = (uint16_t)(_buffer.velned.heading_2d / 10000);  // Heading 2D deg * 100000 rescaled to deg * 10
       break;
+#if defined(UBLOX_PVT)
+    case MSG_PVT:                  // position, velocity and their accuracies of one solution
+      _fix_ok = 0;
+      if((_buffer.pvt.fix_status & NAV_STATUS_FIX_VALID) && (_buffer.pvt.fix_type == FIX_3D || _buffer.pvt.fix_type == FIX_2D)) _fix_ok = 1;
+      GPS_numSat = _buffer.pvt.satellites;
+      if(_fix_ok) {
+        GPS_coord[LON] = _buffer.pvt.longitude;
+        GPS_coord[LAT] = _buffer.pvt.latitude;
+        GPS_altitude   = _buffer.pvt.altitude_msl / 1000;         //alt in m
+        GPS_time       = _buffer.pvt.time;
+        }
+      GPS_speed         = _buffer.pvt.speed_2d / 10;               // mm/s to cm/s
+      GPS_ground_course = (uint16_t)(_buffer.pvt.heading_2d / 10000);
+      GPS_velocity[LAT] = _buffer.pvt.ned_north / 10;              // cm/s
+      GPS_velocity[LON] = _buffer.pvt.ned_east / 10;
+      GPS_velocity_ok   = _fix_ok && _buffer.pvt.speed_accuracy < UBLOX_SPEED_ACCURACY;
+      f.GPS_FIX = _fix_ok;
+      return true;
+#endif
     default:
       break;
     }
@@ -1809,7 +2233,7 @@ restart:
       GPS_ground_course           = _buffer.msg.ground_course/100;  //in degrees
       GPS_numSat                  = _buffer.msg.satellites;
       GPS_time                    = _buffer.msg.utc_time;
-      //GPS_hdop                  = _buffer.msg.hdop;
+      GPS_hdop                    = _buffer.msg.hdop;
       parsed = true;
       GPS_Present = 1;
     }
@@ -1817,6 +2241,96 @@ restart:
   }
 #endif //MTK
 
+static void GPS_detect(void) {
+#if defined(UBLOX)
+  uint8_t len;
+#endif
+
+  switch (GPS_detect_state) {
+    case GPS_DETECT_BAUD:
+#if defined(UBLOX) || defined(INIT_MTK_GPS)
+      if (!SerialTXfree(GPS_SERIAL)) break;                  // the command at the previous speed is still being sent
+      if (GPS_detect_step < 5) {
+        SerialOpen(GPS_SERIAL,init_speed[GPS_detect_step++]); // switch UART speed for sending SET BAUDRATE command (NMEA mode)
+        GPS_send_baud_command();
+        break;
+        }
+      SerialOpen(GPS_SERIAL,GPS_BAUD);
+#endif
+      GPS_detect_step = 0;
+      GPS_detect_retry = 0;
+      GPS_detect_sent = 0;
+      GPS_detect_timer = millis() + GPS_DETECT_SETTLE;
+      GPS_detect_state = GPS_DETECT_CONFIG;
+      break;
+
+    case GPS_DETECT_CONFIG:
+#if defined(UBLOX)
+      if (GPS_detect_sent) {
+        if (_ack_ok) {                                          // next message
+          GPS_detect_step += 8 + pgm_read_byte(UBLOX_INIT + GPS_detect_step + 4);
+          GPS_detect_retry = 0;
+          }
+        else if ((int32_t)(millis() - GPS_detect_timer) < 0) break;
+        else if (++GPS_detect_retry >= GPS_DETECT_RETRY) {     // no answer at GPS_BAUD, set the baudrate again
+          GPS_detect_step = 0;
+          GPS_detect_state = GPS_DETECT_BAUD;
+          break;
+          }
+        GPS_detect_sent = 0;
+        }
+      else if ((int32_t)(millis() - GPS_detect_timer) < 0) break;
+      if (GPS_detect_step < sizeof(UBLOX_INIT)) {              // send configuration data in UBX protocol
+        len = 8 + pgm_read_byte(UBLOX_INIT + GPS_detect_step + 4);
+        _ack_class = pgm_read_byte(UBLOX_INIT + GPS_detect_step + 2);
+        _ack_id    = pgm_read_byte(UBLOX_INIT + GPS_detect_step + 3);
+        _ack_ok    = 0;
+        for (uint8_t i=0; i<len; i++) SerialWrite(GPS_SERIAL, pgm_read_byte(UBLOX_INIT + GPS_detect_step + i));
+        GPS_detect_sent = 1;
+        GPS_detect_timer = millis() + GPS_DETECT_ACK_TIME;
+        break;
+        }
+#elif defined(INIT_MTK_GPS)
+      if ((int32_t)(millis() - GPS_detect_timer) < 0 || !SerialTXfree(GPS_SERIAL)) break;
+      if (GPS_mtk_config(GPS_detect_step)) {
+        SerialGpsPrint(GPS_mtk_config(GPS_detect_step++));
+        break;
+        }
+#endif
+      GPS_Present = 0;
+      GPS_detect_timer = millis() + GPS_DETECT_WAIT_TIME;
+      GPS_detect_state = GPS_DETECT_WAIT;
+      break;
+
+    case GPS_DETECT_WAIT:
+      if (GPS_Present) {
+        GPS_detect_state = GPS_DETECT_DONE;
+        }
+      else if ((int32_t)(millis() - GPS_detect_timer) >= 0) {
+#if defined(GPS_PROMINI)
+        if (millis() > GPS_PROMINI_DETECT) {                   // the port is shared with MSP, give it back
+          GPS_Enable = 0;
+          SerialOpen(0,SERIAL0_COM_SPEED);
+          break;
+          }
+#endif
+        GPS_detect_step = 0;
+        GPS_detect_state = GPS_DETECT_BAUD;
+        }
+      break;
+
+    case GPS_DETECT_DONE:
+#if !defined(GPS_PROMINI)
+      if (!f.ARMED && (millis() - GPS_last_frame_seen) > GPS_DETECT_LOST_TIME) {  // unplugged or reset to its defaults
+        GPS_Present = 0;
+        GPS_detect_step = 0;
+        GPS_detect_state = GPS_DETECT_BAUD;
+        }
+#endif
+      break;
+    }
+  }
+
 #endif //ONBOARD GPS CALC
 
 //************************************************************************
@@ -1845,17 +2359,17 @@ void init_RTH()
   }
 void GPS_reset_home_position(void) {
   if (f.GPS_FIX && GPS_numSat >= 5) {
+    f.GPS_FIX_HOME = 1;                            //first, GPS_set_origin converts home only once it is set
 #if defined(I2C_GPS)
     //set current position as home
     GPS_I2C_command(I2C_GPS_COMMAND_SET_WP,0);  //WP0 is the home position
 #else
     GPS_home[LAT] = GPS_coord[LAT];
     GPS_home[LON] = GPS_coord[LON];
-    GPS_calc_longitude_scaling(GPS_coord[LAT]);  //need an initial value for distance and bearing calc
+    GPS_set_origin(GPS_coord);                   //the local frame used for distance and bearing calc
 #endif
     nav_takeoff_bearing = att.heading;             //save takeoff heading
     //TODO: Set ground altitude
-    f.GPS_FIX_HOME = 1;
     }
   }
 //reset navigation (stop the navigation processor, and clear nav)
@@ -1880,6 +2394,9 @@ void GPS_reset_nav(void) {
     f.GPS_head_set = 0;
 #endif
     }
+#if defined(INS_NAV)
+  ins_controller = INS_CTRL_NONE;
+#endif
   }
 //Get the relevant P I D values and set the PID controllers 
 void GPS_set_pids(void) {
@@ -14,6 +14,7 @@ void GPS_set_pids(void);
 void GPS_SerialInit(void);
 void GPS_NewData(void);
 void GPS_reset_home_position(void);
+void GPS_set_home(int32_t* coord);
 void GPS_set_next_wp(int32_t* lat_to, int32_t* lon_to, int32_t* lat_from, int32_t* lon_from);
 void GPS_reset_nav(void);
 void GPS_Process_data(void);
@@ -34,6 +35,9 @@ void check_land(void);
 #else
 extern uint32_t wp_distance;
 extern int32_t target_bearing;
+#if defined(INS_NAV)
+  void GPS_ins_nav(void);
+#endif
 #endif
 
 #endif /* GPS_H_ */
@@ -8,6 +8,11 @@
 
 void getEstimatedAttitude();
 
+#if defined(INS_NAV)
+  static int32_t insAccSum[3], insGSum[3];  // sums of ACC and G since the last getEstimatedHorizontalAcc
+  static uint8_t insCount;
+#endif
+
 void computeIMU () {
   uint8_t axis;
   static int16_t gyroADCprevious[3] = {0,0,0};
@@ -258,7 +263,14 @@ void getEstimatedAttitude(){
     #if MAG
       EstM.A32[axis]  += (int32_t)(imu.magADC[axis] - EstM.A16[2*axis+1])<<(16-GYR_CMPFM_FACTOR);
     #endif
+    #if defined(INS_NAV)
+      insAccSum[axis] += imu.accSmooth[axis];
+      insGSum[axis]   += EstG.A16[2*axis+1];
+    #endif
   }
+  #if defined(INS_NAV)
+    if (insCount < 255) insCount++;
+  #endif
   
   if (EstG.V16.Z > ACCZ_25deg)
     f.SMALL_ANGLES_25 = 1;
@@ -295,6 +307,35 @@ void getEstimatedAttitude(){
   accZ -= accZoffset>>3;
 }
 
+#if defined(INS_NAV)
+// Horizontal acceleration in cm/s^2, acc[LAT] to the north and acc[LON] to the east,
+// averaged over the calls of getEstimatedAttitude since the previous call. 0 if there was none.
+// The part of ACC along G is removed, what is left is turned from the body to the earth frame with the heading.
+uint8_t getEstimatedHorizontalAcc(float *acc) {
+  float a[3], g[3], ag, gg, right, forward, s, c;
+  uint8_t axis;
+
+  if (insCount == 0) return 0;
+  for (axis = 0; axis < 3; axis++) {
+    a[axis] = (float)insAccSum[axis] / insCount;
+    g[axis] = (float)insGSum[axis] / insCount;
+    insAccSum[axis] = 0;
+    insGSum[axis] = 0;
+  }
+  insCount = 0;
+  gg = g[0]*g[0] + g[1]*g[1] + g[2]*g[2];
+  if (gg < 1) return 0;
+  ag = (a[0]*g[0] + a[1]*g[1] + a[2]*g[2]) / gg;
+  right   = (g[ROLL]*ag  - a[ROLL])  * (981.0f / ACC_1G);  // ROLL axis points left, PITCH axis points back
+  forward = (g[PITCH]*ag - a[PITCH]) * (981.0f / ACC_1G);
+  s = sin(att.heading*0.0174532925f);
+  c = cos(att.heading*0.0174532925f);
+  acc[LON] = right*c + forward*s;                         // inverse of the rotation of nav[] to GPS_angle[]
+  acc[LAT] = forward*c - right*s;
+  return 1;
+}
+#endif
+
 #define UPDATE_INTERVAL 25000    // 40hz update rate (20hz LPF on acc)
 #define BARO_TAB_SIZE   21
 
@@ -8,6 +8,9 @@ uint8_t getEstimatedAltitude();
 #endif
 
 void computeIMU();
+#if defined(INS_NAV)
+uint8_t getEstimatedHorizontalAcc(float *acc);
+#endif
 int32_t mul(int16_t a, int16_t b);
 
 #endif /* IMU_H_ */
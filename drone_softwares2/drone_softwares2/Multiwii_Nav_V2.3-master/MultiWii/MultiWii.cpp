@@ -340,6 +340,7 @@ int16_t  GPS_angle[2] = { 0, 0};                      // the angles that must be
   uint16_t GPS_speed;                                   // GPS speed         - unit: cm/s
   uint8_t  GPS_update = 0;                              // a binary toogle to distinct a GPS position update
   uint16_t GPS_ground_course = 0;                       //                   - unit: degree*10
+  uint16_t GPS_hdop = 9999;                             // horizontal dilution of precision * 100, 9999 if unknown
   uint8_t  GPS_Present = 0;                             // Checksum from Gps serial
   uint8_t  GPS_Enable  = 0;
   uint32_t GPS_time;
@@ -355,9 +356,9 @@ int16_t  GPS_angle[2] = { 0, 0};                      // the angles that must be
   uint8_t prv_gps_modes = 0;			  /// GPS_checkbox items packed into 1 byte for checking GPS mode changes
   uint32_t nav_timer_stop = 0;		  /// common timer used in navigation (contains the desired stop time in millis()
   uint16_t nav_hold_time;			  /// time in seconds to hold position
-  uint8_t NAV_paused_at = 0;		  // This contains the mission step where poshold paused the runing mission.
+  wp_number_t NAV_paused_at = 0;		  // This contains the mission step where poshold paused the runing mission.
 
-  uint8_t next_step = 1;			      /// The mission step which is upcoming it equals with the mission_step stored in EEPROM
+  wp_number_t next_step = 1;			      /// The mission step which is upcoming it equals with the mission_step stored in EEPROM
 
   int16_t jump_times = -10;
 
@@ -555,6 +556,13 @@ void annexCode() { // this code is excetuted at each loop and won't interfere wi
     #endif
   #endif
 
+  #if defined(MISSION_STAGE_SIZE)
+    missionStageFlush();
+  #endif
+  #if defined(MISSION_RAM)
+    missionCacheCheck();
+  #endif
+
   #if defined(POWERMETER)
     analog.intPowerMeterSum = (pMeter[PMOTOR_SUM]/PLEVELDIV);
     intPowerTrigger1 = conf.powerTrigger1 * PLEVELSCALE; 
@@ -605,6 +613,9 @@ void annexCode() { // this code is excetuted at each loop and won't interfere wi
     #if defined(VBAT)
       if ( (analog.vbat > NO_VBAT) && (analog.vbat < vbatMin) ) vbatMin = analog.vbat;
     #endif
+    #if defined(LOG_FLIGHTS)
+      flightLogUpdate();
+    #endif
     #ifdef LCD_TELEMETRY
       #if BARO
         if ( (alt.EstAlt > BAROaltMax) ) BAROaltMax = alt.EstAlt;
@@ -701,22 +712,8 @@ void setup() {
   #endif
   /************************************/
   #if defined(GPS_SERIAL)
-    GPS_SerialInit();
-    for(uint8_t j=0;j<=5;j++){
-      GPS_NewData(); 
-      LEDPIN_ON
-      delay(20);
-      LEDPIN_OFF
-      delay(80);
-    }
-    if(!GPS_Present){
-      SerialEnd(GPS_SERIAL);
-      SerialOpen(0,SERIAL0_COM_SPEED);
-    }
-    #if !defined(GPS_PROMINI)
-      GPS_Present = 1;
-    #endif
-    GPS_Enable = GPS_Present;    
+    GPS_SerialInit();  // GPS_NewData detects and configures the GPS in the background
+    GPS_Enable = 1;
   #endif
 
 #if GPS
@@ -769,6 +766,9 @@ void setup() {
   #endif
 #ifdef MWI_SDCARD //SDCARD
 	init_SD();
+  #if defined(MISSION_SD)
+	GPS_conf.max_wp_number = getMaxWPNumber();	//The mission is on the card when there is one
+  #endif
 #endif
 	#if defined(VOLUME_FLIGHT)
 	VolumeHeightMax = VOLUME_HEIGTH_MAX * 100;
@@ -865,6 +865,12 @@ void go_arm() {
           powerValueMaxMAH = 0;
         #endif
       #endif
+      #if defined(LOG_FLIGHTS)
+        flightLogStart();
+      #endif
+      #if defined(MISSION_RAM)
+        missionCacheLoad();   // the check ends now or in the next cycles, navigation then takes the mission from RAM (read before the log write is queued)
+      #endif
       #ifdef LOG_PERMANENT
         plog.arm++;           // #arm events
         plog.running = 1;       // toggle on arm & disarm to monitor for clean shutdown vs. powercut
@@ -876,6 +882,9 @@ void go_arm() {
 		writePLogToSD();
 	#endif
     #endif
+      #if defined(LOG_BLACKBOX)
+        blackboxStart();
+      #endif
 		#if defined(VOLUME_FLIGHT) || defined(VOLUME_S1) || defined(VOLUME_S2) || defined(VOLUME_S3)
 			BAROaltHome = alt.EstAlt;
 			VolumeAltitudeMax = BAROaltHome + VolumeHeightMax;
@@ -890,6 +899,9 @@ void go_arm() {
 void go_disarm() {
   if (f.ARMED) {
     f.ARMED = 0;
+    #if defined(LOG_BLACKBOX)
+      blackboxStop();     // before any other access to the SD card
+    #endif
     #ifdef LOG_PERMANENT
       plog.disarm++;        // #disarm events
       plog.armed_time = armedTime ;   // lifetime in seconds
@@ -904,6 +916,9 @@ void go_disarm() {
 	  writePLogToSD();
 	#endif
 #endif
+    #if defined(LOG_FLIGHTS)
+      flightLogStore();
+    #endif
 	  #if defined(VOLUME_FLIGHT) || defined(VOLUME_S1) || defined(VOLUME_S2) || defined(VOLUME_S3)
 		  BAROaltHome = alt.EstAlt;
 		  VolumeAltitudeMax = BAROaltHome + VolumeHeightMax;
@@ -1413,6 +1428,9 @@ void loop () {
 		  GPS_reset_nav();
 		  }
 
+  #if defined(INS_NAV)
+    GPS_ins_nav();                                // position/velocity estimate and nav PIDs at 50Hz
+  #endif
 #endif
 
 
@@ -1747,4 +1765,7 @@ void loop () {
   if ( (f.ARMED) || ((!calibratingG) && (!calibratingA)) ) writeServos();
 #endif 
   writeMotors();
+  #if defined(LOG_BLACKBOX)
+    blackboxLog();
+  #endif
 }
@@ -140,6 +140,7 @@ extern gps_conf_struct GPS_conf;
   extern uint16_t GPS_speed;                               // GPS speed         - unit: cm/s
   extern uint8_t  GPS_update;                              // a binary toogle to distinct a GPS position update
   extern uint16_t GPS_ground_course;                       //                   - unit: degree*10
+  extern uint16_t GPS_hdop;                                // HDOP              - unit: 1/100
   extern uint8_t  GPS_Present;                             // Checksum from Gps serial
   extern uint8_t  GPS_Enable;
   extern uint32_t GPS_time;
@@ -152,8 +153,8 @@ extern uint8_t GPS_saved_mission_state;   //The mission state saved when poshold
 extern uint8_t prv_gps_modes;             //GPS_checkbox items packed into 1 byte for checking GPS mode changes
 extern uint32_t nav_timer_stop;           //common timer used in navigation (contains the desired stop time in millis()
 extern uint16_t nav_hold_time;            //time in seconds to hold position
-  extern uint8_t NAV_paused_at;		      // This contains the mission step where poshold paused the runing mission.
-extern uint8_t next_step;                 //The mission step which is upcoming it equals with the mission_step stored in EEPROM
+  extern wp_number_t NAV_paused_at;		      // This contains the mission step where poshold paused the runing mission.
+extern wp_number_t next_step;                 //The mission step which is upcoming it equals with the mission_step stored in EEPROM
 
 //Altitude control state
   #define ASCENDING			1
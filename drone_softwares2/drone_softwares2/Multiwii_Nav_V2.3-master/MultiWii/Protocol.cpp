@@ -22,7 +22,7 @@
 #define MSP_SERVO                103   //out message         8 servos
 #define MSP_MOTOR                104   //out message         8 motors
 #define MSP_RC                   105   //out message         8 rc chan and more
-#define MSP_RAW_GPS              106   //out message         fix, numsat, lat, lon, alt, speed, ground course
+#define MSP_RAW_GPS              106   //out message         fix, numsat, lat, lon, alt, speed, ground course, hdop
 #define MSP_COMP_GPS             107   //out message         distance home, direction home
 #define MSP_ATTITUDE             108   //out message         2 angles 1 heading
 #define MSP_ALTITUDE             109   //out message         altitude, variometer
@@ -40,6 +40,14 @@
 #define MSP_NAV_STATUS			 121   //out message	     Returns navigation status
 #define MSP_NAV_CONFIG			 122   //out message		 Returns navigation parameters
 #define MSP_PCF8591              123   //out message         ADC values
+#define MSP_RC_JITTER            124   //out message         PPM jitter stats of one raw channel, channel# is in the payload (255 clears the stats)
+#define MSP_SERIAL_STATS         125   //out message         per port: MSP frames deferred to the next cycle, RX bytes dropped, TX bytes queued, TX bytes dropped, streamed frames deferred
+#define MSP_WP_STAGE_STATUS      126   //out message         bulk mission stage: state, first WP#, count, received, written to EEPROM
+#define MSP_WP_BULK              127   //out message         get several WPs, first WP# and count are in the payload, returns frames of (WP#, n, n x step) over several cycles
+#define MSP_WP16                 128   //out message         MSP_WP with a 16 bit WP# for the missions on the SD card (WP#, action, lat, lon, alt, param1-3, flag)
+#define MSP_PARAM_LIST           129   //out message         parameter table from the given index (count, index, n x id, type, min, max, scale)
+#define MSP_PARAM                130   //out message         values of the parameters with an id in first..first+count-1 (n x id, value)
+#define MSP_FLIGHT_LOG           131   //out message         flight summaries from the given index, 0 is the last flight, frames of (index, n, n x flight_log_t) over several cycles, n = 0 ends
 
 #define MSP_SET_RAW_RC           200   //in message          8 rc chan
 #define MSP_SET_RAW_GPS          201   //in message          fix, numsat, lat, lon, alt, speed    //depreciated 
@@ -57,6 +65,12 @@
 #define MSP_SET_MOTOR            214   //in message          PropBalance function
 
 #define MSP_SET_NAV_CONFIG       215   //in message			 Sets nav config parameters - write to the eeprom  
+#define MSP_WP_STAGE             217   //in message          opens the mission stage for WP# first..first+count-1 (first, count)
+#define MSP_SET_WP_BULK          218   //in message          fills the stage (index in stage, n, n x step: action, lat, lon, alt, param1-3, flag)
+#define MSP_WP_STAGE_COMMIT      219   //in message          CRC16 of the staged steps, starts the EEPROM write when it matches
+#define MSP_SET_WP16             220   //in message          MSP_SET_WP with a 16 bit WP# for the missions on the SD card (WP#, action, lat, lon, alt, param1-3, flag)
+#define MSP_SET_PARAM            221   //in message          sets parameters by id (n, n x id, value), all or none when one is unknown or out of range
+#define MSP_SET_STREAM           216   //in message          out message id + period in ms, the reply is then sent without request on this port in the bulk TX queue (period 0 stops it, id 0 & period 0 stops all)
 
 #define MSP_BIND                 240   //in message          no param
 
@@ -77,14 +91,56 @@
 static uint8_t CURRENTPORT=0;
 
 #define INBUF_SIZE 64
-static uint8_t inBuf[INBUF_SIZE][UART_NUMBER];
+static uint8_t inBuf[UART_NUMBER][INBUF_SIZE];
+#if defined(MSP_LARGE_INBUF_PORT)
+  #if (MSP_LARGE_INBUF_PORT >= UART_NUMBER)
+    #error "MSP_LARGE_INBUF_PORT is not a serial port of this board"
+  #endif
+  static uint8_t inBufLarge[MSP_LARGE_INBUF_SIZE]; // reassembly buffer for the big MSP v2 requests of one port
+#endif
 static uint8_t checksum[UART_NUMBER];
-static uint8_t indRX[UART_NUMBER];
-static uint8_t cmdMSP[UART_NUMBER];
+static uint16_t indRX[UART_NUMBER];
+static uint16_t dataSize[UART_NUMBER];  // payload size of the current request, checked by the commands with a variable payload
+static uint16_t cmdMSP[UART_NUMBER];
+static uint8_t mspVersion[UART_NUMBER]; // framing of the current request, used for the reply: 1 = $M (v1), 2 = $X (v2)
+
+#define MSP_CYCLE_BUDGET 500                // us: no new MSP frame is decoded once serialCom() has run this long
+#define MSP_TX_MARGIN 50                    // bytes: no new MSP frame is decoded with less free TX buffer
+#define MSP_REPLY_MAX (MSP_TX_MARGIN - 10)  // payload of a reply which always fits in the margin (the ring holds TX_BUFFER_SIZE-1 bytes, $X framing: 9 bytes)
+static uint16_t mspFramesDeferred[UART_NUMBER]; // times a port was left with pending bytes because of the budget or a full TX buffer
+// a reply longer than MSP_REPLY_MAX may not fit in the free TX buffer: it is not queued, the request is evaluated again once
+// the TX buffer has room for it and nothing more is read on the port before (those replies have no side effect)
+static uint8_t mspRetry[UART_NUMBER];           // size of the reply waiting for room, 0 = none
+static uint8_t mspAnswering;                    // evaluateCommand() answers a request of serialCom(): not a stream nor a bulk frame
 
 void evaluateOtherData(uint8_t sr);
 #ifndef SUPPRESS_ALL_SERIAL_MSP
 void evaluateCommand();
+
+#define MSP_STREAM_SLOTS 4  // telemetry subscriptions per port
+static struct {
+  uint8_t  cmd;             // out message to send, 0 = free slot
+  uint8_t  version;         // MSP framing of the subscription request
+  uint16_t period;          // in ms
+  uint16_t due;             // next emission, low 16 bits of millis()
+} mspStream[UART_NUMBER][MSP_STREAM_SLOTS];
+static void serialStreams();
+static void mspAnswer();
+#if defined(MISSION_STAGE_SIZE) || defined(LOG_FLIGHTS)
+  #define MSP_BULK_REPLIES
+#endif
+#if defined(MSP_BULK_REPLIES)
+// replies longer than the TX buffer (MSP_WP_BULK, MSP_FLIGHT_LOG) go out as several frames, one per cycle, each one with the items
+// which fit in the free TX buffer; a new request of the same kind on the port replaces the transfer in progress
+static struct {
+  uint16_t cmd;             // out message of the transfer, 0 = none
+  uint8_t  version;         // MSP framing of the request
+  uint8_t  next;            // WP# or flight index of the next frame
+  uint8_t  left;            // WPs still to send (MSP_WP_BULK)
+} mspBulk[UART_NUMBER];
+static void mspBulkFrame();
+static void serialBulkReplies();
+#endif
 #endif
 
 #define BIND_CAPABLE 0;  //Used for Spektrum today; can be used in the future for any RX type that needs a bind and has a MultiWii module. 
@@ -95,8 +151,33 @@ void evaluateCommand();
 
 const uint32_t capability = 0+BIND_CAPABLE;
 
+static uint8_t *portInBuf(uint8_t port) {
+  #if defined(MSP_LARGE_INBUF_PORT)
+    if (port == MSP_LARGE_INBUF_PORT) return inBufLarge;
+  #endif
+  return inBuf[port];
+}
+
+static uint16_t portInBufSize(uint8_t port) {
+  #if defined(MSP_LARGE_INBUF_PORT)
+    if (port == MSP_LARGE_INBUF_PORT) return MSP_LARGE_INBUF_SIZE;
+  #endif
+  return INBUF_SIZE;
+}
+
+// CRC8 with the DVB-S2 polynomial (0xD5), checksum of the MSP v2 frames
+static uint8_t crc8_dvb_s2(uint8_t crc, uint8_t a) {
+  crc ^= a;
+  for (uint8_t i=0;i<8;i++) crc = (crc & 0x80) ? (crc<<1) ^ 0xD5 : crc<<1;
+  return crc;
+}
+
+static uint8_t mspChecksum(uint8_t chk, uint8_t a) {
+  return (mspVersion[CURRENTPORT] == 2) ? crc8_dvb_s2(chk,a) : chk ^ a;
+}
+
 uint8_t read8()  {
-  return inBuf[indRX[CURRENTPORT]++][CURRENTPORT]&0xff;
+  return portInBuf(CURRENTPORT)[indRX[CURRENTPORT]++];
 }
 uint16_t read16() {
   uint16_t t = read8();
@@ -111,7 +192,7 @@ uint32_t read32() {
 
 void serialize8(uint8_t a) {
   SerialSerialize(CURRENTPORT,a);
-  checksum[CURRENTPORT] ^= a;
+  checksum[CURRENTPORT] = mspChecksum(checksum[CURRENTPORT],a);
 }
 void serialize16(int16_t a) {
   serialize8((a   ) & 0xFF);
@@ -124,20 +205,43 @@ void serialize32(uint32_t a) {
   serialize8((a>>24) & 0xFF);
 }
 
-void headSerialResponse(uint8_t err, uint8_t s) {
-  serialize8('$');
-  serialize8('M');
-  serialize8(err ? '!' : '>');
+// checksum in one pass, then the block goes to the TX ring in one copy
+void serializeBlock(const uint8_t *cb,uint8_t siz) {
+  uint8_t c = checksum[CURRENTPORT];
+  if (mspVersion[CURRENTPORT] == 2) for (uint8_t i=0;i<siz;i++) c = crc8_dvb_s2(c,cb[i]);
+  else                              for (uint8_t i=0;i<siz;i++) c ^= cb[i];
+  checksum[CURRENTPORT] = c;
+  SerialSerializeBlock(CURRENTPORT,cb,siz);
+}
+
+// the reply uses the framing of the request: $M size cmd, or $X flag cmd16 size16
+void headSerialResponse(uint8_t err, uint16_t s) {
+  uint16_t cmd = cmdMSP[CURRENTPORT];
+  uint8_t head[8] = {'$','M',(uint8_t)(err ? '!' : '>'),(uint8_t)s,(uint8_t)cmd};
+  uint8_t len = 5;
+  if (mspVersion[CURRENTPORT] == 2) {
+    head[1] = 'X';
+    head[3] = 0;         // flag
+    head[4] = cmd; head[5] = cmd>>8;
+    head[6] = s;   head[7] = s>>8;
+    len = 8;
+  }
+  uint16_t frame = len + s + 1;
+  if (mspAnswering && frame > TX_BUFFER_SIZE - 1 - SerialUsedTXBuff(CURRENTPORT) && frame < TX_BUFFER_SIZE) {
+    mspRetry[CURRENTPORT] = frame;   // later: a frame which never fits is dropped as before
+    SerialTXCancel(CURRENTPORT);
+    return;
+  }
+  SerialSerializeBlock(CURRENTPORT,head,3);
   checksum[CURRENTPORT] = 0; // start calculating a new checksum
-  serialize8(s);
-  serialize8(cmdMSP[CURRENTPORT]);
+  serializeBlock(&head[3],len-3);
 }
 
-void headSerialReply(uint8_t s) {
+void headSerialReply(uint16_t s) {
   headSerialResponse(0, s);
 }
 
-void inline headSerialError(uint8_t s) {
+void inline headSerialError(uint16_t s) {
   headSerialResponse(1, s);
 }
 
@@ -146,16 +250,21 @@ void tailSerialReply() {
 }
 
 void serializeNames(PGM_P s) {
-  headSerialReply(strlen_P(s));
-  for (PGM_P c = s; pgm_read_byte(c); c++) {
-    serialize8(pgm_read_byte(c));
+  uint8_t buf[16];
+  uint8_t len = strlen_P(s);
+  headSerialReply(len);
+  while (len) { // PROGMEM can't be copied directly in the TX ring: go through a small RAM buffer
+    uint8_t n = (len > sizeof(buf)) ? sizeof(buf) : len;
+    memcpy_P(buf,s,n);
+    serializeBlock(buf,n);
+    s += n; len -= n;
   }
 }
 
 void serialCom() {
   uint8_t c,n;  
-  static uint8_t offset[UART_NUMBER];
-  static uint8_t dataSize[UART_NUMBER];
+  uint16_t start = micros();
+  static uint16_t offset[UART_NUMBER];
   static enum _serial_state {
     IDLE,
     HEADER_START,
@@ -163,6 +272,12 @@ void serialCom() {
     HEADER_ARROW,
     HEADER_SIZE,
     HEADER_CMD,
+    HEADER_X,
+    HEADER_V2_ARROW,
+    HEADER_V2_FLAG,
+    HEADER_V2_CMD_L,
+    HEADER_V2_CMD_H,
+    HEADER_V2_SIZE_L,
   } c_state[UART_NUMBER];// = IDLE;
 
   for(n=0;n<UART_NUMBER;n++) {
@@ -182,10 +297,23 @@ void serialCom() {
 #if (defined(SPEKTRUM)|| defined(SBUS)) && (UART_NUMBER >1)
       #define RX_COND && (RX_SERIAL_PORT != CURRENTPORT)
     #endif
+    #ifndef SUPPRESS_ALL_SERIAL_MSP
+      if (mspRetry[CURRENTPORT]) {   // the reply of the last request is still to be sent: its input is in inBuf
+        if (mspRetry[CURRENTPORT] > TX_BUFFER_SIZE - 1 - SerialUsedTXBuff(CURRENTPORT)) {
+          mspFramesDeferred[CURRENTPORT]++;
+          continue;
+        }
+        indRX[CURRENTPORT] = 0;
+        mspAnswer();
+      }
+    #endif
     uint8_t cc = SerialAvailable(CURRENTPORT);
     while (cc-- GPS_COND RX_COND) {
       uint8_t bytesTXBuff = SerialUsedTXBuff(CURRENTPORT); // indicates the number of occupied bytes in TX buffer
-      if (bytesTXBuff > TX_BUFFER_SIZE - 50 ) return; // ensure there is enough free TX buffer to go further (50 bytes margin)
+      if (bytesTXBuff > TX_BUFFER_SIZE - MSP_TX_MARGIN ) { // ensure there is enough free TX buffer to go further
+        mspFramesDeferred[CURRENTPORT]++;       // the other ports have their own TX buffer and can go on
+        break;
+      }
       c = SerialRead(CURRENTPORT);
       #ifdef SUPPRESS_ALL_SERIAL_MSP
         // no MSP handling, so go directly
@@ -196,14 +324,15 @@ void serialCom() {
           c_state[CURRENTPORT] = (c=='$') ? HEADER_START : IDLE;
           if (c_state[CURRENTPORT] == IDLE) evaluateOtherData(c); // evaluate all other incoming serial data
         } else if (c_state[CURRENTPORT] == HEADER_START) {
-          c_state[CURRENTPORT] = (c=='M') ? HEADER_M : IDLE;
+          c_state[CURRENTPORT] = (c=='M') ? HEADER_M : (c=='X') ? HEADER_X : IDLE;
         } else if (c_state[CURRENTPORT] == HEADER_M) {
           c_state[CURRENTPORT] = (c=='<') ? HEADER_ARROW : IDLE;
         } else if (c_state[CURRENTPORT] == HEADER_ARROW) {
-          if (c > INBUF_SIZE) {  // now we are expecting the payload size
+          if (c > portInBufSize(CURRENTPORT)) {  // now we are expecting the payload size
             c_state[CURRENTPORT] = IDLE;
             continue;
           }
+          mspVersion[CURRENTPORT] = 1;
           dataSize[CURRENTPORT] = c;
           offset[CURRENTPORT] = 0;
           checksum[CURRENTPORT] = 0;
@@ -214,24 +343,220 @@ void serialCom() {
           cmdMSP[CURRENTPORT] = c;
           checksum[CURRENTPORT] ^= c;
           c_state[CURRENTPORT] = HEADER_CMD;
+        } else if (c_state[CURRENTPORT] == HEADER_X) {
+          c_state[CURRENTPORT] = (c=='<') ? HEADER_V2_ARROW : IDLE;
+        } else if (c_state[CURRENTPORT] == HEADER_V2_ARROW) { // MSP v2: flag, cmd 16 bits, size 16 bits, all covered by the CRC
+          mspVersion[CURRENTPORT] = 2;
+          checksum[CURRENTPORT] = crc8_dvb_s2(0,c);
+          c_state[CURRENTPORT] = HEADER_V2_FLAG;
+        } else if (c_state[CURRENTPORT] == HEADER_V2_FLAG) {
+          cmdMSP[CURRENTPORT] = c;
+          checksum[CURRENTPORT] = crc8_dvb_s2(checksum[CURRENTPORT],c);
+          c_state[CURRENTPORT] = HEADER_V2_CMD_L;
+        } else if (c_state[CURRENTPORT] == HEADER_V2_CMD_L) {
+          cmdMSP[CURRENTPORT] |= (uint16_t)c<<8;
+          checksum[CURRENTPORT] = crc8_dvb_s2(checksum[CURRENTPORT],c);
+          c_state[CURRENTPORT] = HEADER_V2_CMD_H;
+        } else if (c_state[CURRENTPORT] == HEADER_V2_CMD_H) {
+          dataSize[CURRENTPORT] = c;
+          checksum[CURRENTPORT] = crc8_dvb_s2(checksum[CURRENTPORT],c);
+          c_state[CURRENTPORT] = HEADER_V2_SIZE_L;
+        } else if (c_state[CURRENTPORT] == HEADER_V2_SIZE_L) {
+          dataSize[CURRENTPORT] |= (uint16_t)c<<8;
+          checksum[CURRENTPORT] = crc8_dvb_s2(checksum[CURRENTPORT],c);
+          offset[CURRENTPORT] = 0;
+          indRX[CURRENTPORT] = 0;
+          c_state[CURRENTPORT] = (dataSize[CURRENTPORT] > portInBufSize(CURRENTPORT)) ? IDLE : HEADER_CMD; // the payload is to follow
         } else if (c_state[CURRENTPORT] == HEADER_CMD && offset[CURRENTPORT] < dataSize[CURRENTPORT]) {
-          checksum[CURRENTPORT] ^= c;
-          inBuf[offset[CURRENTPORT]++][CURRENTPORT] = c;
+          checksum[CURRENTPORT] = mspChecksum(checksum[CURRENTPORT],c);
+          portInBuf(CURRENTPORT)[offset[CURRENTPORT]++] = c;
         } else if (c_state[CURRENTPORT] == HEADER_CMD && offset[CURRENTPORT] >= dataSize[CURRENTPORT]) {
           if (checksum[CURRENTPORT] == c) {  // compare calculated and transferred checksum
-            evaluateCommand();  // we got a valid packet, evaluate it
+            mspAnswer();  // we got a valid packet, evaluate it
           }
           c_state[CURRENTPORT] = IDLE;
-          cc = 0; // no more than one MSP per port and per cycle
+          if (mspRetry[CURRENTPORT]) break;  // nothing more on this port until the reply is sent
+          if ((uint16_t)(micros() - start) > MSP_CYCLE_BUDGET) { // at least one MSP per port and per cycle, more while there is time left
+            if (cc) mspFramesDeferred[CURRENTPORT]++;
+            cc = 0;
+          }
         }
       #endif // SUPPRESS_ALL_SERIAL_MSP
     }
   }
+  #ifndef SUPPRESS_ALL_SERIAL_MSP
+    #if defined(MSP_BULK_REPLIES)
+      serialBulkReplies();
+    #endif
+    serialStreams();
+  #endif
+  UartSendDeferred(); // one USB transfer for all the replies of this cycle
+}
+
+#ifndef SUPPRESS_ALL_SERIAL_MSP
+static void mspAnswer() {
+  mspRetry[CURRENTPORT] = 0;
+  mspAnswering = 1;
+  evaluateCommand();
+  mspAnswering = 0;
+}
+
+// the out messages which can be streamed: telemetry without argument only
+// a new message is not streamable until it is added here
+static uint8_t mspStreamable(uint8_t cmd) {
+  switch(cmd) {
+    case MSP_STATUS:
+    case MSP_RAW_IMU:
+    case MSP_SERVO:
+    case MSP_MOTOR:
+    case MSP_RC:
+    case MSP_RAW_GPS:
+    case MSP_COMP_GPS:
+    case MSP_ATTITUDE:
+    case MSP_ALTITUDE:
+    case MSP_ANALOG:
+    case MSP_NAV_STATUS:
+    case MSP_PCF8591:
+    case MSP_SERIAL_STATS:
+    case MSP_WP_STAGE_STATUS:
+    case MSP_DEBUG:
+      return 1;
+  }
+  return 0;
+}
+
+// register (period!=0) or remove a telemetry subscription on CURRENTPORT
+static uint8_t mspStreamSet(uint8_t cmd, uint16_t period) {
+  uint8_t i,slot = MSP_STREAM_SLOTS;
+  if (cmd == 0 && period == 0) { // stop all the streams of this port
+    for(i=0;i<MSP_STREAM_SLOTS;i++) mspStream[CURRENTPORT][i].cmd = 0;
+    return 1;
+  }
+  if (!mspStreamable(cmd)) return 0;
+  for(i=0;i<MSP_STREAM_SLOTS;i++) {
+    if (mspStream[CURRENTPORT][i].cmd == cmd) {slot = i; break;}
+    if (mspStream[CURRENTPORT][i].cmd == 0 && slot == MSP_STREAM_SLOTS) slot = i;
+  }
+  if (slot == MSP_STREAM_SLOTS) return period == 0; // table full, or nothing to remove
+  if (period == 0) {
+    mspStream[CURRENTPORT][slot].cmd = 0;
+  } else {
+    mspStream[CURRENTPORT][slot].cmd    = cmd;
+    mspStream[CURRENTPORT][slot].version = mspVersion[CURRENTPORT];
+    mspStream[CURRENTPORT][slot].period = period;
+    mspStream[CURRENTPORT][slot].due    = millis();
+  }
+  return 1;
+}
+
+// send the due subscriptions in the bulk TX queue: they go out only when no reply is waiting and are shed first
+// when the link is too slow (a frame which doesn't fit is dropped whole, see serialTXStats)
+static void serialStreams() {
+  uint16_t now = millis();
+  uint16_t cmd;
+  uint8_t n,i,chk,ver;
+
+  for(n=0;n<UART_NUMBER;n++) {
+    #if !defined(PROMINI)
+      CURRENTPORT=n;
+    #endif
+    for(i=0;i<MSP_STREAM_SLOTS;i++) {
+      if (mspStream[n][i].cmd == 0 || (int16_t)(now - mspStream[n][i].due) < 0) continue;
+      if (SerialUsedTXBulk(CURRENTPORT) > TX_BULK_BUFFER_SIZE / 2) { // still due, retried next cycle
+        serialTXStats[CURRENTPORT].deferred++;
+        break;
+      }
+      mspStream[n][i].due += mspStream[n][i].period;
+      if ((int16_t)(now - mspStream[n][i].due) >= 0) mspStream[n][i].due = now + mspStream[n][i].period; // late: don't burst to catch up
+      cmd = cmdMSP[CURRENTPORT]; chk = checksum[CURRENTPORT]; ver = mspVersion[CURRENTPORT]; // a request may be half received on this port
+      cmdMSP[CURRENTPORT] = mspStream[n][i].cmd;
+      mspVersion[CURRENTPORT] = mspStream[n][i].version;
+      SerialTXQueue(CURRENTPORT,TX_BULK);
+      evaluateCommand();
+      SerialTXQueue(CURRENTPORT,TX_CRITICAL);
+      cmdMSP[CURRENTPORT] = cmd; checksum[CURRENTPORT] = chk; mspVersion[CURRENTPORT] = ver;
+    }
+  }
 }
 
+#if defined(MSP_BULK_REPLIES)
+// next frame of the transfer of CURRENTPORT, without the checksum (tailSerialReply)
+static void mspBulkFrame() {
+  // payload room after the framing and the 2 bytes (first item, count) of the frame
+  int16_t room = TX_BUFFER_SIZE - 1 - SerialUsedTXBuff(CURRENTPORT) - ((mspVersion[CURRENTPORT] == 2) ? 9 : 6) - 2;
+  uint8_t n = 0;
+
+  if (room < 0) room = 0;
+  switch(mspBulk[CURRENTPORT].cmd) {
+    #if defined(MISSION_STAGE_SIZE)
+    case MSP_WP_BULK:
+      {
+        mission_step_struct step;
+        n = room / 20;
+        if (n > mspBulk[CURRENTPORT].left) n = mspBulk[CURRENTPORT].left;
+        headSerialReply(2 + n*20);
+        serialize8(mspBulk[CURRENTPORT].next);
+        serialize8(n);
+        for (uint8_t i=0; i<n; i++) {
+          if (!readWP(mspBulk[CURRENTPORT].next+i, &step)) { memset(&step, 0, sizeof(step)); step.flag = MISSION_FLAG_CRC_ERROR; }
+          serialize8(step.action);
+          serialize32(step.pos[LAT]);
+          serialize32(step.pos[LON]);
+          serialize32(step.altitude);
+          serialize16(step.parameter1);
+          serialize16(step.parameter2);
+          serialize16(step.parameter3);
+          serialize8(step.flag);
+        }
+        mspBulk[CURRENTPORT].next += n;
+        mspBulk[CURRENTPORT].left -= n;
+        if (mspBulk[CURRENTPORT].left == 0) mspBulk[CURRENTPORT].cmd = 0;
+      }
+      break;
+    #endif
+    #if defined(LOG_FLIGHTS)
+    case MSP_FLIGHT_LOG:
+      {
+        flight_log_t rec[(TX_BUFFER_SIZE - 1 - 6 - 2) / sizeof(flight_log_t)];
+        uint8_t max = room / sizeof(flight_log_t);
+        if (max > sizeof(rec) / sizeof(rec[0])) max = sizeof(rec) / sizeof(rec[0]);
+        while (n < max && flightLogRead(mspBulk[CURRENTPORT].next+n, &rec[n])) n++;
+        headSerialReply(2 + n*sizeof(flight_log_t));
+        serialize8(mspBulk[CURRENTPORT].next);
+        serialize8(n);
+        serializeBlock((uint8_t*)rec, n*sizeof(flight_log_t));
+        mspBulk[CURRENTPORT].next += n;
+        if (n == 0) mspBulk[CURRENTPORT].cmd = 0; // the empty frame ends the transfer
+      }
+      break;
+    #endif
+  }
+}
+
+// the next frame of each transfer, once the TX buffer has the room serialCom() keeps for a reply
+static void serialBulkReplies() {
+  uint16_t cmd;
+  uint8_t n,chk,ver;
+
+  for(n=0;n<UART_NUMBER;n++) {
+    #if !defined(PROMINI)
+      CURRENTPORT=n;
+    #endif
+    if (mspBulk[n].cmd == 0 || SerialUsedTXBuff(CURRENTPORT) > TX_BUFFER_SIZE - MSP_TX_MARGIN) continue;
+    cmd = cmdMSP[CURRENTPORT]; chk = checksum[CURRENTPORT]; ver = mspVersion[CURRENTPORT]; // a request may be half received on this port
+    cmdMSP[CURRENTPORT] = mspBulk[n].cmd;
+    mspVersion[CURRENTPORT] = mspBulk[n].version;
+    mspBulkFrame();
+    tailSerialReply();
+    cmdMSP[CURRENTPORT] = cmd; checksum[CURRENTPORT] = chk; mspVersion[CURRENTPORT] = ver;
+  }
+}
+#endif
+#endif
+
 void  s_struct(uint8_t *cb,uint8_t siz) {
   headSerialReply(siz);
-  while(siz--) serialize8(*cb++);
+  serializeBlock(cb,siz);
 }
 
 void s_struct_w(uint8_t *cb,uint8_t siz) {
@@ -458,7 +783,7 @@ void evaluateCommand() {
      break;
    #if GPS
    case MSP_RAW_GPS:
-     headSerialReply(16);
+     headSerialReply(18);
      serialize8(f.GPS_FIX);
      serialize8(GPS_numSat);
      serialize32(GPS_coord[LAT]);
@@ -466,6 +791,7 @@ void evaluateCommand() {
      serialize16(GPS_altitude);
      serialize16(GPS_speed);
      serialize16(GPS_ground_course);        // added since r1172
+     serialize16(GPS_hdop);                 // 1/100, 9999 if the GPS does not give it
      break;
    case MSP_COMP_GPS:
      headSerialReply(5);
@@ -589,6 +915,108 @@ void evaluateCommand() {
      }
      break;
 
+#if defined(MISSION_STAGE_SIZE)
+   case MSP_WP_STAGE:
+	   {
+	   uint8_t first = read8();
+	   uint8_t count = read8();
+	   if (missionStageBegin(first, count)) headSerialReply(0); else headSerialError(0);
+	   }
+	   break;
+
+   case MSP_SET_WP_BULK:
+	   {
+	   uint8_t index = read8();
+	   uint8_t n     = read8();
+	   bool    ok    = (dataSize[CURRENTPORT] == 2 + 20*(uint16_t)n);   // the steps must all be in this frame
+	   while (ok && n--) {
+		   mission_step_struct *step = missionStageStep(index++);
+		   if (step == 0) { ok = false; break; }
+		   step->action     = read8();
+		   step->pos[LAT]   = read32();
+		   step->pos[LON]   = read32();
+		   step->altitude   = read32();
+		   step->parameter1 = read16();
+		   step->parameter2 = read16();
+		   step->parameter3 = read16();
+		   step->flag       = read8();
+	   }
+	   if (ok) headSerialReply(0); else headSerialError(0);
+	   }
+	   break;
+
+   case MSP_WP_STAGE_COMMIT:
+	   if (missionStageCommit(read16())) headSerialReply(0); else headSerialError(0);
+	   break;
+
+   case MSP_WP_STAGE_STATUS:
+	   {
+	   uint8_t received = 0;
+	   for (uint8_t i=0; i<mission_stage.count; i++) if (mission_stage.received[i>>3] & (1<<(i&7))) received++;
+	   headSerialReply(5);
+	   serialize8(mission_stage.state);
+	   serialize8(mission_stage.first);
+	   serialize8(mission_stage.count);
+	   serialize8(received);
+	   serialize8(mission_stage.flushed);
+	   }
+	   break;
+
+   case MSP_WP_BULK:
+	   if (dataSize[CURRENTPORT] != 2) { headSerialError(0); break; }
+	   mspBulk[CURRENTPORT].cmd     = MSP_WP_BULK;
+	   mspBulk[CURRENTPORT].version = mspVersion[CURRENTPORT];
+	   mspBulk[CURRENTPORT].next    = read8();
+	   mspBulk[CURRENTPORT].left    = read8();
+	   if (mspBulk[CURRENTPORT].next == 0 || (uint16_t)mspBulk[CURRENTPORT].next + mspBulk[CURRENTPORT].left - 1 > GPS_conf.max_wp_number)
+		   mspBulk[CURRENTPORT].left = 0;												//a single empty frame
+	   mspBulkFrame();																	//the first frame now, the others in the next cycles
+	   break;
+#endif
+
+#if defined(MISSION_SD)
+   case MSP_WP16:
+	   {
+	   mission_step_struct step;
+	   uint8_t flag;
+	   if (dataSize[CURRENTPORT] != 2) { headSerialError(0); break; }
+	   wp_number_t wp_no = read16();
+	   memset(&step, 0, sizeof(step));
+	   if (NAV_state != NAV_STATE_NONE) flag = MISSION_FLAG_NAV_IN_PROG;		//The card is kept for the running mission
+	   else if (readWP(wp_no, &step)) flag = step.flag;
+	   else { memset(&step, 0, sizeof(step)); flag = MISSION_FLAG_CRC_ERROR; }
+	   headSerialReply(22);
+	   serialize16(wp_no);
+	   serialize8(step.action);
+	   serialize32(step.pos[LAT]);
+	   serialize32(step.pos[LON]);
+	   serialize32(step.altitude);
+	   serialize16(step.parameter1);
+	   serialize16(step.parameter2);
+	   serialize16(step.parameter3);
+	   serialize8(flag);
+	   }
+	   break;
+
+   case MSP_SET_WP16:
+	   if (dataSize[CURRENTPORT] != 22) { headSerialError(0); break; }		//WP#, action, lat, lon, alt, param1-3, flag
+	   if (NAV_state == NAV_STATE_NONE) {										//Silently ignored during navigation, as MSP_SET_WP
+		   mission_step.number     = read16();
+		   mission_step.action     = read8();
+		   mission_step.pos[LAT]   = read32();
+		   mission_step.pos[LON]   = read32();
+		   mission_step.altitude   = read32();
+		   mission_step.parameter1 = read16();
+		   mission_step.parameter2 = read16();
+		   mission_step.parameter3 = read16();
+		   mission_step.flag       = read8();
+		   if (mission_step.number > 0 && (f.SDCARD || mission_step.number <= getMaxWPNumber()))
+			   storeWP();
+		   headSerialReply(0);
+	   }
+	   break;
+#endif
+
    case MSP_SET_WP:
 	   //TODO: add I2C_gps handling
 
@@ -637,8 +1065,7 @@ void evaluateCommand() {
 */
 		   if (mission_step.number == 0)											//Set new Home position
 			   {
-			   GPS_home[LAT] = mission_step.pos[LAT];
-			   GPS_home[LON] = mission_step.pos[LON];
+			   GPS_set_home(mission_step.pos);
 			   }
 
 		   if (mission_step.number >0 && mission_step.number<255)			//Not home and not poshold, we are free to store it in the eprom
@@ -652,6 +1079,83 @@ void evaluateCommand() {
 
 #endif
 
+#if defined(MSP_PARAMS)
+   case MSP_PARAM_LIST:
+     {
+       #define PARAM_LIST_MAX ((MSP_REPLY_MAX - 2) / 7)	// what always fits in the serialCom() TX margin
+       param_desc_t d;
+       uint8_t index = read8();
+       uint8_t n = (index < paramCount()) ? paramCount() - index : 0;
+       if (n > PARAM_LIST_MAX) n = PARAM_LIST_MAX;
+       headSerialReply(2+7*n);
+       serialize8(paramCount());
+       serialize8(index);
+       while (n--) {
+         paramDesc(index++,&d);
+         serialize8(d.id);
+         serialize8(d.type);
+         serialize16(d.min);
+         serialize16(d.max);
+         serialize8(d.scale);
+       }
+     }
+     break;
+   case MSP_PARAM:
+     {
+       #define PARAM_MAX (MSP_REPLY_MAX / 3)
+       param_desc_t d;
+       uint8_t first = read8();
+       uint8_t count = read8();
+       uint8_t i,n = 0;
+       for(i=0;i<paramCount();i++) { // the ids which are compiled in, the GUI goes on after the last one it got
+         paramDesc(i,&d);
+         if ((uint8_t)(d.id - first) < count && n < PARAM_MAX) n++;
+       }
+       headSerialReply(3*n);
+       for(i=0;n && i<paramCount();i++) {
+         paramDesc(i,&d);
+         if ((uint8_t)(d.id - first) < count) {
+           serialize8(d.id);
+           serialize16(paramGet(&d));
+           n--;
+         }
+       }
+     }
+     break;
+   case MSP_SET_PARAM:
+     {
+       param_desc_t d;
+       uint16_t start;
+       uint8_t i,n = read8();
+       uint8_t ok = (dataSize[CURRENTPORT] == 1 + 3*(uint16_t)n);
+       start = indRX[CURRENTPORT];
+       for(i=0;ok && i<n;i++) {   // everything is checked before anything is changed
+         uint8_t id = read8();
+         int16_t v = read16();
+         if (!paramFind(id,&d) || v < d.min || v > d.max) ok = 0;
+       }
+       if (ok) {
+         indRX[CURRENTPORT] = start;
+         for(i=0;i<n;i++) {
+           paramFind(read8(),&d);
+           paramSet(&d,read16());
+         }
+         headSerialReply(0);
+       } else headSerialError(0);
+     }
+     break;
+#endif
+
+#if defined(LOG_FLIGHTS)
+   case MSP_FLIGHT_LOG:
+     if (dataSize[CURRENTPORT] != 1) {headSerialError(0); break;}
+     mspBulk[CURRENTPORT].cmd     = MSP_FLIGHT_LOG;
+     mspBulk[CURRENTPORT].version = mspVersion[CURRENTPORT];
+     mspBulk[CURRENTPORT].next    = read8();
+     mspBulkFrame(); // the first frame now, the others in the next cycles
+     break;
+#endif
+
    case MSP_RESET_CONF:
      if(!f.ARMED) LoadDefaults();
      headSerialReply(0);
@@ -677,6 +1181,40 @@ void evaluateCommand() {
    case MSP_DEBUG:
      s_struct((uint8_t*)&debug,8);
      break;
+   case MSP_SERIAL_STATS:
+     headSerialReply(UART_NUMBER*10);
+     for(uint8_t i=0;i<UART_NUMBER;i++) {
+       serialize16(mspFramesDeferred[i]);
+       serialize16(SerialRXDropped(i));
+       serialize16(serialTXStats[i].queued);
+       serialize16(serialTXStats[i].dropped);
+       serialize16(serialTXStats[i].deferred);
+     }
+     break;
+   case MSP_SET_STREAM:
+     {
+       uint8_t cmd = read8();
+       uint16_t period = read16();
+       if (mspStreamSet(cmd,period)) headSerialReply(0); else headSerialError(0);
+     }
+     break;
+   #if defined(RC_JITTER_STATS)
+   case MSP_RC_JITTER:
+     {
+       rcJitter_t j;
+       if (dataSize[CURRENTPORT] != 1) {headSerialError(0); break;}
+       uint8_t chan = read8();
+       if (!readRCJitter(chan,&j)) {headSerialError(0); break;}
+       if (chan == 0xFF) {headSerialReply(0); break;}
+       headSerialReply(2+sizeof(j));
+       serialize8(chan);
+       serialize8(RC_JITTER_BUCKETS);
+       for(uint8_t i=0;i<RC_JITTER_BUCKETS;i++) serialize16(j.hist[i]);
+       serialize16(j.avg);
+       serialize8(j.max);
+     }
+     break;
+   #endif
    #ifdef DEBUGMSG
    case MSP_DEBUGMSG:
      {
@@ -37,7 +37,9 @@
   static uint8_t PCInt_RX_Pins[PCINT_PIN_COUNT] = {PCINT_RX_BITS}; // if this slowes the PCINT readings we can switch to a define for each pcint bit
 #endif
 
-void rxInt(void);
+#if !defined(PPM_INPUT_CAPTURE)
+  void rxInt(void);
+#endif
 
 /**************************************************************************************/
 /***************                   RX Pin Setup                    ********************/
@@ -270,21 +272,41 @@ case 3: UCSR3C |= (1 << UPM31) | (1 << USBS3); break;
 
 // Read PPM SUM RX Data
 #if defined(SERIAL_SUM_PPM)
-  void rxInt(void) {
-    uint16_t now,diff;
-    static uint16_t last = 0;
+  #if defined(RC_JITTER_STATS)
+    rcJitter_t rcJitter[RC_CHANS];
+    static uint16_t rcJitterPrev[RC_CHANS];           // the width before rcValue
+
+    // called from the PPM ISR with the new pulse width, before rcValue is updated
+    // the jitter is half the second difference of the widths: a stick moving at a steady rate does not count
+    static void rcJitterUpdate(uint8_t chan, uint16_t width) {
+      rcJitter_t *j = &rcJitter[chan];
+      int16_t dd = (int16_t)(width + rcJitterPrev[chan]) - (int16_t)(rcValue[chan]<<1);
+      uint16_t d = (dd < 0 ? -dd : dd) >> 1;
+      uint8_t b = 0;
+
+      if (!rcJitterPrev[chan]) {rcJitterPrev[chan] = width; return;} // no history yet
+      rcJitterPrev[chan] = rcValue[chan];
+      if (d > 255) d = 255;
+      if (d > j->max) j->max = d;
+      j->avg += ((int16_t)(d<<4) - (int16_t)j->avg)>>3;   // IIR: 1/8 of the new sample, kept in 1/16 us
+      while (d && b < RC_JITTER_BUCKETS-1) {d >>= 1; b++;} // 0, 1, 2-3, 4-7 ...
+      if (j->hist[b] < 0xFFFF) j->hist[b]++;
+    }
+  #endif
+
+  // one pulse of the PPM frame, diff is the time since the previous rising edge in us
+  static void ppmSumPulse(uint16_t diff) {
     static uint8_t chan = 0;
   #if defined(FAILSAFE)
     static uint8_t GoodPulses;
   #endif
-  
-    now = micros();
-    sei();
-    diff = now - last;
-    last = now;
+
     if(diff>3000) chan = 0;
     else {
       if(900<diff && diff<2200 && chan<RC_CHANS ) {   //Only if the signal is between these values it is valid, otherwise the failsafe counter should move up
+        #if defined(RC_JITTER_STATS)
+          rcJitterUpdate(chan,diff);
+        #endif
         rcValue[chan] = diff;
         #if defined(FAILSAFE)
           if(chan<4 && diff>FAILSAFE_DETECT_TRESHOLD) GoodPulses |= (1<<chan); // if signal is valid - mark channel as OK
@@ -294,9 +316,34 @@ case 3: UCSR3C |= (1 << UPM31) | (1 << USBS3); break;
           }
         #endif
       }
-    chan++;
+      chan++;
+    }
   }
-}
+
+  #if defined(PPM_INPUT_CAPTURE)
+    // the rising edge time is latched in ICR5 by the hardware: no jitter from the latency of this ISR
+    ISR(TIMER5_CAPT_vect) {
+      uint16_t now,diff;
+      static uint16_t last = 0;
+
+      now = ICR5;
+      sei();
+      diff = (now - last) / (F_CPU/8000000UL); // Timer5 prescaler 8 => ticks to us
+      last = now;
+      ppmSumPulse(diff);
+    }
+  #else
+    void rxInt(void) {
+      uint16_t now,diff;
+      static uint16_t last = 0;
+
+      now = micros();
+      sei();
+      diff = now - last;
+      last = now;
+      ppmSumPulse(diff);
+    }
+  #endif
 #endif
 
 /**************************************************************************************/
@@ -405,6 +452,30 @@ uint16_t readRawRC(uint8_t chan) {
   return data; // We return the value correctly copied when the IRQ's where disabled
 }
 
+#if defined(RC_JITTER_STATS)
+  // copy the jitter stats of PPM position chan (raw order), 0xFF clears all the stats
+  uint8_t readRCJitter(uint8_t chan, rcJitter_t *j) {
+    uint8_t oldSREG = SREG;
+    if (chan == 0xFF) {
+      cli(); memset(rcJitter,0,sizeof(rcJitter)); SREG = oldSREG;
+      return 1;
+    }
+    if (chan >= RC_CHANS) return 0;
+    cli(); *j = rcJitter[chan]; SREG = oldSREG;
+    return 1;
+  }
+#endif
+
+#if defined(RC_JITTER_BYPASS_THRESHOLD)
+  static uint16_t rcJitterAvg(uint8_t chan) {
+    uint16_t avg;
+    uint8_t oldSREG = SREG; cli();
+    avg = rcJitter[rcChannel[chan]].avg;
+    SREG = oldSREG;
+    return avg;
+  }
+#endif
+
 /**************************************************************************************/
 /***************          compute and Filter the RX data           ********************/
 /**************************************************************************************/
@@ -431,8 +502,15 @@ void computeRC() {
           rcDataMean = rcDataTmp;
           for (a=0;a<AVERAGING_ARRAY_LENGTH-1;a++) rcDataMean += rcData4Values[chan][a];
           rcDataMean = (rcDataMean+(AVERAGING_ARRAY_LENGTH/2))/AVERAGING_ARRAY_LENGTH;
-          if ( rcDataMean < (uint16_t)rcData[chan] -3)  rcData[chan] = rcDataMean+2;
-          if ( rcDataMean > (uint16_t)rcData[chan] +3)  rcData[chan] = rcDataMean-2;
+          #if defined(RC_JITTER_BYPASS_THRESHOLD)
+          if (rcJitterAvg(chan) < (RC_JITTER_BYPASS_THRESHOLD<<4)) {
+            rcData[chan] = rcDataTmp; // clean channel: no averaging latency, the array is still filled to switch back smoothly
+          } else
+          #endif
+          {
+            if ( rcDataMean < (uint16_t)rcData[chan] -3)  rcData[chan] = rcDataMean+2;
+            if ( rcDataMean > (uint16_t)rcData[chan] +3)  rcData[chan] = rcDataMean-2;
+          }
           rcData4Values[chan][rc4ValuesIndex] = rcDataTmp;
         }
       #endif
@@ -10,6 +10,9 @@ void readSBus(void);
   void initOpenLRS(void);
   void Read_OpenLRS_RC(void);
 #endif
+#if defined(RC_JITTER_STATS)
+  uint8_t readRCJitter(uint8_t chan, rcJitter_t *j);
+#endif
 #if defined(SPEK_BIND)  // Bind Support
   void spekBind(void);
 #endif
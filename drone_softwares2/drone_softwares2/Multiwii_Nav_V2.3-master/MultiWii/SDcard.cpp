@@ -17,16 +17,426 @@
 
 #define PERMANENT_LOG_FILENAME "PERM.TXT"
 #define GPS_LOG_FILENAME "GPS_DATA.RAW"
+#define FLIGHT_LOG_FILENAME "FLIGHTS.BIN"
 
 SdFat sd;
 ofstream gps_data;	// Log file for GPS raw data
 ofstream permanent; // Log file for permanent logging
-SdFile mission_file; // comma separated file for missions ( lat/lon/alt/heading )
+SdFile mission_file; // binary mission store, see MISSION_SD
 
 uint8_t sdFlags = 0;
+
+/* SPI clock of the card: the fastest one the card and the wiring accept at init, lowered after a write error */
+static const uint8_t sdSpiRates[] = {SPI_FULL_SPEED, SPI_HALF_SPEED, SPI_QUARTER_SPEED};
+static uint8_t sdSpiRate;     // index in sdSpiRates
+
+#if defined(LOG_BLACKBOX)
+static void sdSlowDown() {
+	if (sdSpiRate < sizeof(sdSpiRates) - 1) sd.card()->setSckRate(sdSpiRates[++sdSpiRate]);
+}
+#endif
 #define MFO_FLAG_ON 0x01			
 #define MFO_FLAG_OFF 0xFE
 
+#if defined(LOG_BLACKBOX)
+/* Blackbox : one frame every LOG_BLACKBOX loops while armed.
+ * The file is allocated in one piece when disarmed, the flight is then written with a multiple block write
+ * straight to the card: no FAT access in flight. Two 512 bytes blocks in RAM, one is filled while the other
+ * waits for the card, which is never waited for (a frame is dropped if both blocks are full).
+ *
+ * File format (decoder: tools/bbdecode.cpp)
+ *  - text header, "H name:value" lines, then 0 up to the end of its block (1 or 2 blocks).
+ *    It describes the fields: names, C types and predictors.
+ *  - then the frames, back to back across the block limits. The end of the last block is 0 filled.
+ *    'I' frame : every field as a zig-zag varint of its value (predictor 0).
+ *    'P' frame : every field as a zig-zag varint of value - prediction, the prediction is given by the field predictor:
+ *                0 = 0, 1 = previous frame, 2 = straight line through the two previous frames.
+ *    An 'I' frame is written every LOG_BLACKBOX_INTRA frames and after a dropped frame: it is the resync point.
+ *  zig-zag : 0,-1,1,-2,.. -> 0,1,2,3,..   varint : 7 bits per byte, lowest first, bit 7 set when more bytes follow */
+#define BB_BLOCK_SIZE     512
+#define BB_VERSION        2
+#define BB_PRED_ZERO      0
+#define BB_PRED_PREVIOUS  1
+#define BB_PRED_STRAIGHT  2
+
+static const char bbGroupName[][10] PROGMEM = {"time","gyro","acc","rcCommand","axisPID","motor","angle","heading","alt"};
+static const char bbTypeName[][4] PROGMEM = {"u32","s16","s32"};
+enum bbtype {BB_U32 = 0, BB_S16, BB_S32};
+static const uint8_t bbGroupInfo[][3] PROGMEM = {   // fields, type, predictor
+	{1, BB_U32, BB_PRED_STRAIGHT},
+	{3, BB_S16, BB_PRED_PREVIOUS},
+	{3, BB_S16, BB_PRED_PREVIOUS},
+	{4, BB_S16, BB_PRED_PREVIOUS},
+	{3, BB_S16, BB_PRED_PREVIOUS},
+	{NUMBER_MOTOR, BB_S16, BB_PRED_PREVIOUS},
+	{2, BB_S16, BB_PRED_PREVIOUS},
+	{1, BB_S16, BB_PRED_PREVIOUS},
+	{1, BB_S32, BB_PRED_PREVIOUS},
+};
+#define BB_GROUPS  (sizeof(bbGroupInfo) / sizeof(bbGroupInfo[0]))
+#define BB_FIELDS  (1 + 3 + 3 + 4 + 3 + NUMBER_MOTOR + 2 + 1 + 1)
+#define BB_FRAME_MAX (1 + BB_FIELDS * 5)
+
+enum bbstate {
+	BB_IDLE = 0,            // no file
+	BB_READY,               // file allocated, waiting for arming
+	BB_LOGGING,             // multiple block write in progress
+	BB_STOPPED              // file full or card error: nothing more until disarm
+};
+
+static SdFile bbFile;
+static uint8_t bbBuf[2][BB_BLOCK_SIZE];
+static uint16_t bbPos;        // next byte in bbBuf[bbFill]
+static uint8_t bbFill;        // block being filled
+static uint8_t bbPending;     // the other block is full and not written yet
+static uint32_t bbBlock;      // next block of the card to write
+static uint32_t bbEnd;        // last block of the file
+static uint32_t bbFirst;      // first block of the file
+static uint8_t bbState = BB_IDLE;
+static uint8_t bbWriting;     // the card is in the multiple block write
+static uint8_t bbDivider;
+static uint8_t bbIntra;       // frames until the next 'I' frame, 0 forces it
+static uint32_t bbPrev[BB_FIELDS], bbPrev2[BB_FIELDS];   // unsigned: the predictions wrap like the time field, no overflow
+uint16_t blackboxDropped;     // frames dropped during the last flight
+
+/* allocation of the file of the next flight, BB000.BIN to BB999.BIN, one step per loop while disarmed:
+ * the root directory is read one entry per step to find the highest BBnnn.BIN, then the file after it is created,
+ * BB_ALLOC_CLUSTERS clusters of the FAT searched or linked per step.
+ * Gives up until the next reboot when the card is full or there is no number left */
+#define BB_ALLOC_CLUSTERS 256   // one FAT16 block, two FAT32 blocks
+enum bballoc {
+	BB_ALLOC_SCAN = 0,      // reading the directory
+	BB_ALLOC_CREATE,        // bbNext is the number of the next file
+	BB_ALLOC_NONE           // file allocated, or failed
+};
+static uint8_t bbAlloc = BB_ALLOC_SCAN;
+static uint32_t bbScanPos;    // position of the next entry in the root directory
+static uint16_t bbNext;       // number of the next file
+static FatAlloc_t bbAllocFat; // clusters of the file being created
+
+static void blackboxAllocateStep() {
+	if (f.SDCARD == 0 || f.ARMED || bbState != BB_IDLE) return;
+	if (bbAlloc == BB_ALLOC_SCAN) {
+		dir_t d;
+		uint16_t num = 0;
+		uint8_t i;
+		sd.vwd()->seekSet(bbScanPos);   // the other files of the card are opened through the same directory
+		if (sd.vwd()->readDir(&d) <= 0) {
+			bbAlloc = BB_ALLOC_CREATE;   // end of the directory
+			return;
+		}
+		bbScanPos = sd.vwd()->curPosition();
+		if (memcmp(d.name, "BB", 2) || memcmp(d.name + 5, "   BIN", 6)) return;
+		for (i = 2; i < 5; i++) {
+			if (d.name[i] < '0' || d.name[i] > '9') return;
+			num = num * 10 + d.name[i] - '0';
+		}
+		if (num >= bbNext) bbNext = num + 1;
+	} else if (bbAlloc == BB_ALLOC_CREATE) {
+		char name[] = "BB000.BIN";
+		int8_t created;
+		if (bbNext >= 1000) {
+			bbAlloc = BB_ALLOC_NONE;
+			return;
+		}
+		name[2] = '0' + bbNext / 100;
+		name[3] = '0' + (bbNext / 10) % 10;
+		name[4] = '0' + bbNext % 10;
+		created = bbFile.createContiguousStep(sd.vwd(), name, LOG_BLACKBOX_BLOCKS * BB_BLOCK_SIZE, &bbAllocFat, BB_ALLOC_CLUSTERS);
+		if (created == 0) return;   // more of the FAT at the next step
+		bbAllocFat = FatAlloc_t();
+		bbAlloc = BB_ALLOC_NONE;
+		if (created < 0) return;
+		if (!bbFile.contiguousRange(&bbFirst, &bbEnd)) {
+			bbFile.remove();
+			return;
+		}
+		bbNext++;
+		bbState = BB_READY;
+	}
+}
+
+static void blackboxWrite(const uint8_t *buf) {
+	if (!sd.card()->writeData(buf)) {   // card not ready or data rejected: slower clock for the next flight
+		sdSlowDown();
+		bbState = BB_STOPPED;
+		return;
+	}
+	if (++bbBlock > bbEnd) bbState = BB_STOPPED;   // file full
+}
+
+static void blackboxWritePending() {
+	blackboxWrite(bbBuf[bbFill ^ 1]);
+	bbPending = 0;
+}
+
+/* header text, built across the two blocks (they are contiguous): about 600 bytes with 8 motors */
+#define BB_HEADER(i) (bbBuf[0][i])
+static void bbHeaderStr(const char *s) { while (*s) BB_HEADER(bbPos++) = *s++; }
+static void bbHeaderStr_P(const char *s) { char c; while ((c = pgm_read_byte(s++))) BB_HEADER(bbPos++) = c; }
+static void bbHeaderNum(uint16_t v) {
+	char d[6]; uint8_t n = 0;
+	do { d[n++] = '0' + v % 10; v /= 10; } while (v);
+	while (n) BB_HEADER(bbPos++) = d[--n];
+}
+static void bbHeaderFields(uint8_t what) {   // 0: names, 1: types, 2: predictors
+	uint8_t g, i, cnt;
+	for (g = 0; g < BB_GROUPS; g++) {
+		cnt = pgm_read_byte(&bbGroupInfo[g][0]);
+		for (i = 0; i < cnt; i++) {
+			if (g || i) BB_HEADER(bbPos++) = ',';
+			if (what == 0) {
+				bbHeaderStr_P(bbGroupName[g]);
+				if (cnt > 1) { bbHeaderStr("["); bbHeaderNum(i); bbHeaderStr("]"); }
+			} else if (what == 1) bbHeaderStr_P(bbTypeName[pgm_read_byte(&bbGroupInfo[g][1])]);
+			else bbHeaderNum(pgm_read_byte(&bbGroupInfo[g][2]));
+		}
+	}
+	bbHeaderStr("\n");
+}
+
+void blackboxStart() {
+	if (bbState != BB_READY) return;
+	bbBlock = bbFirst;
+	if (!sd.card()->writeStart(bbBlock, bbEnd - bbFirst + 1)) {
+		sdSlowDown();
+		return;
+	}
+	bbWriting = 1;
+	bbPos = 0;
+	memset(bbBuf, 0, sizeof(bbBuf));
+	bbHeaderStr("H Product:MultiWii blackbox\nH Version:"); bbHeaderNum(BB_VERSION);
+	bbHeaderStr("\nH Divisor:"); bbHeaderNum(LOG_BLACKBOX);
+	bbHeaderStr("\nH I interval:"); bbHeaderNum(LOG_BLACKBOX_INTRA);
+	bbHeaderStr("\nH Cycle time:"); bbHeaderNum(cycleTime);
+	bbHeaderStr("\nH Field names:"); bbHeaderFields(0);
+	bbHeaderStr("H Field types:"); bbHeaderFields(1);
+	bbHeaderStr("H Field predictors:"); bbHeaderFields(2);
+	bbState = BB_LOGGING;
+	blackboxWrite(bbBuf[0]);
+	if (bbPos > BB_BLOCK_SIZE && bbState == BB_LOGGING) blackboxWrite(bbBuf[1]);
+	memset(bbBuf, 0, sizeof(bbBuf));
+	bbFill = 0; bbPos = 0; bbPending = 0; bbDivider = 0; bbIntra = 0;
+	blackboxDropped = 0;
+}
+
+static uint8_t *bbPutVarint(uint8_t *p, int32_t v) {
+	uint32_t z = ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);   // zig-zag
+	while (z > 0x7F) {
+		*p++ = (uint8_t)z | 0x80;
+		z >>= 7;
+	}
+	*p++ = z;
+	return p;
+}
+
+/* at the end of the loop: adds a frame and writes the full block if the card is not busy, allocates the next file while disarmed */
+void blackboxLog() {
+	uint8_t frame[BB_FRAME_MAX], *p;
+	uint32_t v[BB_FIELDS], pred;   // the signed fields are stored modulo 2^32, as tools/bblog.h decodes them
+	uint16_t len, n;
+	uint8_t i, g, j, k, intra;
+	if (bbState == BB_IDLE) blackboxAllocateStep();
+	if (bbState != BB_LOGGING) return;
+	if (++bbDivider >= LOG_BLACKBOX) {
+		bbDivider = 0;
+		k = 0;
+		v[k++] = currentTime;
+		for (i = 0; i < 3; i++) v[k++] = imu.gyroData[i];
+		for (i = 0; i < 3; i++) v[k++] = imu.accSmooth[i];
+		for (i = 0; i < 4; i++) v[k++] = rcCommand[i];
+		for (i = 0; i < 3; i++) v[k++] = axisPID[i];
+		for (i = 0; i < NUMBER_MOTOR; i++) v[k++] = motor[i];
+		v[k++] = att.angle[ROLL];
+		v[k++] = att.angle[PITCH];
+		v[k++] = att.heading;
+		v[k++] = alt.EstAlt;
+		intra = (bbIntra == 0);
+		p = frame;
+		*p++ = intra ? 'I' : 'P';
+		k = 0;
+		for (g = 0; g < BB_GROUPS; g++) {
+			uint8_t cnt = pgm_read_byte(&bbGroupInfo[g][0]);
+			uint8_t predictor = intra ? BB_PRED_ZERO : pgm_read_byte(&bbGroupInfo[g][2]);
+			for (j = 0; j < cnt; j++, k++) {
+				pred = 0;
+				if (predictor == BB_PRED_PREVIOUS) pred = bbPrev[k];
+				else if (predictor == BB_PRED_STRAIGHT) pred = 2 * bbPrev[k] - bbPrev2[k];
+				p = bbPutVarint(p, (int32_t)(v[k] - pred));
+			}
+		}
+		len = p - frame;
+		if (bbPending && bbPos + len > BB_BLOCK_SIZE) {
+			blackboxDropped++;
+			bbIntra = 0;               // the next frame can't be predicted from this one
+		} else {
+			for (k = 0; k < BB_FIELDS; k++) {
+				bbPrev2[k] = intra ? v[k] : bbPrev[k];   // no straight line across an 'I' frame
+				bbPrev[k] = v[k];
+			}
+			bbIntra = intra ? LOG_BLACKBOX_INTRA - 1 : bbIntra - 1;
+			n = BB_BLOCK_SIZE - bbPos;
+			if (n > len) n = len;
+			memcpy(&bbBuf[bbFill][bbPos], frame, n);
+			bbPos += n;
+			if (bbPos == BB_BLOCK_SIZE) {  // block full: swap
+				bbFill ^= 1;
+				bbPending = 1;
+				bbPos = len - n;
+				memcpy(bbBuf[bbFill], frame + n, bbPos);
+			}
+		}
+	}
+	if (bbPending && !sd.card()->isBusy()) blackboxWritePending();
+}
+
+/* at disarm: writes what is left, ends the multiple block write and trims the file. The next one is allocated by blackboxLog() */
+void blackboxStop() {
+	if (bbState == BB_LOGGING) {
+		if (bbPending) blackboxWritePending();
+		if (bbState == BB_LOGGING && bbPos > 0) {
+			memset(&bbBuf[bbFill][bbPos], 0, BB_BLOCK_SIZE - bbPos);
+			bbFill ^= 1;
+			blackboxWritePending();
+		}
+	}
+	if (bbState == BB_LOGGING || bbState == BB_STOPPED) {
+		if (bbWriting) sd.card()->writeStop();
+		bbWriting = 0;
+		bbFile.truncate((bbBlock - bbFirst) * BB_BLOCK_SIZE);
+		bbFile.close();
+		bbState = BB_IDLE;
+		if (bbAlloc == BB_ALLOC_NONE) bbAlloc = BB_ALLOC_CREATE;
+	}
+}
+
+/* the card can't be used for anything else during the multiple block write: it is ended before
+ * (waits for the card, a few ms) and started again at the same block after */
+static void blackboxPause() {
+	if (!bbWriting) return;
+	if (bbPending && bbState == BB_LOGGING) blackboxWritePending();
+	sd.card()->writeStop();
+	bbWriting = 0;
+}
+
+static void blackboxResume() {
+	if (bbState != BB_LOGGING || bbWriting) return;
+	if (!sd.card()->writeStart(bbBlock, bbEnd - bbBlock + 1)) {
+		sdSlowDown();
+		bbState = BB_STOPPED;
+		return;
+	}
+	bbWriting = 1;
+}
+#endif
+
+#if defined(MISSION_SD)
+/* Mission store: MISSION.BIN, fixed size records, the record n is the mission step n.
+ * Record 0 is the header: "MWMS", version, record size, number of the last step stored.
+ * A step record is the mission_step_struct with its checksum, 0 padded: 16 records per block, never across two.
+ * Missing steps are 0 filled and fail the checksum.
+ * In flight MISSION_SD steps are kept in RAM: a step which is not there is read with the next ones,
+ * when half of them are used the following ones are read by missionSDPrefetch(), not in the step change. */
+#define MISSION_FILENAME  "MISSION.BIN"
+#define MS_RECORD_SIZE    32
+#define MS_VERSION        1
+
+typedef struct {
+	char      magic[4];
+	uint8_t   version;
+	uint8_t   recordSize;
+	uint16_t  last;           // highest step number stored
+} mission_sd_header_t;
+
+static mission_sd_header_t msHeader;
+static uint8_t msOpen;
+static mission_step_struct msAhead[MISSION_SD];   // steps msFirst..msFirst+msCount-1
+static wp_number_t msFirst;   // 0: nothing in RAM
+static uint8_t msCount;
+static wp_number_t msWanted;  // first step to read in the background, 0: none
+
+static bool missionSDWriteRecord(wp_number_t number, const void *data, uint8_t len) {
+	uint8_t rec[MS_RECORD_SIZE];
+	uint32_t pos = (uint32_t)number * MS_RECORD_SIZE;
+	memset(rec, 0, sizeof(rec));
+	if (!mission_file.seekEnd()) return false;
+	while (mission_file.curPosition() < pos) {   // 0 records up to a step written out of order
+		if (mission_file.write(rec, MS_RECORD_SIZE) != MS_RECORD_SIZE) return false;
+	}
+	memcpy(rec, data, len);
+	return mission_file.seekSet(pos) && mission_file.write(rec, MS_RECORD_SIZE) == MS_RECORD_SIZE;
+}
+
+static void missionSDOpen() {
+	if (!mission_file.open(MISSION_FILENAME, O_RDWR | O_CREAT)) return;
+	if (mission_file.read(&msHeader, sizeof(msHeader)) != sizeof(msHeader) || memcmp(msHeader.magic, "MWMS", 4) != 0
+	    || msHeader.version != MS_VERSION || msHeader.recordSize != MS_RECORD_SIZE) {   // new or foreign file: empty mission
+		memcpy(msHeader.magic, "MWMS", 4);
+		msHeader.version    = MS_VERSION;
+		msHeader.recordSize = MS_RECORD_SIZE;
+		msHeader.last       = 0;
+		if (!mission_file.truncate(0) || !missionSDWriteRecord(0, &msHeader, sizeof(msHeader)) || !mission_file.sync()) return;
+	}
+	msOpen = 1;
+}
+
+static void missionSDLoad(wp_number_t first) {
+	uint8_t n = 0;
+#if defined(LOG_BLACKBOX)
+	blackboxPause();
+#endif
+	if (mission_file.seekSet((uint32_t)first * MS_RECORD_SIZE)) {
+		while (n < MISSION_SD && (uint32_t)first + n <= msHeader.last) {
+			if (mission_file.read(&msAhead[n], sizeof(mission_step_struct)) != sizeof(mission_step_struct)) break;
+			n++;
+			if (!mission_file.seekCur(MS_RECORD_SIZE - sizeof(mission_step_struct))) break;
+		}
+	}
+#if defined(LOG_BLACKBOX)
+	blackboxResume();
+#endif
+	msFirst = n ? first : 0;
+	msCount = n;
+}
+
+/* step->checksum must be set. Ground only: a few ms, and more for a step far after the last one */
+bool missionSDWrite(mission_step_struct *step) {
+	bool ok;
+	if (!msOpen || step->number == 0) return false;
+	msFirst = 0;              // what is in RAM may be the old step
+	msWanted = 0;
+#if defined(LOG_BLACKBOX)
+	blackboxPause();
+#endif
+	ok = missionSDWriteRecord(step->number, step, sizeof(mission_step_struct));
+	if (ok && step->number > msHeader.last) {
+		msHeader.last = step->number;
+		ok = missionSDWriteRecord(0, &msHeader, sizeof(msHeader));
+	}
+	ok = mission_file.sync() && ok;
+#if defined(LOG_BLACKBOX)
+	blackboxResume();
+#endif
+	return ok;
+}
+
+bool missionSDRead(wp_number_t number, mission_step_struct *step) {
+	if (!msOpen || number == 0 || number > msHeader.last) return false;
+	if (msFirst == 0 || number < msFirst || number >= msFirst + msCount) missionSDLoad(number);
+	if (msFirst == 0 || number < msFirst || number >= msFirst + msCount) return false;
+	*step = msAhead[number - msFirst];
+	if (number - msFirst >= MISSION_SD / 2 && msFirst + msCount <= msHeader.last) msWanted = number + 1;
+	return calculate_sum((uint8_t*)step, sizeof(mission_step_struct)) == step->checksum && step->number == number;
+}
+
+/* called by the navigation while flying to a step: reads the next steps when needed */
+void missionSDPrefetch() {
+	if (msWanted == 0) return;
+	missionSDLoad(msWanted);
+	msWanted = 0;
+}
+#endif
+
 /* Init SD card : assign OUTPUT mode to CSPIN and start SPI mode */
 void init_SD(){
 
@@ -35,18 +445,27 @@ void init_SD(){
 #else
 	pinMode(CSPIN, OUTPUT); 	// Put CSPIN to OUTPUT for SD library
 #endif
-	if (!sd.begin(CSPIN, SPI_HALF_SPEED)) {
+	for (sdSpiRate = 0; sdSpiRate < sizeof(sdSpiRates); sdSpiRate++) {   // the volume init reads the boot sector: a bad transfer fails it
+		if (sd.begin(CSPIN, sdSpiRates[sdSpiRate])) break;
+	}
+	if (sdSpiRate == sizeof(sdSpiRates)) {
 		f.SDCARD = 0;      	// If init fails, tell the code not to try to write on it
 		debug[1] = 999;
 	}
 	else {
 		f.SDCARD = 1;
 		debug[1] = 000;
+#if defined(MISSION_SD)
+		missionSDOpen();
+#endif
 	}
 }
 
 void writeGPSLog(int32_t latitude, int32_t longitude, int32_t altitude) {
 	if (f.SDCARD == 0) return;
+#if defined(LOG_BLACKBOX)
+	if (bbState == BB_LOGGING) return; // the card is in a multiple block write
+#endif
 	gps_data.open(GPS_LOG_FILENAME, O_WRITE | O_CREAT | O_APPEND);
 	char lat_c[11];
 	char lon_c[11];
@@ -88,6 +507,20 @@ void writePLogToSD() {
 
 }
 
+#if defined(LOG_FLIGHTS)
+/* every flight_log_t record one after the other, the whole history (the eeprom keeps the last ones) */
+void writeFlightLogToSD(flight_log_t *rec) {
+	if (f.SDCARD == 0) return;
+#if defined(LOG_BLACKBOX)
+	if (bbState == BB_LOGGING) return; // the card is in a multiple block write
+#endif
+	SdFile file;
+	if (!file.open(FLIGHT_LOG_FILENAME, O_WRITE | O_CREAT | O_APPEND)) return;
+	file.write(rec, sizeof(*rec));
+	file.close();
+}
+#endif
+
 void fillPlogStruct(char* key, char* value) {
 	if (strcmp(key, "arm") == 0)			sscanf(value, "%u", &plog.arm);
 	if (strcmp(key, "disarm") == 0)		sscanf(value, "%u", &plog.disarm);
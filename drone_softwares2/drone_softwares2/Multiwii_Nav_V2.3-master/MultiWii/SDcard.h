@@ -7,6 +7,20 @@ void writeGPSLog(int32_t latitude, int32_t longitude, int32_t altitude);
 void writePLogToSD(void);
 void fillPlogStruct(char* key, char* value);
 void readPLogFromSD(void);
+#if defined(LOG_FLIGHTS)
+void writeFlightLogToSD(flight_log_t *rec);                         // appends the record to FLIGHTS.BIN
+#endif
+#if defined(LOG_BLACKBOX)
+void blackboxStart(void);
+void blackboxLog(void);
+void blackboxStop(void);
+extern uint16_t blackboxDropped;
+#endif
+#if defined(MISSION_SD)
+bool missionSDWrite(mission_step_struct *step);                     // stores the step in MISSION.BIN (checksum set by the caller)
+bool missionSDRead(wp_number_t number, mission_step_struct *step);  // false if the step is missing or its checksum is wrong
+void missionSDPrefetch(void);                                       // reads the next steps in RAM when the mission needs them
+#endif
 #endif
 
 #endif //SDcard_H_
\ No newline at end of file
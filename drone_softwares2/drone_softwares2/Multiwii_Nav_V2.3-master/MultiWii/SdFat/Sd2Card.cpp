@@ -973,6 +973,21 @@ bool Sd2Card::setSckRate(uint8_t sckRateID) {
   return true;
 }
 //------------------------------------------------------------------------------
+/** Check for busy.  MISO low indicates the card is busy programming.
+ *
+ * \note Use it between writeData() calls of a multiple block write to
+ * avoid waiting for the card.
+ *
+ * \return true if busy else false.
+ */
+bool Sd2Card::isBusy() {
+  bool rtn;
+  chipSelectLow();
+  rtn = spiRec() != 0XFF;
+  chipSelectHigh();
+  return rtn;
+}
+//------------------------------------------------------------------------------
 // wait for card to go not busy
 bool Sd2Card::waitNotBusy(uint16_t timeoutMillis) {
   uint16_t t0 = millis();
@@ -147,6 +147,7 @@ class Sd2Card {
   int errorData() const {return status_;}
   bool init(uint8_t sckRateID = SPI_FULL_SPEED,
     uint8_t chipSelectPin = SD_CHIP_SELECT_PIN);
+  bool isBusy();
   bool readBlock(uint32_t block, uint8_t* dst);
   bool readCID(cid_t* cid) {
     return readRegister(CMD10, cid);
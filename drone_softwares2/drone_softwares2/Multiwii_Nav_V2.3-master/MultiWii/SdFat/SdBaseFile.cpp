@@ -139,6 +139,49 @@ bool SdBaseFile::createContiguous(SdBaseFile* dirFile,
  fail:
   return false;
 }
+// createContiguous() a few clusters per call, see SdVolume::allocContiguousStep():
+// returns 1 when the file is created, 0 when more calls are needed, -1 on failure
+int8_t SdBaseFile::createContiguousStep(SdBaseFile* dirFile,
+        const char* path, uint32_t size, FatAlloc_t* alloc, uint16_t budget) {
+  uint32_t count;
+  int8_t rtn;
+  // don't allow zero length file
+  if (size == 0) {
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+  // the file is created by the first call, empty until its clusters are linked
+  if (!isOpen() && !open(dirFile, path, O_CREAT | O_EXCL | O_RDWR)) {
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+  // calculate number of clusters needed
+  count = ((size - 1) >> (vol_->clusterSizeShift_ + 9)) + 1;
+
+  // allocate clusters
+  rtn = vol_->allocContiguousStep(count, alloc, budget);
+  if (rtn == 0) return 0;
+  if (rtn < 0) {
+    remove();
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+  firstCluster_ = alloc->bgn;
+  fileSize_ = size;
+
+  // insure sync() will update dir entry
+  flags_ |= F_FILE_DIR_DIRTY;
+
+  if (!sync()) {
+    remove();
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+  return 1;
+
+ fail:
+  return -1;
+}
 bool SdBaseFile::dirEntry(dir_t* dir) {
   dir_t* p;
   // make sure fields on SD are correct
@@ -1031,7 +1074,7 @@ int SdBaseFile::read(void* buf, size_t nbyte) {
       }
       block = vol_->clusterStartBlock(curCluster_) + blockOfCluster;
     }
-    if (offset != 0 || toRead < 512 || block == vol_->cacheBlockNumber()) {
+    if (offset != 0 || toRead < 512 || vol_->cacheHas(block)) {
       // amount to be read from current block
       n = 512 - offset;
       if (n > toRead) n = toRead;
@@ -1057,13 +1100,10 @@ int SdBaseFile::read(void* buf, size_t nbyte) {
         if (mb < nb) nb = mb;
       }
       n = 512*nb;
-      if (vol_->cacheBlockNumber() <= block
-        && block < (vol_->cacheBlockNumber() + nb)) {
-        // flush cache if a block is in the cache
-        if (!vol_->cacheSync()) {
-          DBG_FAIL_MACRO;
-          goto fail;
-        }
+      // flush cache if a block is in the cache
+      if (!vol_->cacheSyncRange(block, nb)) {
+        DBG_FAIL_MACRO;
+        goto fail;
       }
       if (!vol_->sdCard()->readStart(block)) {
         DBG_FAIL_MACRO;
@@ -1701,9 +1741,7 @@ int SdBaseFile::write(const void* buf, size_t nbyte) {
     } else if (!USE_MULTI_BLOCK_SD_IO || nToWrite < 1024) {
       // use single block write command
       n = 512;
-      if (vol_->cacheBlockNumber() == block) {
-        vol_->cacheInvalidate();
-      }
+      vol_->cacheInvalidateBlock(block);
       if (!vol_->writeBlock(block, src)) {
         DBG_FAIL_MACRO;
         goto fail;
@@ -1721,9 +1759,7 @@ int SdBaseFile::write(const void* buf, size_t nbyte) {
       }
       for (uint8_t b = 0; b < nBlock; b++) {
         // invalidate cache if block is in cache
-        if ((block + b) == vol_->cacheBlockNumber()) {
-          vol_->cacheInvalidate();
-        }
+        vol_->cacheInvalidateBlock(block + b);
         if (!vol_->sdCard()->writeData(src + 512*b)) {
           DBG_FAIL_MACRO;
           goto fail;
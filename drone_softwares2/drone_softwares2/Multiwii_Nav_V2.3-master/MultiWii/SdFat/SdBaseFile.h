@@ -210,6 +210,8 @@ class SdBaseFile {
   bool contiguousRange(uint32_t* bgnBlock, uint32_t* endBlock);
   bool createContiguous(SdBaseFile* dirFile,
           const char* path, uint32_t size);
+  int8_t createContiguousStep(SdBaseFile* dirFile, const char* path,
+    uint32_t size, FatAlloc_t* alloc, uint16_t budget);
   /** \return The current cluster number for a file or directory. */
   uint32_t curCluster() const {return curCluster_;}
   /** \return The current position for a file or directory. */
@@ -23,6 +23,16 @@
 #endif
 #define USE_SD_CRC 0
 #define USE_MULTIPLE_CARDS 0
+// Number of 512 byte blocks in the SdVolume cache, shared by FAT, directory
+// and file data blocks and replaced least recently used first.  1 keeps the
+// single block cache (and USE_SEPARATE_FAT_CACHE).  Each block costs 518
+// bytes of RAM; SdVolume::cacheHits()/cacheMisses() help to size it.
+#ifndef SD_CACHE_BLOCKS
+#define SD_CACHE_BLOCKS 1
+#endif  // SD_CACHE_BLOCKS
+#if SD_CACHE_BLOCKS > 1 && USE_MULTIPLE_CARDS
+#error SD_CACHE_BLOCKS > 1 requires USE_MULTIPLE_CARDS 0
+#endif  // SD_CACHE_BLOCKS
 #define DESTRUCTOR_CLOSES_FILE 0
 #define USE_SERIAL_FOR_STD_OUT 0
 #define ENDL_CALLS_FLUSH 0
@@ -8,7 +8,8 @@
  */
 SdFile::SdFile(const char* path, uint8_t oflag) : SdBaseFile(path, oflag) {
 }
-//-int SdFile::write(const void* buf, size_t nbyte) {
+//------------------------------------------------------------------------------
+int SdFile::write(const void* buf, size_t nbyte) {
   return SdBaseFile::write(buf, nbyte);
 }
 size_t SdFile::write(uint8_t b) {
@@ -2,7 +2,17 @@
 // macro for debug
 #define DBG_FAIL_MACRO  //  Serial.print(__FILE__);Serial.println(__LINE__)
 //------------------------------------------------------------------------------
-#if !USE_MULTIPLE_CARDS
+uint16_t SdVolume::cacheHits_;    // fetches found in the cache
+uint16_t SdVolume::cacheMisses_;  // fetches that took a cache block
+#if SD_CACHE_BLOCKS > 1
+// LRU block cache
+cache_t  SdVolume::cacheBuffer_[SD_CACHE_BLOCKS];
+uint32_t SdVolume::cacheBlockNumber_[SD_CACHE_BLOCKS];
+uint8_t  SdVolume::cacheStatus_[SD_CACHE_BLOCKS];
+uint8_t  SdVolume::cacheOrder_[SD_CACHE_BLOCKS];
+uint32_t SdVolume::cacheFatOffset_;    // offset for mirrored FAT
+Sd2Card* SdVolume::sdCard_;            // pointer to SD card object
+#elif !USE_MULTIPLE_CARDS
 // raw block cache
 
 cache_t  SdVolume::cacheBuffer_;       // 512 byte cache for Sd2Card
@@ -102,8 +112,225 @@ bool SdVolume::allocContiguous(uint32_t count, uint32_t* curCluster) {
  fail:
   return false;
 }
+//------------------------------------------------------------------------------
+/** Find and link a contiguous group of clusters, at most \a budget clusters
+ * of the FAT checked or linked per call, for callers which can't wait for a
+ * scan of the whole FAT.  The search starts at the likely place for a free
+ * cluster.  The group is linked from its end and each cluster is checked
+ * again before it is linked: when another allocation took one between two
+ * calls, the linked part is freed and the search goes on after it.
+ *
+ * \param[in] count Number of clusters.
+ * \param[in,out] alloc State of the allocation, FatAlloc_t() for a new one.
+ * \param[in] budget Clusters checked or linked by this call.
+ *
+ * \return One when the group is linked, its first cluster is alloc->bgn,
+ * zero when more calls are needed or -1 when there is no such free group
+ * or an I/O error occurs.
+ */
+int8_t SdVolume::allocContiguousStep(uint32_t count, FatAlloc_t* alloc,
+                                     uint16_t budget) {
+  // last cluster of FAT
+  uint32_t fatEnd = clusterCount_ + 1;
+  uint32_t f;
+
+  if (alloc->bgn == 0) {
+    // start at likely place for free cluster
+    alloc->bgn = alloc->next = allocSearchStart_;
+  }
+  while (budget--) {
+    if (!alloc->linking) {
+      // can't find space checked all clusters
+      if (alloc->checked >= clusterCount_) {
+        DBG_FAIL_MACRO;
+        goto fail;
+      }
+      alloc->checked++;
+      // past end - start from beginning of FAT
+      if (alloc->next > fatEnd) {
+        alloc->bgn = alloc->next = 2;
+      }
+      if (!fatGet(alloc->next, &f)) {
+        DBG_FAIL_MACRO;
+        goto fail;
+      }
+      if (f != 0) {
+        // cluster in use try next cluster as bgn
+        alloc->bgn = alloc->next + 1;
+      } else if ((alloc->next - alloc->bgn + 1) == count) {
+        // found - link it from its end
+        alloc->linking = true;
+        continue;
+      }
+      alloc->next++;
+    } else {
+      if (!fatGet(alloc->next, &f)) {
+        DBG_FAIL_MACRO;
+        goto fail;
+      }
+      if (f != 0) {
+        // taken since it was checked - free the linked part, search on
+        if (alloc->next != alloc->bgn + count - 1
+          && !freeChain(alloc->next + 1)) {
+          DBG_FAIL_MACRO;
+          goto fail;
+        }
+        alloc->linking = false;
+        alloc->bgn = ++alloc->next;
+        continue;
+      }
+      if (alloc->next == alloc->bgn + count - 1) {
+        // mark end of chain
+        if (!fatPutEOC(alloc->next)) {
+          DBG_FAIL_MACRO;
+          goto fail;
+        }
+      } else if (!fatPut(alloc->next, alloc->next + 1)) {
+        DBG_FAIL_MACRO;
+        goto fail;
+      }
+      if (alloc->next == alloc->bgn) return 1;
+      alloc->next--;
+    }
+  }
+  return 0;
+
+ fail:
+  // don't leave a linked part behind
+  if (alloc->linking && alloc->next != alloc->bgn + count - 1) {
+    freeChain(alloc->next + 1);
+  }
+  return -1;
+}
 //==============================================================================
 // cache functions
+#if SD_CACHE_BLOCKS > 1
+//------------------------------------------------------------------------------
+// FAT, directory and data blocks share the entries; a miss takes the least
+// recently used one, written back first if it is dirty.
+cache_t* SdVolume::cacheFetch(uint32_t blockNumber, uint8_t options) {
+  uint8_t i, e;
+  for (i = 0; i < SD_CACHE_BLOCKS; i++) {
+    if (cacheBlockNumber_[cacheOrder_[i]] == blockNumber) break;
+  }
+  if (i < SD_CACHE_BLOCKS) {
+    e = cacheOrder_[i];
+    cacheHits_++;
+  } else {
+    i = SD_CACHE_BLOCKS - 1;
+    e = cacheOrder_[i];
+    if (!cacheWriteEntry(e)) {
+      DBG_FAIL_MACRO;
+      goto fail;
+    }
+    cacheStatus_[e] = 0;
+    cacheBlockNumber_[e] = 0XFFFFFFFF;
+    if (!(options & CACHE_OPTION_NO_READ)) {
+      if (!sdCard_->readBlock(blockNumber, cacheBuffer_[e].data)) {
+        DBG_FAIL_MACRO;
+        goto fail;
+      }
+    }
+    cacheBlockNumber_[e] = blockNumber;
+    cacheMisses_++;
+  }
+  // move the entry to the front
+  for (; i > 0; i--) cacheOrder_[i] = cacheOrder_[i - 1];
+  cacheOrder_[0] = e;
+  cacheStatus_[e] |= options & CACHE_STATUS_MASK;
+  return &cacheBuffer_[e];
+
+ fail:
+  return 0;
+}
+//------------------------------------------------------------------------------
+cache_t* SdVolume::cacheFetchData(uint32_t blockNumber, uint8_t options) {
+  return cacheFetch(blockNumber, options);
+}
+//------------------------------------------------------------------------------
+cache_t* SdVolume::cacheFetchFat(uint32_t blockNumber, uint8_t options) {
+  return cacheFetch(blockNumber, options | CACHE_STATUS_FAT_BLOCK);
+}
+//------------------------------------------------------------------------------
+bool SdVolume::cacheWriteEntry(uint8_t e) {
+  if (cacheStatus_[e] & CACHE_STATUS_DIRTY) {
+    if (!sdCard_->writeBlock(cacheBlockNumber_[e], cacheBuffer_[e].data)) {
+      DBG_FAIL_MACRO;
+      goto fail;
+    }
+    // mirror second FAT
+    if ((cacheStatus_[e] & CACHE_STATUS_FAT_BLOCK) && cacheFatOffset_) {
+      uint32_t lbn = cacheBlockNumber_[e] + cacheFatOffset_;
+      if (!sdCard_->writeBlock(lbn, cacheBuffer_[e].data)) {
+        DBG_FAIL_MACRO;
+        goto fail;
+      }
+    }
+    cacheStatus_[e] &= ~CACHE_STATUS_DIRTY;
+  }
+  return true;
+
+ fail:
+  return false;
+}
+//------------------------------------------------------------------------------
+bool SdVolume::cacheSync() {
+  for (uint8_t e = 0; e < SD_CACHE_BLOCKS; e++) {
+    if (!cacheWriteEntry(e)) return false;
+  }
+  return true;
+}
+//------------------------------------------------------------------------------
+// the block just written by SdBaseFile::write()
+bool SdVolume::cacheWriteData() {
+  return cacheWriteEntry(cacheOrder_[0]);
+}
+//------------------------------------------------------------------------------
+bool SdVolume::cacheWriteFat() {
+  for (uint8_t e = 0; e < SD_CACHE_BLOCKS; e++) {
+    if ((cacheStatus_[e] & CACHE_STATUS_FAT_BLOCK) && !cacheWriteEntry(e)) {
+      return false;
+    }
+  }
+  return true;
+}
+//------------------------------------------------------------------------------
+void SdVolume::cacheInvalidate() {
+  for (uint8_t e = 0; e < SD_CACHE_BLOCKS; e++) {
+    cacheBlockNumber_[e] = 0XFFFFFFFF;
+    cacheStatus_[e] = 0;
+    cacheOrder_[e] = e;
+  }
+}
+//------------------------------------------------------------------------------
+bool SdVolume::cacheHas(uint32_t blockNumber) {
+  for (uint8_t e = 0; e < SD_CACHE_BLOCKS; e++) {
+    if (cacheBlockNumber_[e] == blockNumber) return true;
+  }
+  return false;
+}
+//------------------------------------------------------------------------------
+void SdVolume::cacheInvalidateBlock(uint32_t blockNumber) {
+  for (uint8_t e = 0; e < SD_CACHE_BLOCKS; e++) {
+    if (cacheBlockNumber_[e] == blockNumber) {
+      cacheBlockNumber_[e] = 0XFFFFFFFF;
+      cacheStatus_[e] = 0;
+    }
+  }
+}
+//------------------------------------------------------------------------------
+// write back the cached blocks of a range before it is read directly
+bool SdVolume::cacheSyncRange(uint32_t firstBlock, uint8_t count) {
+  for (uint8_t e = 0; e < SD_CACHE_BLOCKS; e++) {
+    if (firstBlock <= cacheBlockNumber_[e]
+      && cacheBlockNumber_[e] < firstBlock + count
+      && !cacheWriteEntry(e)) {
+      return false;
+    }
+  }
+  return true;
+}
+#else  // SD_CACHE_BLOCKS
 #if USE_SEPARATE_FAT_CACHE
 //------------------------------------------------------------------------------
 cache_t* SdVolume::cacheFetch(uint32_t blockNumber, uint8_t options) {
@@ -124,6 +351,9 @@ cache_t* SdVolume::cacheFetchData(uint32_t blockNumber, uint8_t options) {
     }
     cacheStatus_ = 0;
     cacheBlockNumber_ = blockNumber;
+    cacheMisses_++;
+  } else {
+    cacheHits_++;
   }
   cacheStatus_ |= options & CACHE_STATUS_MASK;
   return &cacheBuffer_;
@@ -146,6 +376,9 @@ cache_t* SdVolume::cacheFetchFat(uint32_t blockNumber, uint8_t options) {
     }
     cacheFatStatus_ = 0;
     cacheFatBlockNumber_ = blockNumber;
+    cacheMisses_++;
+  } else {
+    cacheHits_++;
   }
   cacheFatStatus_ |= options & CACHE_STATUS_MASK;
   return &cacheFatBuffer_;
@@ -209,6 +442,9 @@ cache_t* SdVolume::cacheFetch(uint32_t blockNumber, uint8_t options) {
     }
     cacheStatus_ = 0;
     cacheBlockNumber_ = blockNumber;
+    cacheMisses_++;
+  } else {
+    cacheHits_++;
   }
   cacheStatus_ |= options & CACHE_STATUS_MASK;
   return &cacheBuffer_;
@@ -252,6 +488,23 @@ void SdVolume::cacheInvalidate() {
     cacheBlockNumber_ = 0XFFFFFFFF;
     cacheStatus_ = 0;
 }
+//------------------------------------------------------------------------------
+bool SdVolume::cacheHas(uint32_t blockNumber) {
+  return cacheBlockNumber_ == blockNumber;
+}
+//------------------------------------------------------------------------------
+void SdVolume::cacheInvalidateBlock(uint32_t blockNumber) {
+  if (cacheBlockNumber_ == blockNumber) cacheInvalidate();
+}
+//------------------------------------------------------------------------------
+// write back the cached block if it is in a range which is read directly
+bool SdVolume::cacheSyncRange(uint32_t firstBlock, uint8_t count) {
+  if (firstBlock <= cacheBlockNumber_ && cacheBlockNumber_ < firstBlock + count) {
+    return cacheSync();
+  }
+  return true;
+}
+#endif  // SD_CACHE_BLOCKS
 //==============================================================================
 //------------------------------------------------------------------------------
 uint32_t SdVolume::clusterStartBlock(uint32_t cluster) const {
@@ -482,8 +735,12 @@ bool SdVolume::init(Sd2Card* dev, uint8_t part) {
   sdCard_ = dev;
   fatType_ = 0;
   allocSearchStart_ = 2;
+#if SD_CACHE_BLOCKS > 1
+  cacheInvalidate();
+#else  // SD_CACHE_BLOCKS
   cacheStatus_ = 0;  // cacheSync() will write block if true
   cacheBlockNumber_ = 0XFFFFFFFF;
+#endif  // SD_CACHE_BLOCKS
   cacheFatOffset_ = 0;
 #if USE_SERARATEFAT_CACHE
   cacheFatStatus_ = 0;  // cacheSync() will write block if true
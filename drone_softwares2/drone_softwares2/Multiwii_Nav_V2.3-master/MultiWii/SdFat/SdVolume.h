@@ -32,6 +32,22 @@ union cache_t {
   fat32_fsinfo_t fsinfo;
 };
 //------------------------------------------------------------------------------
+/**
+ * \brief State of a contiguous allocation done a few clusters per call,
+ * see SdVolume::allocContiguousStep()
+ */
+struct FatAlloc_t {
+  /** first cluster of the free group being checked, zero before the first call */
+  uint32_t bgn;
+  /** next cluster to check, or to link once the group is found */
+  uint32_t next;
+  /** clusters checked since the first call */
+  uint32_t checked;
+  /** the group is found, it is being linked from its end */
+  bool linking;
+  FatAlloc_t() : bgn(0), next(0), checked(0), linking(false) {}
+};
+//------------------------------------------------------------------------------
 /**
  * \class SdVolume
  * \brief Access FAT16 and FAT32 volumes on SD and SDHC cards.
@@ -46,9 +62,18 @@ class SdVolume {
    */
   cache_t* cacheClear() {
     if (!cacheSync()) return 0;
+#if SD_CACHE_BLOCKS > 1
+    cacheBlockNumber_[cacheOrder_[0]] = 0XFFFFFFFF;
+    return &cacheBuffer_[cacheOrder_[0]];
+#else  // SD_CACHE_BLOCKS
     cacheBlockNumber_ = 0XFFFFFFFF;
     return &cacheBuffer_;
+#endif  // SD_CACHE_BLOCKS
   }
+  /** \return Number of block fetches served by the cache. */
+  static uint16_t cacheHits() {return cacheHits_;}
+  /** \return Number of block fetches that needed a new cache block. */
+  static uint16_t cacheMisses() {return cacheMisses_;}
   /** Initialize a FAT volume.  Try partition one first then try super
    * floppy format.
    *
@@ -80,6 +105,8 @@ class SdVolume {
   /** \return The FAT type of the volume. Values are 12, 16 or 32. */
   uint8_t fatType() const {return fatType_;}
   int32_t freeClusterCount();
+  int8_t allocContiguousStep(uint32_t count, FatAlloc_t* alloc,
+    uint16_t budget);
   /** \return The number of entries in the root directory for FAT16 volumes. */
   uint32_t rootDirEntryCount() const {return rootDirEntryCount_;}
   /** \return The logical block number for the start of the root directory
@@ -128,7 +155,16 @@ class SdVolume {
   // reserve cache block with no read
   static uint8_t const CACHE_RESERVE_FOR_WRITE
      = CACHE_STATUS_DIRTY | CACHE_OPTION_NO_READ;
-#if USE_MULTIPLE_CARDS
+  static uint16_t cacheHits_;         // fetches found in the cache
+  static uint16_t cacheMisses_;       // fetches that took a cache block
+#if SD_CACHE_BLOCKS > 1
+  static cache_t cacheBuffer_[SD_CACHE_BLOCKS];        // cached blocks
+  static uint32_t cacheBlockNumber_[SD_CACHE_BLOCKS];  // their block numbers
+  static uint8_t cacheStatus_[SD_CACHE_BLOCKS];        // their status
+  static uint8_t cacheOrder_[SD_CACHE_BLOCKS];  // entries, most recent first
+  static uint32_t cacheFatOffset_;    // offset for mirrored FAT
+  static Sd2Card* sdCard_;            // Sd2Card object for cache
+#elif USE_MULTIPLE_CARDS
   cache_t cacheBuffer_;        // 512 byte cache for device blocks
   uint32_t cacheBlockNumber_;  // Logical number of block in the cache
   uint32_t cacheFatOffset_;    // offset for mirrored FAT
@@ -152,13 +188,23 @@ class SdVolume {
   static Sd2Card* sdCard_;            // Sd2Card object for cache
 #endif  // USE_MULTIPLE_CARDS
 
+#if SD_CACHE_BLOCKS > 1
+  // the most recently fetched block
+  cache_t *cacheAddress() {return &cacheBuffer_[cacheOrder_[0]];}
+  uint32_t cacheBlockNumber() {return cacheBlockNumber_[cacheOrder_[0]];}
+  static bool cacheWriteEntry(uint8_t e);
+#else  // SD_CACHE_BLOCKS
   cache_t *cacheAddress() {return &cacheBuffer_;}
   uint32_t cacheBlockNumber() {return cacheBlockNumber_;}
+#endif  // SD_CACHE_BLOCKS
 #if USE_MULTIPLE_CARDS
   cache_t* cacheFetch(uint32_t blockNumber, uint8_t options);
   cache_t* cacheFetchData(uint32_t blockNumber, uint8_t options);
   cache_t* cacheFetchFat(uint32_t blockNumber, uint8_t options);
   void cacheInvalidate();
+  bool cacheHas(uint32_t blockNumber);
+  void cacheInvalidateBlock(uint32_t blockNumber);
+  bool cacheSyncRange(uint32_t firstBlock, uint8_t count);
   bool cacheSync();
   bool cacheWriteData();
   bool cacheWriteFat();
@@ -167,6 +213,9 @@ class SdVolume {
   static cache_t* cacheFetchData(uint32_t blockNumber, uint8_t options);
   static cache_t* cacheFetchFat(uint32_t blockNumber, uint8_t options);
   static void cacheInvalidate();
+  static bool cacheHas(uint32_t blockNumber);
+  static void cacheInvalidateBlock(uint32_t blockNumber);
+  static bool cacheSyncRange(uint32_t firstBlock, uint8_t count);
   static bool cacheSync();
   static bool cacheWriteData();
   static bool cacheWriteFat();
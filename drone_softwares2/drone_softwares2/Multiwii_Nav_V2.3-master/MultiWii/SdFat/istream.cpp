@@ -160,7 +160,7 @@ bool istream::getDouble(double* value) {
   setstate(failbit);
   return false;
 }
-/
+//------------------------------------------------------------------------------
 istream& istream::getline(char *str, streamsize n, char delim) {
   FatPos_t pos;
   int c;
@@ -4,10 +4,57 @@
 #include "Serial.h"
 #include "MultiWii.h"
 
+// one contiguous RX ring per port, each sized for what the port carries (see RX_BUFFER_SIZE_PORTn): power of two sizes, wrapped with a mask
 static volatile uint8_t serialHeadRX[UART_NUMBER],serialTailRX[UART_NUMBER];
-static uint8_t serialBufferRX[RX_BUFFER_SIZE][UART_NUMBER];
-static volatile uint8_t serialHeadTX[UART_NUMBER],serialTailTX[UART_NUMBER];
-static uint8_t serialBufferTX[TX_BUFFER_SIZE][UART_NUMBER];
+static volatile uint16_t serialDroppedRX[UART_NUMBER];
+static uint8_t serialBufferRX0[RX_BUFFER_SIZE_PORT0];
+#if UART_NUMBER > 1
+  static uint8_t serialBufferRX1[RX_BUFFER_SIZE_PORT1];
+#endif
+#if UART_NUMBER > 2
+  static uint8_t serialBufferRX2[RX_BUFFER_SIZE_PORT2];
+  static uint8_t serialBufferRX3[RX_BUFFER_SIZE_PORT3];
+#endif
+static uint8_t * const serialBufferRX[UART_NUMBER] = {
+  serialBufferRX0
+  #if UART_NUMBER > 1
+    ,serialBufferRX1
+  #endif
+  #if UART_NUMBER > 2
+    ,serialBufferRX2,serialBufferRX3
+  #endif
+};
+static const uint8_t serialMaskRX[UART_NUMBER] = {
+  RX_BUFFER_SIZE_PORT0 - 1
+  #if UART_NUMBER > 1
+    ,RX_BUFFER_SIZE_PORT1 - 1
+  #endif
+  #if UART_NUMBER > 2
+    ,RX_BUFFER_SIZE_PORT2 - 1,RX_BUFFER_SIZE_PORT3 - 1
+  #endif
+};
+
+// two TX queues per port, one contiguous ring each so blocks can be copied with memcpy:
+// TX_CRITICAL for the replies and everything else, TX_BULK for the streamed telemetry which is sent only when the first one is empty
+static uint8_t serialBufferTX[UART_NUMBER][TX_BUFFER_SIZE];
+static uint8_t serialBufferTXBulk[UART_NUMBER][TX_BULK_BUFFER_SIZE];
+static struct {
+  volatile uint8_t head;   // last committed byte, the ISR doesn't go further: it only sees whole frames
+  volatile uint8_t tail;   // last sent byte
+  uint8_t write;           // last written byte, committed by UartSendData
+  uint8_t overflow;        // the frame being written didn't fit, it is dropped at commit
+} serialTX[UART_NUMBER][2];
+static volatile uint8_t serialBulkEnd[UART_NUMBER];   // last byte of the bulk frame being sent
+static volatile uint8_t serialBulkBurst[UART_NUMBER]; // a bulk frame is being sent, it must not be cut
+// last byte of each committed bulk frame, oldest first: the transmitter goes back to the critical queue after each of them
+#define TX_BULK_FRAMES 8   // power of two; when they are all used the next frame is merged with the last one
+static volatile uint8_t serialBulkFrameEnd[UART_NUMBER][TX_BULK_FRAMES];
+static volatile uint8_t serialBulkFrameIn[UART_NUMBER],serialBulkFrameOut[UART_NUMBER];
+static uint8_t serialTXSelect[UART_NUMBER];           // queue used by SerialSerialize
+serialTXStats_t serialTXStats[UART_NUMBER];
+
+#define TX_QUEUE_BUF(port,q)  ((q) == TX_BULK ? serialBufferTXBulk[port] : serialBufferTX[port])
+#define TX_QUEUE_SIZE(q)      ((q) == TX_BULK ? TX_BULK_BUFFER_SIZE : TX_BUFFER_SIZE)
 
 
 // *******************************************************
@@ -27,6 +74,31 @@ static uint8_t serialBufferTX[TX_BUFFER_SIZE][UART_NUMBER];
 // *******************************************************
 
 
+// next byte to send on a port: a bulk frame is never cut (the frames would be mixed), otherwise the critical queue goes first
+static inline uint8_t serialTXNext(uint8_t port, uint8_t *c) {
+  uint8_t t;
+  if (!serialBulkBurst[port]) {
+    t = serialTX[port][TX_CRITICAL].tail;
+    if (t != serialTX[port][TX_CRITICAL].head) {
+      if (++t >= TX_BUFFER_SIZE) t = 0;
+      *c = serialBufferTX[port][t];
+      serialTX[port][TX_CRITICAL].tail = t;
+      return 1;
+    }
+    if (serialTX[port][TX_BULK].tail == serialTX[port][TX_BULK].head) return 0;
+    t = serialBulkFrameOut[port];  // the end of a frame is recorded before the frame is committed
+    serialBulkEnd[port] = serialBulkFrameEnd[port][t];
+    serialBulkFrameOut[port] = (t + 1) & (TX_BULK_FRAMES - 1);
+    serialBulkBurst[port] = 1;
+  }
+  t = serialTX[port][TX_BULK].tail;
+  if (++t >= TX_BULK_BUFFER_SIZE) t = 0;
+  *c = serialBufferTXBulk[port][t];
+  serialTX[port][TX_BULK].tail = t;
+  if (t == serialBulkEnd[port]) serialBulkBurst[port] = 0;
+  return 1;
+}
+
 #if defined(PROMINI) || defined(MEGA)
   #if defined(PROMINI)
   ISR(USART_UDRE_vect) {  // Serial 0 on a PROMINI
@@ -34,63 +106,106 @@ static uint8_t serialBufferTX[TX_BUFFER_SIZE][UART_NUMBER];
   #if defined(MEGA)
   ISR(USART0_UDRE_vect) { // Serial 0 on a MEGA
   #endif
-    uint8_t t = serialTailTX[0];
-    if (serialHeadTX[0] != t) {
-      if (++t >= TX_BUFFER_SIZE) t = 0;
-      UDR0 = serialBufferTX[t][0];  // Transmit next byte in the ring
-      serialTailTX[0] = t;
-    }
-    if (t == serialHeadTX[0]) UCSR0B &= ~(1<<UDRIE0); // Check if all data is transmitted . if yes disable transmitter UDRE interrupt
+    uint8_t c;
+    if (serialTXNext(0,&c)) UDR0 = c;  // Transmit next byte in the queues
+    else UCSR0B &= ~(1<<UDRIE0);      // all data is transmitted: disable transmitter UDRE interrupt
   }
 #endif
 #if defined(MEGA) || defined(PROMICRO)
   ISR(USART1_UDRE_vect) { // Serial 1 on a MEGA or on a PROMICRO
-    uint8_t t = serialTailTX[1];
-    if (serialHeadTX[1] != t) {
-      if (++t >= TX_BUFFER_SIZE) t = 0;
-      UDR1 = serialBufferTX[t][1];  // Transmit next byte in the ring
-      serialTailTX[1] = t;
-    }
-    if (t == serialHeadTX[1]) UCSR1B &= ~(1<<UDRIE1);
+    uint8_t c;
+    if (serialTXNext(1,&c)) UDR1 = c;
+    else UCSR1B &= ~(1<<UDRIE1);
   }
 #endif
 #if defined(MEGA)
   ISR(USART2_UDRE_vect) { // Serial 2 on a MEGA
-    uint8_t t = serialTailTX[2];
-    if (serialHeadTX[2] != t) {
-      if (++t >= TX_BUFFER_SIZE) t = 0;
-      UDR2 = serialBufferTX[t][2];
-      serialTailTX[2] = t;
-    }
-    if (t == serialHeadTX[2]) UCSR2B &= ~(1<<UDRIE2);
+    uint8_t c;
+    if (serialTXNext(2,&c)) UDR2 = c;
+    else UCSR2B &= ~(1<<UDRIE2);
   }
   ISR(USART3_UDRE_vect) { // Serial 3 on a MEGA
-    uint8_t t = serialTailTX[3];
-    if (serialHeadTX[3] != t) {
-      if (++t >= TX_BUFFER_SIZE) t = 0;
-      UDR3 = serialBufferTX[t][3];
-      serialTailTX[3] = t;
+    uint8_t c;
+    if (serialTXNext(3,&c)) UDR3 = c;
+    else UCSR3B &= ~(1<<UDRIE3);
+  }
+#endif
+
+// makes the written bytes visible to the transmitter, a frame which didn't fit is dropped as a whole
+static void serialTXCommit(uint8_t port) {
+  for (uint8_t q=0;q<2;q++) {
+    uint8_t n = (uint8_t)(serialTX[port][q].write - serialTX[port][q].head);
+    if (serialTX[port][q].write < serialTX[port][q].head) n += TX_QUEUE_SIZE(q);
+    if (serialTX[port][q].overflow) {
+      serialTXStats[port].dropped += n;
+      serialTX[port][q].write = serialTX[port][q].head;
+      serialTX[port][q].overflow = 0;
+    } else if (n) {
+      serialTXStats[port].queued += n;
+      if (q == TX_BULK) {
+        uint8_t i = serialBulkFrameIn[port];
+        uint8_t next = (i + 1) & (TX_BULK_FRAMES - 1);
+        if (next == serialBulkFrameOut[port]) {  // all used: the last recorded frame, not sent yet, ends here now
+          serialBulkFrameEnd[port][(i - 1) & (TX_BULK_FRAMES - 1)] = serialTX[port][q].write;
+        } else {
+          serialBulkFrameEnd[port][i] = serialTX[port][q].write;
+          serialBulkFrameIn[port] = next;
+        }
+      }
+      serialTX[port][q].head = serialTX[port][q].write;
+    }
+  }
+}
+
+#if defined(PROMICRO)
+  static uint8_t usbTXPending;
+
+  // sends a TX queue of the USB port with one USB_Send per contiguous segment (2 at most, before and after the end of the ring)
+  static void usbSendQueue(uint8_t q) {
+    uint8_t *buf = TX_QUEUE_BUF(0,q);
+    uint8_t t = serialTX[0][q].tail;
+    uint8_t h = serialTX[0][q].head;
+    while (t != h) {
+      uint8_t start = t + 1;
+      if (start >= TX_QUEUE_SIZE(q)) start = 0;
+      uint8_t end = (h >= start) ? h : TX_QUEUE_SIZE(q) - 1; // last byte of the segment
+      #if !defined(TEENSY20)
+        USB_Send(USB_CDC_TX,&buf[start],end - start + 1);
+      #else
+        Serial.write(&buf[start],end - start + 1);
+      #endif
+      t = end;
     }
-    if (t == serialHeadTX[3]) UCSR3B &= ~(1<<UDRIE3);
+    serialTX[0][q].tail = t;
   }
 #endif
 
+// the USB port is not sent byte per byte anymore: UartSendData only marks it, the data goes out in UartSendDeferred
+// which is called once at the end of serialCom()
+void UartSendDeferred() {
+  #if defined(PROMICRO)
+    if (!usbTXPending) return;
+    usbTXPending = 0;
+    usbSendQueue(TX_CRITICAL);
+    usbSendQueue(TX_BULK);
+    #if !defined(TEENSY20)
+      #if (ARDUINO >= 100)
+        USB_Flush(USB_CDC_TX);
+      #endif
+    #else
+      Serial.send_now();
+    #endif
+  #endif
+}
+
 void UartSendData(uint8_t port) {
+  serialTXCommit(port);
   #if defined(PROMINI)
     UCSR0B |= (1<<UDRIE0);
   #endif
   #if defined(PROMICRO)
     switch (port) {
-      case 0:
-        while(serialHeadTX[0] != serialTailTX[0]) {
-           if (++serialTailTX[0] >= TX_BUFFER_SIZE) serialTailTX[0] = 0;
-           #if !defined(TEENSY20)
-             USB_Send(USB_CDC_TX,serialBufferTX[serialTailTX[0]],1);
-           #else
-             Serial.write(serialBufferTX[serialTailTX[0]],1);
-           #endif
-         }
-        break;
+      case 0: usbTXPending = 1; break;
       case 1: UCSR1B |= (1<<UDRIE1); break;
     }
   #endif
@@ -106,7 +221,7 @@ void UartSendData(uint8_t port) {
 
 #if defined(GPS_SERIAL)
   bool SerialTXfree(uint8_t port) {
-    return (serialHeadTX[port] == serialTailTX[port]);
+    return (serialTX[port][TX_CRITICAL].head == serialTX[port][TX_CRITICAL].tail) && (serialTX[port][TX_BULK].head == serialTX[port][TX_BULK].tail);
   }
 #endif
 
@@ -149,8 +264,9 @@ void SerialEnd(uint8_t port) {
   }
 }
 
-// we don't care about ring buffer overflow (head->tail) to avoid a test condition : data is lost anyway if it happens 
-void store_uart_in_buf(uint8_t data, uint8_t portnum) {
+// on ring buffer overflow the new byte is dropped and counted: the bytes already received stay readable
+// (inlined in each ISR with a constant port, the buffer and mask lookups are folded)
+static inline void store_uart_in_buf(uint8_t data, uint8_t portnum) {
 #if defined(SPEKTRUM) || defined(SBUS) || defined(SUMD)
     if (portnum == RX_SERIAL_PORT) {
       if (!spekFrameFlags) { 
@@ -169,9 +285,13 @@ void store_uart_in_buf(uint8_t data, uint8_t portnum) {
   #endif
 
   uint8_t h = serialHeadRX[portnum];
-  serialBufferRX[h++][portnum] = data;
-  if (h >= RX_BUFFER_SIZE) h = 0;
-  serialHeadRX[portnum] = h;
+  uint8_t n = (h + 1) & serialMaskRX[portnum];
+  if (n == serialTailRX[portnum]) {
+    if (serialDroppedRX[portnum] < 0xFFFF) serialDroppedRX[portnum]++;
+    return;
+  }
+  serialBufferRX[portnum][h] = data;
+  serialHeadRX[portnum] = n;
 }
 
 #if defined(PROMINI)
@@ -192,24 +312,20 @@ uint8_t SerialRead(uint8_t port) {
     #if defined(TEENSY20)
       if(port == 0) return Serial.read();
     #else
-      #if (ARDUINO >= 100)
-        if(port == 0) USB_Flush(USB_CDC_TX);
-      #endif
       if(port == 0) return USB_Recv(USB_CDC_RX);      
     #endif
   #endif
   uint8_t t = serialTailRX[port];
-  uint8_t c = serialBufferRX[t][port];
+  uint8_t c = serialBufferRX[port][t];
   if (serialHeadRX[port] != t) {
-    if (++t >= RX_BUFFER_SIZE) t = 0;
-    serialTailRX[port] = t;
+    serialTailRX[port] = (t + 1) & serialMaskRX[port];
   }
   return c;
 }
 
 #if defined(SPEKTRUM)
   uint8_t SerialPeek(uint8_t port) {
-    uint8_t c = serialBufferRX[serialTailRX[port]][port];
+    uint8_t c = serialBufferRX[port][serialTailRX[port]];
     if ((serialHeadRX[port] != serialTailRX[port])) return c; else return 0;
   }
 #endif
@@ -222,20 +338,80 @@ uint8_t SerialAvailable(uint8_t port) {
       if(port == 0) return T_USB_Available();
     #endif
   #endif
-  return ((uint8_t)(serialHeadRX[port] - serialTailRX[port]))%RX_BUFFER_SIZE;
+  return (serialHeadRX[port] - serialTailRX[port]) & serialMaskRX[port];
+}
+
+uint16_t SerialRXDropped(uint8_t port) {
+  uint16_t d;
+  uint8_t oldSREG = SREG; cli();
+  d = serialDroppedRX[port];
+  SREG = oldSREG;
+  return d;
+}
+
+static uint8_t serialTXUsed(uint8_t port, uint8_t q) {
+  uint8_t w = serialTX[port][q].write, t = serialTX[port][q].tail;
+  return (w >= t) ? w - t : w + TX_QUEUE_SIZE(q) - t;
 }
 
 uint8_t SerialUsedTXBuff(uint8_t port) {
-  return ((uint8_t)(serialHeadTX[port] - serialTailTX[port]))%TX_BUFFER_SIZE;
+  return serialTXUsed(port,TX_CRITICAL);
+}
+
+uint8_t SerialUsedTXBulk(uint8_t port) {
+  return serialTXUsed(port,TX_BULK);
+}
+
+// queue used by the next SerialSerialize calls of this port (TX_CRITICAL by default)
+void SerialTXQueue(uint8_t port, uint8_t queue) {
+  serialTXSelect[port] = queue;
+}
+
+// the frame being written in the selected queue is not sent: nothing more of it is queued, the commit drops it
+void SerialTXCancel(uint8_t port) {
+  serialTX[port][serialTXSelect[port]].overflow = 1;
 }
 
 void SerialSerialize(uint8_t port,uint8_t a) {
-  uint8_t t = serialHeadTX[port];
-  if (++t >= TX_BUFFER_SIZE) t = 0;
-  serialBufferTX[t][port] = a;
-  serialHeadTX[port] = t;
+  uint8_t q = serialTXSelect[port];
+  uint8_t t = serialTX[port][q].write;
+  if (serialTX[port][q].overflow) return; // the frame is dropped anyway
+  if (++t >= TX_QUEUE_SIZE(q)) t = 0;
+  if (t == serialTX[port][q].tail) { // full
+    serialTX[port][q].overflow = 1;
+    serialTXStats[port].dropped++;
+    return;
+  }
+  TX_QUEUE_BUF(port,q)[t] = a;
+  serialTX[port][q].write = t;
+}
+
+// same as SerialSerialize for a whole block: at most two memcpy (before and after the end of the ring)
+void SerialSerializeBlock(uint8_t port,const uint8_t *buf,uint8_t len) {
+  uint8_t q = serialTXSelect[port];
+  uint8_t size = TX_QUEUE_SIZE(q);
+  uint8_t *ring = TX_QUEUE_BUF(port,q);
+  uint8_t h = serialTX[port][q].write;
+  uint8_t n;
+  if (len == 0 || serialTX[port][q].overflow) return;
+  if (len > size - 1 - serialTXUsed(port,q)) { // doesn't fit
+    serialTX[port][q].overflow = 1;
+    serialTXStats[port].dropped += len;
+    return;
+  }
+  if (++h >= size) h = 0;               // first free byte
+  n = size - h;                         // room until the end of the ring
+  if (n > len) n = len;
+  memcpy(&ring[h],buf,n);
+  if (len > n) memcpy(&ring[0],buf+n,len-n);
+  uint16_t t = h + len - 1;             // last written byte
+  if (t >= size) t -= size;
+  serialTX[port][q].write = t;
 }
 
 void SerialWrite(uint8_t port,uint8_t c){
   SerialSerialize(port,c);UartSendData(port);
+  #if defined(PROMICRO)
+    if (port == 0) UartSendDeferred(); // LCD & co may write outside of serialCom(): keep them unbuffered
+  #endif
 }
@@ -8,12 +8,81 @@
 #else
   #define UART_NUMBER 1
 #endif
-#if defined(GPS_SERIAL)
-  #define RX_BUFFER_SIZE 256 // 256 RX buffer is needed for GPS communication (64 or 128 was too short)
-#else
-  #define RX_BUFFER_SIZE 64
+// RX ring of each port, config.h may set them with RX_BUFFER_SIZE_PORTn
+#if !defined(RX_BUFFER_SIZE_PORT0)
+  #if defined(GPS_SERIAL) && (GPS_SERIAL == 0)
+    #define RX_BUFFER_SIZE_PORT0 256    // 256 RX buffer is needed for GPS communication (64 or 128 was too short)
+  #elif defined(PROMICRO)
+    #define RX_BUFFER_SIZE_PORT0 2      // USB, the ring is not used
+  #elif defined(SUMD) && (RX_SERIAL_PORT == 0)
+    #define RX_BUFFER_SIZE_PORT0 64
+  #elif (defined(SPEKTRUM) || defined(SBUS)) && (RX_SERIAL_PORT == 0)
+    #define RX_BUFFER_SIZE_PORT0 32
+  #else
+    #define RX_BUFFER_SIZE_PORT0 64
+  #endif
+#endif
+#if (RX_BUFFER_SIZE_PORT0 & (RX_BUFFER_SIZE_PORT0 - 1)) || (RX_BUFFER_SIZE_PORT0 < 2) || (RX_BUFFER_SIZE_PORT0 > 256)
+  #error "RX_BUFFER_SIZE_PORT0 must be a power of two between 2 and 256"
+#endif
+#if UART_NUMBER > 1
+#if !defined(RX_BUFFER_SIZE_PORT1)
+  #if defined(GPS_SERIAL) && (GPS_SERIAL == 1)
+    #define RX_BUFFER_SIZE_PORT1 256    // 256 RX buffer is needed for GPS communication (64 or 128 was too short)
+  #elif defined(SUMD) && (RX_SERIAL_PORT == 1)
+    #define RX_BUFFER_SIZE_PORT1 64
+  #elif (defined(SPEKTRUM) || defined(SBUS)) && (RX_SERIAL_PORT == 1)
+    #define RX_BUFFER_SIZE_PORT1 32
+  #else
+    #define RX_BUFFER_SIZE_PORT1 64
+  #endif
+#endif
+#if (RX_BUFFER_SIZE_PORT1 & (RX_BUFFER_SIZE_PORT1 - 1)) || (RX_BUFFER_SIZE_PORT1 < 2) || (RX_BUFFER_SIZE_PORT1 > 256)
+  #error "RX_BUFFER_SIZE_PORT1 must be a power of two between 2 and 256"
+#endif
+#endif
+#if UART_NUMBER > 2
+#if !defined(RX_BUFFER_SIZE_PORT2)
+  #if defined(GPS_SERIAL) && (GPS_SERIAL == 2)
+    #define RX_BUFFER_SIZE_PORT2 256    // 256 RX buffer is needed for GPS communication (64 or 128 was too short)
+  #elif defined(SUMD) && (RX_SERIAL_PORT == 2)
+    #define RX_BUFFER_SIZE_PORT2 64
+  #elif (defined(SPEKTRUM) || defined(SBUS)) && (RX_SERIAL_PORT == 2)
+    #define RX_BUFFER_SIZE_PORT2 32
+  #else
+    #define RX_BUFFER_SIZE_PORT2 64
+  #endif
+#endif
+#if (RX_BUFFER_SIZE_PORT2 & (RX_BUFFER_SIZE_PORT2 - 1)) || (RX_BUFFER_SIZE_PORT2 < 2) || (RX_BUFFER_SIZE_PORT2 > 256)
+  #error "RX_BUFFER_SIZE_PORT2 must be a power of two between 2 and 256"
+#endif
+#if !defined(RX_BUFFER_SIZE_PORT3)
+  #if defined(GPS_SERIAL) && (GPS_SERIAL == 3)
+    #define RX_BUFFER_SIZE_PORT3 256    // 256 RX buffer is needed for GPS communication (64 or 128 was too short)
+  #elif defined(SUMD) && (RX_SERIAL_PORT == 3)
+    #define RX_BUFFER_SIZE_PORT3 64
+  #elif (defined(SPEKTRUM) || defined(SBUS)) && (RX_SERIAL_PORT == 3)
+    #define RX_BUFFER_SIZE_PORT3 32
+  #else
+    #define RX_BUFFER_SIZE_PORT3 64
+  #endif
+#endif
+#if (RX_BUFFER_SIZE_PORT3 & (RX_BUFFER_SIZE_PORT3 - 1)) || (RX_BUFFER_SIZE_PORT3 < 2) || (RX_BUFFER_SIZE_PORT3 > 256)
+  #error "RX_BUFFER_SIZE_PORT3 must be a power of two between 2 and 256"
+#endif
 #endif
 #define TX_BUFFER_SIZE 128
+#define TX_BULK_BUFFER_SIZE 64  // streamed telemetry, sent only when the TX_BUFFER_SIZE queue is empty
+
+#define TX_CRITICAL 0
+#define TX_BULK     1
+
+typedef struct {
+  uint16_t queued;    // bytes committed to the TX queues (wraps)
+  uint16_t dropped;   // bytes of the frames which didn't fit in their queue
+  uint16_t deferred;  // bulk frames put off because the bulk queue was busy
+} serialTXStats_t;
+extern serialTXStats_t serialTXStats[UART_NUMBER];
 
 void    SerialOpen(uint8_t port, uint32_t baud);
 uint8_t SerialRead(uint8_t port);
@@ -23,8 +92,14 @@ void    SerialEnd(uint8_t port);
 uint8_t SerialPeek(uint8_t port);
 bool    SerialTXfree(uint8_t port);
 uint8_t SerialUsedTXBuff(uint8_t port);
+uint8_t SerialUsedTXBulk(uint8_t port);
+void    SerialTXQueue(uint8_t port, uint8_t queue);
+void    SerialTXCancel(uint8_t port);
+uint16_t SerialRXDropped(uint8_t port);
 void    SerialSerialize(uint8_t port,uint8_t a);
+void    SerialSerializeBlock(uint8_t port,const uint8_t *buf,uint8_t len);
 void    UartSendData(uint8_t port);
+void    UartSendDeferred();
 
 void SerialWrite16(uint8_t port, int16_t val);
 
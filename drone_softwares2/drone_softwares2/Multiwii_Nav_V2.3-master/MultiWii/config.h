@@ -364,6 +364,19 @@
       // Uncommenting following line allow to connect PPM_SUM receiver to standard THROTTLE PIN on MEGA boards (eg. A8 in CRIUS AIO)
       //#define PPM_ON_THROTTLE
 
+      /* Uncommenting following line decodes the PPM_SUM signal with the Timer5 input capture unit on MEGA boards (PIN 48 = ICP5).
+         The edges are timestamped by the hardware (0.5us resolution), so the pulse widths are not affected by the latency
+         of other interrupts (I2C, serial, motors...). Timer5 is also used to drive servos: not compatible with servo outputs */
+      //#define PPM_INPUT_CAPTURE
+
+      /* Collect per channel jitter statistics of the PPM_SUM pulses (max, smoothed value and histogram), read with MSP_RC_JITTER
+         costs about 20 bytes of RAM per channel */
+      //#define RC_JITTER_STATS
+      /* Skip the 4 samples averaging of the RC data on channels whose smoothed jitter is below this value (in us)
+         => less RC latency with a clean signal; the averaging comes back as soon as the channel gets noisy
+         implies RC_JITTER_STATS */
+      //#define RC_JITTER_BYPASS_THRESHOLD 2
+
     /**********************    Spektrum Satellite Reciver    *******************************/
       /* The following lines apply only for Spektrum Satellite Receiver
          Spektrum Satellites are 3V devices.  DO NOT connect to 5V!
@@ -493,6 +506,22 @@
     #define SERIAL2_COM_SPEED 115200
     #define SERIAL3_COM_SPEED 115200
 
+    /* MSP v2 requests ($X framing, 16 bit ids and sizes, CRC8) are accepted on every port, with the same 64 bytes payload limit as MSP v1.
+       The port below gets its own bigger reassembly buffer, so uploads of a few hundred bytes fit in one frame (uses RAM) */
+    //#define MSP_LARGE_INBUF_PORT 0
+    //#define MSP_LARGE_INBUF_SIZE 256
+
+    /* Settings read and written one at a time by id (MSP_PARAM_LIST, MSP_PARAM, MSP_SET_PARAM) with a table in flash
+       giving their type, limits and scale, instead of whole blocks like MSP_SET_PID. ~1k of flash */
+    //#define MSP_PARAMS
+
+    /* size of the RX ring of each port, a power of two up to 256 (uses RAM).
+       defaults: 256 for the GPS port, 32 for the serial RX port (64 with SUMD), 64 for the others */
+    //#define RX_BUFFER_SIZE_PORT0 64
+    //#define RX_BUFFER_SIZE_PORT1 64
+    //#define RX_BUFFER_SIZE_PORT2 64
+    //#define RX_BUFFER_SIZE_PORT3 64
+
     /* interleaving delay in micro seconds between 2 readings WMP/NK in a WMP+NK config
        if the ACC calibration time is very long (20 or 30s), try to increase this delay up to 4000
        it is relevent only for a conf with NK */
@@ -698,6 +727,8 @@
     
     //#define NMEA
     #define UBLOX
+      //#define UBLOX_PVT         // u-blox 7/8: one NAV-PVT at 10Hz instead of POSLLH, SOL and VELNED at 5Hz,
+                                  // and the receiver velocity is used for navigation when its accuracy is good
     //#define MTK_BINARY16
     //#define MTK_BINARY19
     //#define INIT_MTK_GPS        // initialize MTK GPS for using selected speed, 5Hz update rate and GGA & RMC sentence or binary settings
@@ -721,6 +752,21 @@
     //Enables the MSP_WP command set , which is used by WinGUI for displaying an setting up navigation
     #define USE_MSP_WP                       
 
+    // Bulk mission upload: several steps per MSP frame go to a RAM stage, the stage is verified with a CRC as a whole
+    // and then written to the EEPROM in the background while disarmed, without blocking the main loop
+    // value is the number of steps in the stage (22 bytes of RAM each), bigger missions are sent in several stages
+    //#define MISSION_STAGE_SIZE 16
+
+    // Missions on the SD card (MISSION.BIN, MWI_SDCARD on a MEGA) instead of the EEPROM: up to 65535 steps, steps above 254
+    // are set and read with MSP_SET_WP16 / MSP_WP16. The EEPROM is still used when there is no card at boot.
+    // value is the number of steps read ahead in RAM during the mission (23 bytes of RAM each)
+    //#define MISSION_SD 8
+
+    // Mission checked as a whole in the background while disarmed (finished at arming) and kept in RAM: navigation then
+    // takes the steps from memory, a damaged step is found on the ground instead of in the middle of the mission. value is the number of steps in RAM (20 bytes each),
+    // a longer mission is kept by windows which are read while flying to a waypoint
+    //#define MISSION_RAM 16
+
 	// HOME position is reset at every arm, uncomment it to prohibit it (you can set home position with GyroCalibration)    
 	//#define DONT_RESET_HOME_AT_ARM             
 
@@ -745,6 +791,12 @@
     // add a 5 element moving average filter to GPS coordinates, helps eliminate gps noise but adds latency comment out to disable
 	// use it with NMEA gps only 
 	//#define GPS_FILTERING                 //(**)     
+
+    // Inertial navigation: the acc turned to north/east is integrated and corrected with the GPS position
+    // (3rd order complementary filter, the value is its time constant in seconds). The speed comes from this
+    // estimate instead of the difference of two GPS positions, and the poshold/nav PIDs run on it at 50Hz.
+    // Needs a serial GPS, a MAG and an ACC.
+    //#define INS_NAV 2.5
     
     // if we are within this distance to a waypoint then we consider it reached (distance is in cm)
     #define GPS_WP_RADIUS              200      //(**) 
@@ -980,6 +1032,19 @@
   /*************      Support multiple configuration profiles in EEPROM     ************/
     //#define MULTIPLE_CONFIGURATION_PROFILES
 
+  /*************      Journaled parameter store in EEPROM     ************/
+    /* The settings are appended to a journal in the first N bytes of the EEPROM, only the bytes which changed:
+     * a trim or a PID change writes a few bytes instead of the whole profile, and the writes go round the area.
+     * The settings go back to the defaults once when it is enabled, the missions are stored after it.
+     * 1024 is enough for one profile, 2048 for three. */
+    //#define EEPROM_JOURNAL 2048
+
+  /*************      Background EEPROM writes     ************/
+    /* A byte takes ~3.4ms to write in the EEPROM. The writes are queued and done by the EEPROM ready interrupt, the
+     * main loop only waits when the queue is full (saving the settings or a WP doesn't hold it any more).
+     * Value: queue entries, 3 bytes of RAM each. Default 64 on a MEGA, 0 turns it off. */
+    //#define EEPROM_WRITE_QUEUE 32
+
   /*************      do no reset constants when change of flashed program is detected ***********/
    // #define NO_FLASH_CHECK
 
@@ -1120,6 +1185,11 @@
     //#define LOG_PERMANENT_SHOW_AT_L // enable to display log when receiving 'L'
     //#define LOG_PERMANENT_SHOW_AFTER_CONFIG // enable to display log after exiting LCD config menu
     //#define LOG_PERMANENT_SERVICE_LIFETIME 36000 // in seconds; service alert at startup after 10 hours of armed time
+
+    /* Summary of each of the last N flights in a ring in the eeprom, below the permanent log: duration, power used, max current,
+     * min vbat, failsafes, i2c errors, max cycle time, GPS satellites, max distance and speed. One record (21 bytes) is written
+     * at disarm, MSP_FLIGHT_LOG reads them. With MWI_SDCARD every record is also appended to FLIGHTS.BIN. */
+    //#define LOG_FLIGHTS 16
 	
 	/* Logging to SDCARD module 
 	*/
@@ -1127,6 +1197,9 @@
     //#define LOG_PERMANENT_SD_ONLY     // Disable permanent logging on eeprom
     //#define LOG_GPS_POSITION 2	   // Write GPS position to log. Parameter is the number of seconds between two logs
     //#define CSPIN 53                  // By default : 53 on mega boards, 10 on others. refer to your board specs
+    //#define LOG_BLACKBOX 4            // Binary flight log (gyro, acc, rcCommand, PID, motors, attitude, alt) one loop out of N while armed. MEGA only: 1k of RAM
+    //#define LOG_BLACKBOX_BLOCKS 16384UL // Size of the file allocated for each flight, in 512 bytes blocks (16384 = 8MB)
+    //#define LOG_BLACKBOX_INTRA 32     // One full frame every N frames, the others are deltas. Decode with tools/bbdecode.cpp
 
     /* to add debugging code
        not needed and not recommended for normal operation
@@ -563,7 +563,10 @@
   #define STABLEPIN_PINMODE          pinMode (31, OUTPUT);
   #define STABLEPIN_ON               PORTC |= 1<<6;
   #define STABLEPIN_OFF              PORTC &= ~(1<<6);
-  #if defined(PPM_ON_THROTTLE)
+  #if defined(PPM_INPUT_CAPTURE)
+    //configure PIN 48 (ICP5) as input with pullup, Timer5 in normal mode, noise canceler, rising edge, prescaler 8 (0.5us) and enable the capture interrupt
+    #define PPM_PIN_INTERRUPT        DDRL &= ~(1<<1); PORTL |= (1<<1); TCCR5A = 0; TCCR5B = (1<<ICNC5)|(1<<ICES5)|(1<<CS51); TIMSK5 |= (1<<ICIE5);
+  #elif defined(PPM_ON_THROTTLE)
     //configure THROTTLE PIN (A8 pin) as input witch pullup and enabled PCINT interrupt
     #define PPM_PIN_INTERRUPT        DDRK &= ~(1<<0); PORTK |= (1<<0);  PCICR |= (1<<2); PCMSK2 |= (1<<0);
   #else
@@ -846,6 +849,12 @@
 #define LOGFILE_GPS 0
 #define LOGFILE_PERM 1
 #endif
+#if defined(LOG_BLACKBOX) && !defined(LOG_BLACKBOX_BLOCKS)
+  #define LOG_BLACKBOX_BLOCKS 16384UL
+#endif
+#if defined(LOG_BLACKBOX) && !defined(LOG_BLACKBOX_INTRA)
+  #define LOG_BLACKBOX_INTRA 32
+#endif
 
 
 /**************************************************************************************/
@@ -1852,6 +1861,15 @@
   #define RC_CHANS 8
 #endif
 
+#if defined(MSP_LARGE_INBUF_PORT) && !defined(MSP_LARGE_INBUF_SIZE)
+  #define MSP_LARGE_INBUF_SIZE 256
+#endif
+
+#if defined(RC_JITTER_BYPASS_THRESHOLD) || defined(PPM_INPUT_CAPTURE)
+  #define RC_JITTER_STATS
+#endif
+#define RC_JITTER_BUCKETS 8 // pulse to pulse change histogram: 0, 1, 2-3, 4-7, 8-15, 16-31, 32-63, 64+ us
+
 
 /**************************************************************************************/
 /***************                       I2C GPS                     ********************/
@@ -2115,6 +2133,55 @@
         #error "to use single step telemetry, you MUST also define and configure LCD_TELEMETRY"
 #endif
 
+#if defined(PPM_INPUT_CAPTURE) && !(defined(MEGA) && defined(SERIAL_SUM_PPM))
+  #error "PPM_INPUT_CAPTURE uses the Timer5 input capture of MEGA boards and needs SERIAL_SUM_PPM"
+#endif
+
+#if defined(PPM_INPUT_CAPTURE) && (defined(SERVO) || defined(PPM_ON_THROTTLE))
+  #error "PPM_INPUT_CAPTURE uses Timer5 which is also needed for the servos, and can't be used with PPM_ON_THROTTLE"
+#endif
+
+#if defined(RC_JITTER_STATS) && !defined(SERIAL_SUM_PPM)
+  #error "RC_JITTER_STATS and RC_JITTER_BYPASS_THRESHOLD are only available with a SERIAL_SUM_PPM receiver"
+#endif
+
+#if defined(MISSION_STAGE_SIZE) && !(defined(USE_MSP_WP) && defined(GPS_SERIAL) && !defined(I2C_GPS))
+  #error "MISSION_STAGE_SIZE needs USE_MSP_WP and a serial GPS"
+#endif
+
+#if defined(MISSION_SD) && !(defined(USE_MSP_WP) && defined(GPS_SERIAL) && !defined(I2C_GPS) && defined(MWI_SDCARD) && defined(MEGA))
+  #error "MISSION_SD needs USE_MSP_WP, a serial GPS, MWI_SDCARD and a MEGA board"
+#endif
+
+#if defined(MISSION_RAM) && !(defined(GPS_SERIAL) && !defined(I2C_GPS))
+  #error "MISSION_RAM needs a serial GPS"
+#endif
+#if defined(MISSION_RAM) && MISSION_RAM < 2
+  #error "MISSION_RAM must be 2 or more"
+#endif
+
+#if defined(INS_NAV) && (!defined(GPS_SERIAL) || defined(I2C_GPS) || !MAG || !ACC)
+  #error "INS_NAV needs a serial GPS, a MAG and an ACC"
+#endif
+
+#if defined(UBLOX_PVT) && !defined(UBLOX)
+  #error "UBLOX_PVT is a UBLOX option"
+#endif
+
+#if defined(MSP_PARAMS) && defined(SUPPRESS_ALL_SERIAL_MSP)
+  #error "MSP_PARAMS needs the MSP, remove SUPPRESS_ALL_SERIAL_MSP"
+#endif
+
+#if defined(MEGA) && !defined(EEPROM_WRITE_QUEUE)
+  #define EEPROM_WRITE_QUEUE 64
+#endif
+#if defined(EEPROM_WRITE_QUEUE) && EEPROM_WRITE_QUEUE == 0
+  #undef EEPROM_WRITE_QUEUE
+#endif
+#if defined(EEPROM_WRITE_QUEUE) && (EEPROM_WRITE_QUEUE < 2 || EEPROM_WRITE_QUEUE > 255)
+  #error "EEPROM_WRITE_QUEUE must be 0 or between 2 and 255"
+#endif
+
 #if defined(A32U4_4_HW_PWM_SERVOS) && !(defined(HELI_120_CCPM))
   #error "for your protection: A32U4_4_HW_PWM_SERVOS was not tested with your coptertype"
 #endif
@@ -111,6 +111,14 @@ typedef struct {
   int16_t heading;             // variometer in cm/s
 } att_t;
 
+#if defined(RC_JITTER_STATS)
+typedef struct {
+  uint16_t hist[RC_JITTER_BUCKETS]; // count of jitter samples per log2 bucket
+  uint16_t avg;                     // smoothed jitter in 1/16 us
+  uint8_t  max;                     // biggest jitter in us (saturated to 255)
+} rcJitter_t;
+#endif
+
 typedef struct {
   uint8_t OK_TO_ARM :1 ;
   uint8_t ARMED :1 ;
@@ -218,6 +226,26 @@ typedef struct {
   uint8_t  checksum;      // MUST BE ON LAST POSITION OF CONF STRUCTURE !
 } conf_t;
 
+#if defined(MSP_PARAMS)
+enum param_type {
+  PARAM_U8,
+  PARAM_S8,
+  PARAM_U16,
+  PARAM_S16,
+  PARAM_BIT0 = 8,       // PARAM_BIT0+n : bit n of the byte, 0 or 1
+  PARAM_GPS = 0x80      // field of GPS_conf, otherwise of conf (current profile)
+};
+
+typedef struct {
+  uint8_t  id;          // the same in every build, a parameter which is not compiled in is just missing
+  uint8_t  type;        // param_type
+  uint16_t offset;      // of the field, of the byte for a bit
+  int16_t  min;
+  int16_t  max;
+  uint8_t  scale;       // decimals for the GUI, value = raw / 10^scale
+} param_desc_t;
+#endif
+
 #ifdef LOG_PERMANENT
 typedef struct {
   uint16_t arm;           // #arm events
@@ -232,6 +260,24 @@ typedef struct {
 } plog_t;
 #endif
 
+#if defined(LOG_FLIGHTS)
+typedef struct {          // sent as is by MSP_FLIGHT_LOG and in FLIGHTS.BIN (little endian, no padding)
+  uint16_t number;        // flight number, counts up, 0: empty record
+  uint16_t duration;      // armed time in s
+  uint16_t powerSum;      // analog.intPowerMeterSum used during the flight
+  uint16_t maxAmperage;   // analog.amperage
+  uint16_t maxCycleTime;  // us
+  uint16_t i2cErrors;     // during the flight
+  uint8_t  minVbat;       // 0.1V, 0: no VBAT
+  uint8_t  failsafe;      // failsafe events during the flight
+  uint8_t  minSats;       // satellites while the GPS had a fix, 0: no fix
+  uint8_t  maxSats;
+  uint16_t maxDistance;   // m from home
+  uint16_t maxSpeed;      // GPS speed in cm/s
+  uint8_t  checksum;      // MUST BE ON LAST POSITION OF STRUCTURE !
+} flight_log_t;
+#endif
+
 #if GPS
 
 // TODO: cross check with I2C gps and add relevant defines
@@ -275,8 +321,14 @@ enum naverror {
   NAV_ERROR_LANDING              //Landing
   };
 
+#if defined(MISSION_SD)
+  typedef uint16_t wp_number_t;	//Mission step number, missions on the SD card can be longer than 254 steps
+#else
+  typedef uint8_t wp_number_t;
+#endif
+
  typedef struct {
-	  uint8_t	number;		//Waypoint number
+	  wp_number_t	number;		//Waypoint number
 	  int32_t	pos[2];		//GPS position 
 	  uint8_t	action;		//Action to follow
 	  int16_t	parameter1;	//Parameter for the action
@@ -286,6 +338,46 @@ enum naverror {
 	  uint8_t   flag;		//flags the last wp and other fancy things that are not yet defined
 	  uint8_t	checksum;	//this must be at the last position
   } mission_step_struct;
+
+#if defined(MISSION_STAGE_SIZE)
+enum missionstage {
+  MISSION_STAGE_IDLE = 0,
+  MISSION_STAGE_LOADING,         //Waiting for the steps
+  MISSION_STAGE_FLUSHING,        //Verified, being written to the EEPROM
+  MISSION_STAGE_DONE,            //All steps are in the EEPROM
+  MISSION_STAGE_ERROR            //Missing steps or CRC mismatch at commit
+  };
+
+ typedef struct {
+	  mission_step_struct step[MISSION_STAGE_SIZE];
+	  uint8_t	received[(MISSION_STAGE_SIZE+7)/8];	//One bit per staged step
+	  uint8_t	state;
+	  uint8_t	first;		//WP number of step[0]
+	  uint8_t	count;		//Number of steps in this stage
+	  uint8_t	flushed;	//Steps already written to the EEPROM
+	  uint8_t	pos;		//Next byte of step[flushed] to write
+  } mission_stage_t;
+#endif
+
+#if defined(MISSION_RAM)
+ typedef struct {				//mission_step_struct without number and checksum
+	  int32_t	pos[2];
+	  uint32_t	altitude;
+	  int16_t	parameter1;
+	  int16_t	parameter2;
+	  int16_t	parameter3;
+	  uint8_t	action;
+	  uint8_t	flag;
+  } mission_ram_step_t;
+
+ typedef struct {
+	  mission_ram_step_t step[MISSION_RAM];
+	  wp_number_t	first;		//Step number of step[0]
+	  uint8_t	count;		//Steps in step[]
+	  wp_number_t	last;		//Last step of the mission, 0 when the mission was not checked or is not valid
+	  wp_number_t	wanted;		//First step of the next window, read while flying (0 : none)
+  } mission_cache_t;
+#endif
   
 
  typedef struct
@@ -0,0 +1,63 @@
+/*
+ * bbdecode: converts a MultiWii blackbox log (BBnnn.BIN, see LOG_BLACKBOX in config.h) to CSV.
+ *
+ *   g++ -O2 -o bbdecode bbdecode.cpp
+ *   ./bbdecode BB000.BIN > BB000.csv
+ *
+ * One line per frame, the columns are the fields named in the log header.
+ * A damaged frame is skipped up to the next 'I' frame; the counts are printed on stderr.
+ * For long logs bbexport.cpp does the same on all cores.
+ */
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#include "bblog.h"
+
+int main(int argc, char **argv) {
+  if (argc != 2) {
+    fprintf(stderr, "usage: %s BBnnn.BIN > out.csv\n", argv[0]);
+    return 1;
+  }
+  FILE *in = fopen(argv[1], "rb");
+  if (!in) {
+    perror(argv[1]);
+    return 1;
+  }
+  std::vector<uint8_t> data;
+  uint8_t chunk[65536];
+  size_t n;
+  while ((n = fread(chunk, 1, sizeof(chunk), in)) > 0) data.insert(data.end(), chunk, chunk + n);
+  fclose(in);
+
+  bblog::Header h;
+  std::string err;
+  if (!bblog::parseHeader(data.data(), data.size(), h, err)) {
+    fprintf(stderr, "%s: %s\n", argv[1], err.c_str());
+    return 1;
+  }
+  for (size_t i = 0; i < h.names.size(); i++) printf(i ? ",%s" : "%s", h.names[i].c_str());
+  printf("\n");
+
+  bblog::Decoder dec(h);
+  std::vector<uint32_t> v(h.names.size());
+  const uint8_t *p = data.data() + h.dataStart, *end = data.data() + data.size();
+  unsigned long frames = 0, skipped = 0;
+  for (;;) {
+    bblog::Decoder::Result r = dec.next(p, end, v.data());
+    if (r == bblog::Decoder::FRAME) {
+      for (size_t i = 0; i < v.size(); i++) printf(i ? ",%lld" : "%lld", (long long)bblog::fieldValue(h.types[i], v[i]));
+      printf("\n");
+      frames++;
+      continue;
+    }
+    if (r == bblog::Decoder::END) break;
+    // resync on the next 'I' frame
+    dec.reset();
+    skipped++;
+    for (p++; p < end && *p != 'I'; p++) {}
+    if (p >= end) break;
+  }
+  fprintf(stderr, "%lu frames, %lu resyncs, divisor %d, cycle time %d us\n", frames, skipped, h.divisor, h.cycleTime);
+  return 0;
+}
@@ -0,0 +1,252 @@
+/*
+ * bbexport: fast export of MultiWii blackbox logs (BBnnn.BIN, see LOG_BLACKBOX in config.h) for long recordings.
+ * The file is memory mapped and split in chunks at 'I' frames, the chunks are decoded in parallel.
+ *
+ *   g++ -O2 -pthread -o bbexport bbexport.cpp
+ *   ./bbexport [-j threads] [-f csv|col] BB000.BIN out
+ *
+ * csv : same output as bbdecode.
+ * col : columnar binary, little endian:
+ *       "MWBBCOL1", uint32 fields, uint64 rows,
+ *       per field: uint8 type (0 u32, 1 s16, 2 s32), uint8 name length, name,
+ *       then per field the column: rows values of 4 bytes (u32 or s32) or 2 bytes (s16).
+ * The decode and total throughputs are printed on stderr.
+ */
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bblog.h"
+
+static const size_t MIN_CHUNK = 256 * 1024;
+static const int SYNC_FRAMES = 8;  // frames decoded to accept an 'I' found in the middle of the file
+
+struct Chunk {
+  const uint8_t *start;   // an 'I' frame (or the end of the data)
+  const uint8_t *stop;    // first 'I' frame at or after the start of the next chunk, where the decoding stopped
+  std::vector<std::vector<uint32_t> > columns;
+  std::string csv;
+  unsigned long frames, resyncs;
+};
+
+// true if a decoding started at p gives SYNC_FRAMES frames with a growing time (or reaches the end cleanly)
+static bool isSync(const bblog::Header &h, const uint8_t *p, const uint8_t *end) {
+  bblog::Decoder dec(h);
+  std::vector<uint32_t> v(h.names.size());
+  uint32_t last = 0;
+  for (int i = 0; i < SYNC_FRAMES; i++) {
+    bblog::Decoder::Result r = dec.next(p, end, v.data());
+    if (r == bblog::Decoder::END) return i > 0;
+    if (r == bblog::Decoder::BAD) return false;
+    if (i > 0 && (int32_t)(v[0] - last) <= 0) return false;
+    last = v[0];
+  }
+  return true;
+}
+
+static const uint8_t *findSync(const bblog::Header &h, const uint8_t *p, const uint8_t *end) {
+  for (; p < end; p++) {
+    if (*p == 'I' && isSync(h, p, end)) return p;
+  }
+  return end;
+}
+
+// snprintf is most of the CSV time
+static void appendNum(std::string &s, int64_t v) {
+  char d[24];
+  int n = 0;
+  uint64_t u = v < 0 ? 0 - (uint64_t)v : (uint64_t)v;
+  do {
+    d[n++] = '0' + u % 10;
+    u /= 10;
+  } while (u);
+  if (v < 0) s.push_back('-');
+  while (n) s.push_back(d[--n]);
+}
+
+// decodes from c.start, up to the first 'I' frame at or after limit
+static void decodeChunk(const bblog::Header &h, Chunk &c, const uint8_t *limit, const uint8_t *end, bool csv) {
+  bblog::Decoder dec(h);
+  size_t n = h.names.size();
+  std::vector<uint32_t> v(n);
+  const uint8_t *p = c.start;
+  c.frames = c.resyncs = 0;
+  c.columns.assign(csv ? 0 : n, std::vector<uint32_t>());
+  while (p < end) {
+    if (p >= limit && *p == 'I') break;
+    bblog::Decoder::Result r = dec.next(p, end, v.data());
+    if (r == bblog::Decoder::FRAME) {
+      if (csv) {
+        for (size_t i = 0; i < n; i++) {
+          if (i) c.csv.push_back(',');
+          appendNum(c.csv, bblog::fieldValue(h.types[i], v[i]));
+        }
+        c.csv.push_back('\n');
+      } else {
+        for (size_t i = 0; i < n; i++) c.columns[i].push_back(v[i]);
+      }
+      c.frames++;
+      continue;
+    }
+    if (r == bblog::Decoder::END) {
+      p = end;
+      break;
+    }
+    dec.reset();
+    c.resyncs++;
+    for (p++; p < end && *p != 'I'; p++) {}
+  }
+  c.stop = p;
+}
+
+static bool writeAll(FILE *out, const void *buf, size_t len) {
+  return fwrite(buf, 1, len, out) == len;
+}
+
+int main(int argc, char **argv) {
+  unsigned threads = std::thread::hardware_concurrency();
+  bool csv = true;
+  int opt;
+  while ((opt = getopt(argc, argv, "j:f:")) != -1) {
+    if (opt == 'j') threads = atoi(optarg);
+    else if (opt == 'f' && !strcmp(optarg, "col")) csv = false;
+    else if (opt == 'f' && !strcmp(optarg, "csv")) csv = true;
+    else optind = argc + 1;
+  }
+  if (optind != argc - 2) {
+    fprintf(stderr, "usage: %s [-j threads] [-f csv|col] BBnnn.BIN out\n", argv[0]);
+    return 1;
+  }
+  if (threads == 0) threads = 1;
+
+  std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+  int fd = open(argv[optind], O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) < 0 || st.st_size == 0) {
+    perror(argv[optind]);
+    return 1;
+  }
+  size_t size = st.st_size;
+  const uint8_t *data = (const uint8_t *)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (data == MAP_FAILED) {
+    perror("mmap");
+    return 1;
+  }
+  madvise((void *)data, size, MADV_SEQUENTIAL);
+  const uint8_t *end = data + size;
+
+  bblog::Header h;
+  std::string err;
+  if (!bblog::parseHeader(data, size, h, err)) {
+    fprintf(stderr, "%s: %s\n", argv[optind], err.c_str());
+    return 1;
+  }
+  const uint8_t *first = data + (h.dataStart < size ? h.dataStart : size);
+
+  // chunks: a few per thread so the threads stay busy, at 'I' frames found in parallel
+  size_t count = threads * 4;
+  if ((size_t)(end - first) / count < MIN_CHUNK) count = (end - first) / MIN_CHUNK + 1;
+  std::vector<Chunk> chunks(count);
+  std::vector<std::thread> pool;
+  std::atomic<size_t> next(0);
+  for (size_t i = 0; i < count; i++) chunks[i].start = first + (end - first) * i / count;
+  for (unsigned t = 0; t < threads; t++) {
+    pool.push_back(std::thread([&]() {
+      size_t i;
+      while ((i = next++) < count) {
+        if (i > 0) chunks[i].start = findSync(h, chunks[i].start, end);
+      }
+    }));
+  }
+  for (size_t t = 0; t < pool.size(); t++) pool[t].join();
+  pool.clear();
+
+  next = 0;
+  for (unsigned t = 0; t < threads; t++) {
+    pool.push_back(std::thread([&]() {
+      size_t i;
+      while ((i = next++) < count) {
+        const uint8_t *limit = i + 1 < count ? chunks[i + 1].start : end;
+        if (limit < chunks[i].start) limit = chunks[i].start;
+        decodeChunk(h, chunks[i], limit, end, csv);
+      }
+    }));
+  }
+  for (size_t t = 0; t < pool.size(); t++) pool[t].join();
+
+  // a chunk must start where the previous one stopped, otherwise its sync was wrong: decode it again from there
+  unsigned long redone = 0;
+  for (size_t i = 1; i < count; i++) {
+    if (chunks[i].start != chunks[i - 1].stop) {
+      const uint8_t *limit = i + 1 < count ? chunks[i + 1].start : end;
+      chunks[i].start = chunks[i - 1].stop;
+      chunks[i].csv.clear();
+      if (limit < chunks[i].start) limit = chunks[i].start;
+      decodeChunk(h, chunks[i], limit, end, csv);
+      redone++;
+    }
+  }
+  std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+
+  FILE *out = fopen(argv[optind + 1], "wb");
+  if (!out) {
+    perror(argv[optind + 1]);
+    return 1;
+  }
+  unsigned long long rows = 0;
+  unsigned long resyncs = 0;
+  for (size_t i = 0; i < count; i++) {
+    rows += chunks[i].frames;
+    resyncs += chunks[i].resyncs;
+  }
+  bool ok = true;
+  size_t n = h.names.size();
+  if (csv) {
+    for (size_t i = 0; i < n; i++) fprintf(out, i ? ",%s" : "%s", h.names[i].c_str());
+    fprintf(out, "\n");
+    for (size_t i = 0; i < count && ok; i++) ok = writeAll(out, chunks[i].csv.data(), chunks[i].csv.size());
+  } else {
+    uint32_t fields = n;
+    ok = writeAll(out, "MWBBCOL1", 8) && writeAll(out, &fields, 4) && writeAll(out, &rows, 8);
+    for (size_t f = 0; f < n && ok; f++) {
+      uint8_t type = h.types[f], len = h.names[f].size();
+      ok = writeAll(out, &type, 1) && writeAll(out, &len, 1) && writeAll(out, h.names[f].data(), len);
+    }
+    std::vector<int16_t> s16;
+    for (size_t f = 0; f < n && ok; f++) {
+      for (size_t i = 0; i < count && ok; i++) {
+        const std::vector<uint32_t> &col = chunks[i].columns[f];
+        if (h.types[f] == bblog::TYPE_S16) {
+          s16.assign(col.begin(), col.end());
+          ok = writeAll(out, s16.data(), s16.size() * 2);
+        } else {
+          ok = writeAll(out, col.data(), col.size() * 4);
+        }
+      }
+    }
+  }
+  if (fclose(out) != 0 || !ok) {
+    perror(argv[optind + 1]);
+    return 1;
+  }
+  std::chrono::steady_clock::time_point t2 = std::chrono::steady_clock::now();
+
+  double mb = size / 1e6;
+  double dec = std::chrono::duration<double>(t1 - t0).count();
+  double all = std::chrono::duration<double>(t2 - t0).count();
+  fprintf(stderr, "%llu frames, %lu resyncs, %zu chunks (%lu redone), %u threads\n", rows, resyncs, count, redone, threads);
+  fprintf(stderr, "%.1f MB: decode %.1f MB/s, total %.1f MB/s\n", mb, mb / dec, mb / all);
+  munmap((void *)data, size);
+  close(fd);
+  return 0;
+}
@@ -0,0 +1,149 @@
+/*
+ * Reader of the MultiWii blackbox logs (BBnnn.BIN, LOG_BLACKBOX in config.h).
+ * The format is described in MultiWii/SDcard.cpp: a text header giving the fields (names, types, predictors)
+ * then 'I' frames (values) and 'P' frames (differences from a prediction), every field a zig-zag varint.
+ *
+ * Host code only (Linux, any C++11 compiler), used by bbdecode.cpp.
+ */
+#ifndef BBLOG_H_
+#define BBLOG_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+namespace bblog {
+
+static const size_t BLOCK_SIZE = 512;
+
+enum Predictor { PRED_ZERO = 0, PRED_PREVIOUS = 1, PRED_STRAIGHT = 2 };
+enum Type { TYPE_U32 = 0, TYPE_S16, TYPE_S32 };
+
+struct Header {
+  int version;
+  int divisor;                  // one frame every 'divisor' loops
+  int intraInterval;            // one 'I' frame every 'intraInterval' frames
+  int cycleTime;                // loop time at arming, us
+  std::vector<std::string> names;
+  std::vector<int> types;       // Type
+  std::vector<int> predictors;  // Predictor
+  size_t dataStart;             // offset of the first frame in the file
+
+  Header() : version(0), divisor(1), intraInterval(0), cycleTime(0), dataStart(0) {}
+};
+
+static inline std::vector<std::string> splitComma(const std::string &s) {
+  std::vector<std::string> out;
+  size_t b = 0, e;
+  while ((e = s.find(',', b)) != std::string::npos) {
+    out.push_back(s.substr(b, e - b));
+    b = e + 1;
+  }
+  out.push_back(s.substr(b));
+  return out;
+}
+
+// parses the "H name:value" lines at the beginning of the file
+static inline bool parseHeader(const uint8_t *buf, size_t size, Header &h, std::string &err) {
+  size_t p = 0;
+  while (p + 2 < size && buf[p] == 'H' && buf[p + 1] == ' ') {
+    const uint8_t *nl = (const uint8_t *)memchr(buf + p, '\n', size - p);
+    if (!nl) break;
+    std::string line((const char *)buf + p + 2, (const char *)nl);
+    p = nl - buf + 1;
+    size_t colon = line.find(':');
+    if (colon == std::string::npos) continue;
+    std::string key = line.substr(0, colon), val = line.substr(colon + 1);
+    if (key == "Version") h.version = atoi(val.c_str());
+    else if (key == "Divisor") h.divisor = atoi(val.c_str());
+    else if (key == "I interval") h.intraInterval = atoi(val.c_str());
+    else if (key == "Cycle time") h.cycleTime = atoi(val.c_str());
+    else if (key == "Field names") h.names = splitComma(val);
+    else if (key == "Field types") {
+      std::vector<std::string> t = splitComma(val);
+      h.types.clear();
+      for (size_t i = 0; i < t.size(); i++) h.types.push_back(t[i] == "u32" ? TYPE_U32 : t[i] == "s32" ? TYPE_S32 : TYPE_S16);
+    } else if (key == "Field predictors") {
+      std::vector<std::string> t = splitComma(val);
+      h.predictors.clear();
+      for (size_t i = 0; i < t.size(); i++) h.predictors.push_back(atoi(t[i].c_str()));
+    }
+  }
+  if (h.version != 2) { err = "not a MultiWii blackbox log (version 2)"; return false; }
+  if (h.names.empty() || h.types.size() != h.names.size() || h.predictors.size() != h.names.size()) {
+    err = "incomplete field description in the header";
+    return false;
+  }
+  h.dataStart = (p + BLOCK_SIZE - 1) / BLOCK_SIZE * BLOCK_SIZE;
+  return true;
+}
+
+// signed value of a field, as the firmware stored it
+static inline int64_t fieldValue(int type, uint32_t raw) {
+  switch (type) {
+    case TYPE_U32: return raw;
+    case TYPE_S32: return (int32_t)raw;
+    default:       return (int16_t)raw;
+  }
+}
+
+class Decoder {
+ public:
+  enum Result { FRAME, END, BAD };
+
+  explicit Decoder(const Header &h) : h_(h), prev_(h.names.size()), prev2_(h.names.size()), valid_(false) {}
+
+  // forget the history: the next frame must be an 'I' frame
+  void reset() { valid_ = false; }
+
+  // decodes the frame at p into values (raw 32 bit, see fieldValue) and moves p after it.
+  // END: end of data or the 0 padding of the last block, BAD: not a frame (p is not moved)
+  Result next(const uint8_t *&p, const uint8_t *end, uint32_t *values) {
+    if (p >= end) return END;
+    if (*p == 0) {  // a 0 delta is a 0 byte too: only the end if nothing else follows
+      const uint8_t *z = p;
+      while (z < end && *z == 0) z++;
+      return z == end ? END : BAD;
+    }
+    uint8_t marker = *p;
+    if (marker != 'I' && !(marker == 'P' && valid_)) return BAD;
+    const uint8_t *q = p + 1;
+    size_t n = h_.names.size();
+    for (size_t i = 0; i < n; i++) {
+      uint32_t z = 0;
+      int shift = 0;
+      for (;;) {
+        if (q >= end || shift > 28) return BAD;
+        uint8_t c = *q++;
+        z |= (uint32_t)(c & 0x7F) << shift;
+        if (!(c & 0x80)) break;
+        shift += 7;
+      }
+      uint32_t delta = (z >> 1) ^ (0u - (z & 1));   // zig-zag
+      uint32_t pred = 0;
+      if (marker == 'P') {
+        if (h_.predictors[i] == PRED_PREVIOUS) pred = prev_[i];
+        else if (h_.predictors[i] == PRED_STRAIGHT) pred = 2 * prev_[i] - prev2_[i];
+      }
+      values[i] = pred + delta;
+    }
+    for (size_t i = 0; i < n; i++) {
+      prev2_[i] = marker == 'I' ? values[i] : prev_[i];   // no straight line across an 'I' frame
+      prev_[i] = values[i];
+    }
+    valid_ = true;
+    p = q;
+    return FRAME;
+  }
+
+ private:
+  const Header &h_;
+  std::vector<uint32_t> prev_, prev2_;
+  bool valid_;
+};
+
+}  // namespace bblog
+
+#endif  // BBLOG_H_
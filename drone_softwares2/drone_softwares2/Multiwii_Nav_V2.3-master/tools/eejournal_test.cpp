@@ -0,0 +1,307 @@
+/*
+ * eejournal_test: host test of the journaled EEPROM parameter store of MultiWii/EEPROM.cpp (EEPROM_JOURNAL).
+ * The journal code is a copy of EEPROM.cpp running on a simulated EEPROM which counts the writes of every cell
+ * and cuts the power at random points of a write. After each cut the journal is read again as at boot: the struct
+ * of the cut write must hold its old or its new value, and all the other structs their last value.
+ *
+ *   g++ -O2 -o eejournal_test eejournal_test.cpp
+ *   ./eejournal_test [writes] [seed]
+ *
+ * The workload is mostly stick trims (one or two bytes of the active profile), with some full profile changes
+ * (GUI), profile switches (global_conf) and GPS settings. A cut byte is left unchanged or erased (0xFF): the AVR
+ * erases then writes a byte, a power loss between the two leaves it erased.
+ * Prints the byte writes per write and the wear of the most written cell, against the full rewrites of the
+ * original store (eeprom_write_block writes every byte of the struct each time).
+ * The exit code is 0 when all the checks pass.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define E2END            4095
+#define EEPROM_JOURNAL   2048
+#define PROFILES         3
+#define GLOBAL_SIZE      16     // sizeof(global_conf_t)
+#define GPS_SIZE         26     // sizeof(gps_conf_struct)
+#define CONF_SIZE        190    // sizeof(conf_t)
+#define CUT_RATE         20     // one write in CUT_RATE is cut
+
+/************ simulated EEPROM ************/
+static uint8_t ee[E2END + 1];
+static uint32_t wear[E2END + 1];
+static uint32_t eeWrites;             // byte writes so far
+static uint32_t eeCutAt = 0xFFFFFFFF; // the power is cut at this byte write
+struct PowerLoss {};
+
+static uint8_t eepromReadByte(uint16_t addr) {
+  return ee[addr];
+}
+
+static void eepromReadBlock(void *dst, uint16_t addr, uint16_t len) {
+  memcpy(dst, &ee[addr], len);
+}
+
+static void eepromWriteByte(uint16_t addr, uint8_t v) {
+  if (ee[addr] == v) return;
+  if (eeWrites == eeCutAt) {
+    if (rand() & 1) {   // erased, not written
+      ee[addr] = 0xFF;
+      wear[addr]++;
+    }
+    throw PowerLoss();
+  }
+  ee[addr] = v;
+  wear[addr]++;
+  eeWrites++;
+}
+
+/************ copy of the EEPROM.cpp journal ************/
+#define JOURNAL_BANK      (EEPROM_JOURNAL / 2)
+#define JOURNAL_MAGIC     'J'
+#define JOURNAL_END       0xFF
+#define JOURNAL_MAX_LEN   32
+enum journalid {
+  JOURNAL_GLOBAL = 0,
+  JOURNAL_GPS,
+  JOURNAL_CONF            // + profile
+};
+#define JOURNAL_IDS       (JOURNAL_CONF + PROFILES)
+#define JOURNAL_GPS_SIZE  GPS_SIZE
+#define JOURNAL_RECORDS(size) ((size) + 3 * (((size) + JOURNAL_MAX_LEN - 1) / JOURNAL_MAX_LEN))
+#define JOURNAL_SNAPSHOT  (3 + JOURNAL_RECORDS(GLOBAL_SIZE) + JOURNAL_RECORDS(JOURNAL_GPS_SIZE) + PROFILES * JOURNAL_RECORDS(CONF_SIZE) + 1)
+
+typedef char journal_bank_too_small[JOURNAL_BANK >= JOURNAL_SNAPSHOT + 64 ? 1 : -1];
+
+static uint16_t journalBank;
+static uint16_t journalEnd;
+static uint8_t  journalSeq;
+static uint16_t journalTxn;
+static uint8_t  journalTxnHeader;
+
+static uint8_t journalSize(uint8_t id) {
+  if (id == JOURNAL_GLOBAL) return GLOBAL_SIZE;
+  if (id == JOURNAL_GPS) return JOURNAL_GPS_SIZE;
+  if (id >= JOURNAL_CONF && id < JOURNAL_IDS) return CONF_SIZE;
+  return 0;
+}
+
+static uint8_t journalSum(uint16_t addr, uint8_t len) {
+  uint8_t sum = 0x55;
+  len += 2;
+  while (len--) sum += eepromReadByte(addr++);
+  return sum;
+}
+
+static bool journalBankValid(uint16_t bank, uint8_t *seq) {
+  *seq = eepromReadByte(bank + 1);
+  return eepromReadByte(bank) == JOURNAL_MAGIC && eepromReadByte(bank + 2) == (uint8_t)~*seq;
+}
+
+static void journalCommitBank(uint16_t bank, uint8_t seq) {
+  eepromWriteByte(bank + 1, seq);
+  eepromWriteByte(bank + 2, ~seq);
+  eepromWriteByte(bank, JOURNAL_MAGIC);
+}
+
+static void journalInit() {
+  uint8_t s0, s1, h, len;
+  uint16_t a;
+  if (journalEnd) return;
+  bool v0 = journalBankValid(0, &s0), v1 = journalBankValid(JOURNAL_BANK, &s1);
+  if (!v0 && !v1) {
+    journalBank = 0; journalSeq = 0;
+    eepromWriteByte(3, JOURNAL_END);
+    journalCommitBank(0, 0);
+  } else if (v0 && (!v1 || (int8_t)(s0 - s1) > 0)) {
+    journalBank = 0; journalSeq = s0;
+  } else {
+    journalBank = JOURNAL_BANK; journalSeq = s1;
+  }
+  for (a = journalBank + 3; a + 3 < journalBank + JOURNAL_BANK; a += len + 3) {
+    h = eepromReadByte(a);
+    len = (h & 0x1F) + 1;
+    if (h == JOURNAL_END || a + len + 3 > journalBank + JOURNAL_BANK || journalSum(a, len) != eepromReadByte(a + len + 2)) break;
+  }
+  if (a < journalBank + JOURNAL_BANK) eepromWriteByte(a, JOURNAL_END);
+  journalEnd = a;
+}
+
+static bool journalReplay(uint16_t bank, uint16_t end, uint8_t id, uint8_t *buf, uint8_t size) {
+  bool found = false;
+  uint16_t a = bank + 3;
+  while (a < end) {
+    uint8_t h = eepromReadByte(a), len = (h & 0x1F) + 1, off = eepromReadByte(a + 1);
+    if ((h >> 5) == id && off + len <= size) {
+      eepromReadBlock(buf + off, a + 2, len);
+      found = true;
+    }
+    a += len + 3;
+  }
+  return found;
+}
+
+static bool journalAppend(uint8_t id, uint8_t off, const uint8_t *data, uint8_t len, bool defer) {
+  uint16_t a = journalEnd;
+  uint8_t h = id << 5 | (len - 1), sum = 0x55 + h + off, i;
+  if (a + len + 4 > journalBank + JOURNAL_BANK) return false;
+  eepromWriteByte(a + 1, off);
+  for (i = 0; i < len; i++) {
+    eepromWriteByte(a + 2 + i, data[i]);
+    sum += data[i];
+  }
+  eepromWriteByte(a + 2 + len, sum);
+  eepromWriteByte(a + 3 + len, JOURNAL_END);
+  if (defer && journalTxn == 0) {
+    journalTxn = a;
+    journalTxnHeader = h;
+  } else {
+    eepromWriteByte(a, h);
+  }
+  journalEnd = a + 3 + len;
+  return true;
+}
+
+static void journalCommit() {
+  if (journalTxn) eepromWriteByte(journalTxn, journalTxnHeader);
+  journalTxn = 0;
+}
+
+static void journalCompact(uint8_t id, const uint8_t *buf, uint8_t size) {
+  uint8_t tmp[CONF_SIZE];
+  uint16_t oldBank = journalBank, oldEnd = journalTxn ? journalTxn : journalEnd;
+  uint8_t k, off, n;
+  journalTxn = 0;
+  journalBank = oldBank ? 0 : JOURNAL_BANK;
+  journalEnd = journalBank + 3;
+  eepromWriteByte(journalBank, 0);
+  for (k = 0; k < JOURNAL_IDS; k++) {
+    const uint8_t *src = tmp;
+    n = journalSize(k);
+    if (k == id) { src = buf; n = size; }
+    else if (n == 0 || !journalReplay(oldBank, oldEnd, k, tmp, n)) continue;
+    for (off = 0; off < n; off += JOURNAL_MAX_LEN) journalAppend(k, off, src + off, n - off < JOURNAL_MAX_LEN ? n - off : JOURNAL_MAX_LEN, false);
+  }
+  journalCommitBank(journalBank, ++journalSeq);
+}
+
+static void journalRead(uint8_t id, void *buf, uint8_t size) {
+  journalInit();
+  memset(buf, 0, size);
+  journalReplay(journalBank, journalEnd, id, (uint8_t*)buf, size);
+}
+
+static void journalWrite(uint8_t id, const void *data, uint8_t size) {
+  uint8_t old[CONF_SIZE];
+  const uint8_t *buf = (const uint8_t*)data;
+  uint8_t i = 0, start, last;
+  journalInit();
+  bool found = journalReplay(journalBank, journalEnd, id, old, size);
+  while (i < size) {
+    if (found && old[i] == buf[i]) { i++; continue; }
+    start = last = i;
+    while (i < size && i - start < JOURNAL_MAX_LEN) {
+      if (!found || old[i] != buf[i]) last = i;
+      else if (i - last > 3) break;
+      i++;
+    }
+    i = last + 1;
+    if (!journalAppend(id, start, buf + start, last - start + 1, true)) {
+      journalCompact(id, buf, size);
+      return;
+    }
+  }
+  journalCommit();
+}
+
+/************ test ************/
+static uint8_t model[JOURNAL_IDS][CONF_SIZE];   // what the EEPROM must hold
+
+static void reboot() {
+  journalEnd = 0;
+  journalTxn = 0;
+}
+
+// reads everything as at boot, false if a struct is neither its model nor, for id, next
+static bool check(int id, const uint8_t *next) {
+  uint8_t buf[CONF_SIZE];
+  for (int k = 0; k < JOURNAL_IDS; k++) {
+    uint8_t n = journalSize(k);
+    journalRead(k, buf, n);
+    if (memcmp(buf, model[k], n) == 0) continue;
+    if (k == id && memcmp(buf, next, n) == 0) {
+      memcpy(model[k], next, n);
+      continue;
+    }
+    fprintf(stderr, "struct %d is torn after a power loss\n", k);
+    return false;
+  }
+  return true;
+}
+
+int main(int argc, char **argv) {
+  long writes = argc > 1 ? atol(argv[1]) : 20000;
+  srand(argc > 2 ? atoi(argv[2]) : 1);
+  memset(ee, 0xFF, sizeof(ee));
+  long cuts = 0, profileWrites[PROFILES] = {0}, globalWrites = 0, gpsWrites = 0;
+  uint8_t profile = 0;
+
+  for (long w = 0; w < writes; w++) {
+    uint8_t next[CONF_SIZE];
+    int id, r = rand() % 100;
+    if (r < 85) {               // stick trim of the active profile
+      id = JOURNAL_CONF + profile;
+      memcpy(next, model[id], CONF_SIZE);
+      next[rand() % (CONF_SIZE - 1)] += 1 + rand() % 3;
+      if (rand() & 1) next[rand() % (CONF_SIZE - 1)]++;
+      next[CONF_SIZE - 1] ^= 0x5A;   // checksum
+    } else if (r < 92) {        // GUI: new PIDs and rates
+      id = JOURNAL_CONF + profile;
+      memcpy(next, model[id], CONF_SIZE);
+      for (int i = 0; i < 30; i++) next[rand() % CONF_SIZE] = rand();
+    } else if (r < 97) {        // profile switch
+      id = JOURNAL_GLOBAL;
+      profile = rand() % PROFILES;
+      memcpy(next, model[id], GLOBAL_SIZE);
+      next[0] = profile;
+      next[GLOBAL_SIZE - 1] = rand();
+    } else {                    // GPS settings
+      id = JOURNAL_GPS;
+      memcpy(next, model[id], GPS_SIZE);
+      for (int i = 0; i < 4; i++) next[rand() % GPS_SIZE] = rand();
+    }
+    if (id == JOURNAL_GLOBAL) globalWrites++;
+    else if (id == JOURNAL_GPS) gpsWrites++;
+    else profileWrites[id - JOURNAL_CONF]++;
+
+    uint8_t n = journalSize(id);
+    if (rand() % CUT_RATE == 0) eeCutAt = eeWrites + rand() % 40;
+    try {
+      journalWrite(id, next, n);
+      memcpy(model[id], next, n);
+    } catch (PowerLoss &) {
+      cuts++;
+      eeCutAt = 0xFFFFFFFF;
+      reboot();
+      if (!check(id, next)) return 1;
+    }
+    eeCutAt = 0xFFFFFFFF;
+  }
+  reboot();
+  if (!check(-1, NULL)) return 1;
+
+  uint32_t maxWear = 0;
+  for (int i = 0; i <= E2END; i++) if (wear[i] > maxWear) maxWear = wear[i];
+  long profileAll = 0, profileMax = 0;
+  for (int p = 0; p < PROFILES; p++) {
+    profileAll += profileWrites[p];
+    if (profileWrites[p] > profileMax) profileMax = profileWrites[p];
+  }
+  printf("%ld writes (%ld profile, %ld global_conf, %ld GPS), %ld power losses: all checks passed\n",
+         writes, profileAll, globalWrites, gpsWrites, cuts);
+  printf("journal (%d bytes): %.1f byte writes per write, most written cell %u writes\n",
+         EEPROM_JOURNAL, (double)eeWrites / writes, maxWear);
+  printf("full rewrites     : %d byte writes per profile write, every byte of the most used profile %ld writes\n",
+         CONF_SIZE, profileMax);
+  return 0;
+}
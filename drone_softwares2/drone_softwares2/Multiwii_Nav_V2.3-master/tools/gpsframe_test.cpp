@@ -0,0 +1,170 @@
+/*
+ * gpsframe_test: host check of the integer local frame of MultiWii/GPS.cpp (distance, bearing, crosstrack) against
+ * the float formulas it replaced, computed in double with the same longitude scaling. GPS.cpp itself is built,
+ * with a serial NMEA GPS, on the host stand-ins of host/.
+ *
+ *   g++ -O2 -Ihost -ffunction-sections -fdata-sections -Wl,--gc-sections -o gpsframe_test gpsframe_test.cpp
+ *   ./gpsframe_test [points] [seed]
+ *
+ * Every point draws an origin (home) at a latitude up to 70deg, a leg FROM -> WP of up to 20km starting within
+ * 10km of it, set with GPS_set_next_wp, and the copter along the leg within the +-327m GPS_update_crosstrack
+ * gives (crosstrack_error is clamped there).
+ * Also checks that a home moved with GPS_set_home is used by the distance to home, and that nothing is converted
+ * from GPS_home before it is set (0,0 is out of the range of GPS_mul_q15).
+ * Prints the worst errors; the exit code is 0 when they are within the bounds below.
+ */
+#define __AVR_ATmega2560__
+#include "Arduino.h"
+#include "../MultiWii/config.h"
+#undef I2C_GPS
+#undef UBLOX
+#undef MTK_BINARY16
+#undef MTK_BINARY19
+#undef INIT_MTK_GPS
+#undef GPS_SERIAL
+#undef GPS_BAUD
+#define GPS_SERIAL 2
+#define GPS_BAUD   57600
+#define NMEA
+#include "../MultiWii/GPS.cpp"
+
+#include <stdio.h>
+
+#define BEARING_MAX  12      // 0.01deg, beyond MIN_LEG
+#define DISTANCE_MAX 0.00025 // relative, beyond MIN_LEG
+#define CROSS_MAX    150     // cm, legs up to LEG_MAX
+#define MIN_LEG      10000   // cm
+#define LEG_MAX      2000000 // cm
+
+// the rest of the firmware, as far as GPS.cpp uses it here
+flags_struct_t f;
+int32_t  GPS_coord[2];
+int32_t  GPS_home[2];
+int32_t  GPS_hold[2];
+uint8_t  GPS_numSat;
+uint16_t GPS_distanceToHome;
+int16_t  GPS_directionToHome;
+uint16_t GPS_altitude;
+uint16_t GPS_speed;
+uint16_t GPS_ground_course;
+uint8_t  GPS_Present;
+uint16_t GPS_hdop;
+gps_conf_struct GPS_conf;
+
+#define CHECK(c, ...) do { if (!(c)) { printf("FAILED: " __VA_ARGS__); printf("\n"); return 1; } } while (0)
+
+static uint32_t seed = 1;
+static int32_t rnd(int32_t lo, int32_t hi) {  // lo..hi, deterministic for a seed
+  seed = seed * 1103515245u + 12345u;
+  uint32_t r = ((seed >> 8) << 8) ^ (seed * 2654435761u >> 24);
+  return lo + (int32_t)(r % (uint32_t)(hi - lo + 1));
+}
+
+// the float formulas of GPS.cpp before the local frame, in double
+static double refDistance(int32_t *from, int32_t *to) {
+  double dLat = (double)(to[LAT] - from[LAT]);
+  double dLon = (double)(to[LON] - from[LON]) * GPS_scaleLonDown;
+  return sqrt(dLat * dLat + dLon * dLon) * 1.11318845;
+}
+
+static double refBearing(int32_t *from, int32_t *to) {  // 0.01deg
+  double off_x = to[LON] - from[LON];
+  double off_y = (to[LAT] - from[LAT]) / (double)GPS_scaleLonDown;
+  double b = 9000 + atan2(-off_y, off_x) * 5729.57795;
+  return (b < 0) ? b + 36000 : b;
+}
+
+static double angleDiff(double a, double b) {
+  double d = fmod(a - b + 54000.0, 36000.0) - 18000.0;
+  return fabs(d);
+}
+
+// the point n cm north and e cm east of c, in lat/lon*10^7
+static void offset(int32_t *c, double n, double e, int32_t *p) {
+  double scale = cos(c[LAT] * 1.0e-7 * 0.01745329251);
+  p[LAT] = c[LAT] + (int32_t)(n / 1.11318845);
+  p[LON] = c[LON] + (int32_t)(e / 1.11318845 / scale);
+}
+
+// a point within r cm of c
+static void near(int32_t *c, int32_t r, int32_t *p) {
+  offset(c, rnd(-r, r), rnd(-r, r), p);
+}
+
+int main(int argc, char **argv) {
+  long points = (argc > 1) ? atol(argv[1]) : 200000;
+  seed = (argc > 2) ? atol(argv[2]) : 1;
+  double worstBearing = 0, worstDistance = 0, worstCross = 0;
+  long crossed = 0;
+
+  // nothing is converted from GPS_home = 0,0 before home is set
+  int32_t first[2] = {488566000, 23522000};
+  f.GPS_FIX_HOME = 0;
+  GPS_home[LAT] = GPS_home[LON] = 0;
+  GPS_home_local[LAT] = GPS_home_local[LON] = 12345;
+  GPS_cm_per_lon = 0;
+  GPS_set_origin(first);
+  CHECK(GPS_home_local[LAT] == 12345 && GPS_home_local[LON] == 12345, "home converted before it was set");
+
+  // a home moved by MSP is in the local frame right away
+  f.GPS_FIX_HOME = 1;
+  GPS_set_home(first);
+  CHECK(GPS_home_local[LAT] == 0 && GPS_home_local[LON] == 0, "home at the origin is not 0,0");
+  int32_t moved[2], movedLocal[2];
+  near(first, 50000, moved);
+  GPS_set_home(moved);
+  GPS_to_local(moved, movedLocal);
+  CHECK(GPS_home_local[LAT] == movedLocal[LAT] && GPS_home_local[LON] == movedLocal[LON], "GPS_set_home didn't update the local home");
+  uint32_t dist;
+  GPS_distance_cm(movedLocal, GPS_home_local, &dist);
+  CHECK(dist == 0, "distance to the moved home is %u cm", (unsigned)dist);
+
+  for (long i = 0; i < points; i++) {
+    int32_t origin[2] = {rnd(-700000000, 700000000), rnd(-1790000000, 1790000000)};
+    int32_t from[2], to[2], copter[2], fromL[2], toL[2], copterL[2];
+
+    GPS_cm_per_lon = 0;
+    GPS_set_origin(origin);
+    near(origin, 1000000, from);
+    double dir = rnd(0, 35999) * 0.01745329251 / 100, len = rnd(0, LEG_MAX);
+    offset(from, len * cos(dir), len * sin(dir), to);
+    GPS_to_local(from, fromL);
+    GPS_to_local(to, toL);
+
+    GPS_distance_cm(fromL, toL, &dist);
+    double rd = refDistance(from, to);
+    if (rd > MIN_LEG) {
+      int32_t bearing;
+      GPS_bearing(fromL, toL, &bearing);
+      double eb = angleDiff(bearing, refBearing(from, to));
+      double ed = fabs(dist - rd) / rd;
+      if (eb > worstBearing) worstBearing = eb;
+      if (ed > worstDistance) worstDistance = ed;
+    }
+
+    // crosstrack: the distance of the copter to the leg, signed as sin(bearing difference) * distance to WP
+    GPS_set_next_wp(&to[LAT], &to[LON], &from[LAT], &from[LON]);
+    if (rd < MIN_LEG) continue;
+    double along = rnd(0, (int32_t)len), across = rnd(-32700, 32700);
+    offset(from, along * cos(dir) - across * sin(dir), along * sin(dir) + across * cos(dir), copter);
+    GPS_to_local(copter, copterL);
+    GPS_local[LAT] = copterL[LAT];
+    GPS_local[LON] = copterL[LON];
+    GPS_distance_cm(copterL, toL, &wp_distance);
+    target_bearing = 0;
+    GPS_bearing(copterL, toL, &target_bearing);
+    double diff = (refBearing(copter, to) - refBearing(from, to)) * RADX100;
+    double rc = sin(diff) * refDistance(copter, to);
+    GPS_update_crosstrack();
+    double ec = fabs(crosstrack_error - constrain(rc, -32767, 32767));
+    if (ec > worstCross) worstCross = ec;
+    crossed++;
+  }
+
+  printf("%ld points (%ld crosstrack): bearing within %.3fdeg, distance within %.4f%% beyond %dm, crosstrack within %.0fcm\n",
+         points, crossed, worstBearing / 100, worstDistance * 100, MIN_LEG / 100, worstCross);
+  CHECK(worstBearing <= BEARING_MAX, "bearing error above %.2fdeg", BEARING_MAX / 100.0);
+  CHECK(worstDistance <= DISTANCE_MAX, "distance error above %.3f%%", DISTANCE_MAX * 100);
+  CHECK(worstCross <= CROSS_MAX, "crosstrack error above %dcm", CROSS_MAX);
+  return 0;
+}
@@ -0,0 +1,102 @@
+/*
+ * Host stand-ins for the Arduino core and the AVR registers, to build firmware sources of MultiWii/ in the tools:
+ *
+ *   g++ -O2 -Ihost -ffunction-sections -fdata-sections -Wl,--gc-sections -o tool tool.cpp
+ *
+ * The tool includes its C++ headers first (min, max and abs are macros here), defines the MCU (e.g.
+ * __AVR_ATmega2560__), includes config.h, adjusts the options it needs, then includes the .cpp files it runs.
+ * --gc-sections drops the code the tool doesn't reach, so only the globals and functions of the other files which
+ * that code uses have to be defined by the tool.
+ * Time stands still: micros() and millis() return hostMicros, which the tool (and delay) moves on.
+ */
+#ifndef HOST_ARDUINO_H_
+#define HOST_ARDUINO_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include <ctype.h>
+#include <stdio.h>
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+#include <avr/interrupt.h>
+#include <avr/eeprom.h>
+
+#define F_CPU 16000000UL
+#define ARDUINO 105
+#define clockCyclesPerMicrosecond() (F_CPU / 1000000L)
+#define PI 3.1415926535897932384626433832795
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+inline uint32_t hostMicros;
+inline unsigned long micros() { return hostMicros; }
+inline unsigned long millis() { return hostMicros / 1000; }
+inline void delayMicroseconds(unsigned int us) { hostMicros += us; }
+inline void delay(unsigned long ms) { hostMicros += ms * 1000; }
+inline volatile unsigned long timer0_overflow_count;
+
+#define INPUT  0
+#define OUTPUT 1
+#define LOW    0
+#define HIGH   1
+#define RISING 3
+inline void pinMode(uint8_t, uint8_t) {}
+inline void digitalWrite(uint8_t, uint8_t) {}
+inline int  digitalRead(uint8_t) { return 0; }
+inline int  analogRead(uint8_t) { return 0; }
+inline void attachInterrupt(uint8_t, void (*)(void), int) {}
+
+#define min(a,b) ((a)<(b)?(a):(b))
+#define max(a,b) ((a)>(b)?(a):(b))
+#define abs(x) ((x)>0?(x):-(x))
+#define constrain(amt,low,high) ((amt)<(low)?(low):((amt)>(high)?(high):(amt)))
+#define sq(x) ((x)*(x))
+
+// Print of the core, for the libraries which take a Print* (SdFat): numbers and strings through write()
+#define DEC 10
+#define HEX 16
+class __FlashStringHelper;
+#define F(s) (reinterpret_cast<const __FlashStringHelper *>(PSTR(s)))
+class Print {
+ public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t c) = 0;
+  virtual size_t write(const uint8_t *buf, size_t n) {
+    size_t w = 0;
+    while (n--) w += write(*buf++);
+    return w;
+  }
+  size_t write(const char *s) { return write((const uint8_t *)s, strlen(s)); }
+  size_t print(const char *s) { return write(s); }
+  size_t print(const __FlashStringHelper *s) { return write((const char *)s); }
+  size_t print(char c) { return write((uint8_t)c); }
+  size_t print(long n, int base = DEC) { return printNum(n < 0 && base == DEC ? '-' : 0, n < 0 && base == DEC ? -(unsigned long)n : n, base); }
+  size_t print(unsigned long n, int base = DEC) { return printNum(0, n, base); }
+  size_t print(int n, int base = DEC) { return print((long)n, base); }
+  size_t print(unsigned int n, int base = DEC) { return print((unsigned long)n, base); }
+  size_t print(unsigned char n, int base = DEC) { return print((unsigned long)n, base); }
+  size_t println() { return write("\r\n"); }
+  template <class T> size_t println(T v) { return print(v) + println(); }
+  template <class T> size_t println(T v, int base) { return print(v, base) + println(); }
+
+ private:
+  size_t printNum(char sign, unsigned long n, int base) {
+    char buf[24];
+    snprintf(buf, sizeof(buf), base == HEX ? "%s%lX" : "%s%lu", sign ? "-" : "", n);
+    return write(buf);
+  }
+};
+
+// ATmega32u4 USB serial (PROMICRO), defined by the tool which builds it
+#define USB_CDC_RX 2
+#define USB_CDC_TX 3
+int     USB_Send(uint8_t ep, const void *data, int len);
+int     USB_Recv(uint8_t ep);
+uint8_t USB_Available(uint8_t ep);
+void    USB_Flush(uint8_t ep);
+
+#endif /* HOST_ARDUINO_H_ */
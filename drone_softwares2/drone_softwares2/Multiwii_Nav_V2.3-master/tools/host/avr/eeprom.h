@@ -0,0 +1,20 @@
+#ifndef HOST_EEPROM_H_
+#define HOST_EEPROM_H_
+// the EEPROM is hostEeprom[], erased (0xFF) at start
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <avr/io.h>
+
+struct HostEeprom {
+  uint8_t mem[E2END + 1];
+  HostEeprom() { memset(mem, 0xFF, sizeof(mem)); }
+};
+inline HostEeprom hostEeprom;
+
+inline void eeprom_read_block(void *dst, const void *src, size_t n) { memcpy(dst, hostEeprom.mem + (uintptr_t)src, n); }
+inline void eeprom_write_block(const void *src, void *dst, size_t n) { memcpy(hostEeprom.mem + (uintptr_t)dst, src, n); }
+inline uint8_t eeprom_read_byte(const uint8_t *p) { return hostEeprom.mem[(uintptr_t)p]; }
+inline void eeprom_write_byte(uint8_t *p, uint8_t v) { hostEeprom.mem[(uintptr_t)p] = v; }
+inline int  eeprom_is_ready() { return 1; }
+#endif /* HOST_EEPROM_H_ */
@@ -0,0 +1,7 @@
+#ifndef HOST_INTERRUPT_H_
+#define HOST_INTERRUPT_H_
+// an ISR is a plain function the tool calls, e.g. USART0_UDRE_vect() to send one byte
+#define ISR(vector, ...) extern "C" void vector(void)
+inline void cli() {}
+inline void sei() {}
+#endif /* HOST_INTERRUPT_H_ */
@@ -0,0 +1,94 @@
+#ifndef HOST_IO_H_
+#define HOST_IO_H_
+// the registers the firmware touches are plain variables, the bits have their ATmega2560 numbers
+#include <stdint.h>
+
+#define E2END 4095
+
+// a UART data register counts the bytes written to it, so that a tool sees every byte the TX interrupt sends
+struct HostUDR {
+  uint8_t data;
+  uint32_t written;
+  HostUDR &operator=(uint8_t c) { data = c; written++; return *this; }
+  operator uint8_t() const { return data; }
+};
+inline HostUDR UDR0, UDR1, UDR2, UDR3;
+inline volatile uint8_t SREG, UCSR0B, UCSR1B, UCSR2B, UCSR3B, UCSR0A, UCSR1A, UCSR2A, UCSR3A;
+inline volatile uint8_t UBRR0H, UBRR0L, UBRR1H, UBRR1L, UBRR2H, UBRR2L, UBRR3H, UBRR3L, UCSR0C, UCSR1C, UCSR2C, UCSR3C;
+inline volatile uint8_t EEAR, EECR, EEDR;
+inline volatile uint16_t ADCH, ADCL, ADCSRA, ADMUX, DDRA, DDRB, DDRC, DDRD, DDRE, DDRF, DDRG, DDRH, DDRJ, DDRK, DDRL;
+inline volatile uint16_t EICRA, EICRB, EIFR, EIMSK, ICR0, ICR1, ICR2, ICR3, ICR4, ICR5, MCUSR, OCR0A, OCR0AL, OCR0B;
+inline volatile uint16_t OCR0BL, OCR0C, OCR1A, OCR1AL, OCR1B, OCR1BL, OCR1C, OCR2A, OCR2AL, OCR2B, OCR2BL, OCR2C;
+inline volatile uint16_t OCR3A, OCR3AL, OCR3B, OCR3BL, OCR3C, OCR4A, OCR4AL, OCR4B, OCR4BL, OCR4C, OCR5A, OCR5AL;
+inline volatile uint16_t OCR5B, OCR5BL, OCR5C, PCICR, PCIFR, PCMSK0, PCMSK1, PCMSK2, PINA, PINB, PINC, PIND, PINE;
+inline volatile uint16_t PINF, PING, PINH, PINJ, PINK, PINL, PORTA, PORTB, PORTC, PORTD, PORTE, PORTF, PORTG, PORTH;
+inline volatile uint16_t PORTJ, PORTK, PORTL, SPCR, SPDR, SPSR, TCCR0A, TCCR0B, TCCR0C, TCCR1A, TCCR1B, TCCR1C, TCCR2A;
+inline volatile uint16_t TCCR2B, TCCR2C, TCCR3A, TCCR3B, TCCR3C, TCCR4A, TCCR4B, TCCR4C, TCCR5A, TCCR5B, TCCR5C, TCNT0;
+inline volatile uint16_t TCNT1, TCNT2, TCNT3, TCNT4, TCNT5, TIFR0, TIFR1, TIFR2, TIFR3, TIFR4, TIFR5, TIMSK0, TIMSK1;
+inline volatile uint16_t TIMSK2, TIMSK3, TIMSK4, TIMSK5, TWBR, TWCR, TWDR, TWSR, UDIEN, WDTCSR;
+#define EEARL EEAR
+
+#define ICNC5   7
+#define ICES5   6
+#define CS51    1
+#define ICIE5   5
+#define U2X0    1
+#define U2X1    1
+#define U2X2    1
+#define U2X3    1
+#define RXEN0   4
+#define TXEN0   3
+#define RXCIE0  7
+#define UDRIE0  5
+#define RXEN1   4
+#define TXEN1   3
+#define RXCIE1  7
+#define UDRIE1  5
+#define RXEN2   4
+#define TXEN2   3
+#define RXCIE2  7
+#define UDRIE2  5
+#define RXEN3   4
+#define TXEN3   3
+#define RXCIE3  7
+#define UDRIE3  5
+#define EERE    0
+#define EEPE    1
+#define EEMPE   2
+#define EERIE   3
+#define UPM01   5
+#define USBS0   3
+#define UPM11   5
+#define USBS1   3
+#define UPM21   5
+#define USBS2   3
+#define UPM31   5
+#define USBS3   3
+#define SOFE    2
+#define ISC60   0
+#define INT6    6
+#define INT2    2
+#define ISC20   4
+
+#define SS   53
+#define MOSI 51
+#define MISO 50
+#define SCK  52
+#define A0 54
+#define A1 55
+#define A2 56
+#define A3 57
+#define A4 58
+#define A5 59
+#define A6 60
+#define A7 61
+#define A8 62
+#define A9 63
+#define A10 64
+#define A11 65
+#define A12 66
+#define A13 67
+#define A14 68
+#define A15 69
+
+#endif /* HOST_IO_H_ */
@@ -0,0 +1,14 @@
+#ifndef HOST_PGMSPACE_H_
+#define HOST_PGMSPACE_H_
+// flash is plain memory on the host
+#include <stdint.h>
+#include <string.h>
+#define PROGMEM
+#define PGM_P const char *
+#define PSTR(s) (s)
+#define pgm_read_byte(p)  (*(const uint8_t *)(uintptr_t)(p))
+#define pgm_read_word(p)  (*(const uint16_t *)(uintptr_t)(p))
+#define pgm_read_dword(p) (*(const uint32_t *)(uintptr_t)(p))
+#define strlen_P strlen
+#define memcpy_P memcpy
+#endif /* HOST_PGMSPACE_H_ */
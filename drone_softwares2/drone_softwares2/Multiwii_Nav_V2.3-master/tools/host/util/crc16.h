@@ -0,0 +1,15 @@
+#ifndef HOST_CRC16_H_
+#define HOST_CRC16_H_
+// same results as the avr-libc versions
+#include <stdint.h>
+inline uint16_t _crc_xmodem_update(uint16_t crc, uint8_t data) {
+  crc ^= (uint16_t)data << 8;
+  for (uint8_t i = 0; i < 8; i++) crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+  return crc;
+}
+inline uint16_t _crc_ccitt_update(uint16_t crc, uint8_t data) {
+  data ^= crc & 0xFF;
+  data ^= data << 4;
+  return ((((uint16_t)data << 8) | (crc >> 8)) ^ (uint8_t)(data >> 4) ^ ((uint16_t)data << 3));
+}
+#endif /* HOST_CRC16_H_ */
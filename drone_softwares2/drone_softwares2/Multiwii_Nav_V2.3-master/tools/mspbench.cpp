@@ -0,0 +1,228 @@
+/*
+ * mspbench: host benchmark of the MSP reply path of the firmware: MultiWii.cpp, Serial.cpp and Protocol.cpp are
+ * built as they are, with the default config.h, on the host stand-ins of host/. A request is fed to port 0 through
+ * USART0_RX_vect, serialCom() decodes it and writes the reply, USART0_UDRE_vect sends it byte per byte.
+ *
+ *   g++ -O2 -Ihost -I../MultiWii -ffunction-sections -fdata-sections -Wl,--gc-sections -o mspbench mspbench.cpp
+ *   ./mspbench
+ *
+ * -I gives the firmware directory: to compare with an older tree, build a second binary on its MultiWii/, e.g.
+ *   mkdir base && git archive <commit>:<path of MultiWii> | tar -x -C base
+ *   g++ ... -Ibase -o mspbench_base mspbench.cpp
+ *
+ * Every reply is checked ($M>, size, command, checksum). Prints for some requests the reply size, the instructions
+ * run by serialCom() (request decoding and reply) and by the TX interrupt per byte sent, counted by single stepping
+ * (Linux ptrace), and the best of RUNS serialCom() calls in ns. The counts are deterministic and can be compared
+ * between two binaries, the times only roughly. Host numbers, not AVR cycle counts.
+ * Then checks that all the requests sent at once are answered over a link slower than the loop, and, with
+ * MSP_SET_STREAM, that a reply waits at most for the streamed frame being sent, not for the whole bulk queue.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/ptrace.h>
+#include <sys/wait.h>
+
+#define __AVR_ATmega2560__
+#include "Arduino.h"
+#include "config.h"
+#include "MultiWii.cpp"
+#include "Serial.cpp"
+#include "Protocol.cpp"
+
+#define RUNS 2000
+
+// the rest of the firmware, as far as Protocol.cpp refers to it: none of it is reached by the requests below
+uint8_t PWM_PIN[8];
+void writeParams(uint8_t) {}
+void LoadDefaults() {}
+void configurationLoop() {}
+void toggle_telemetry(uint8_t) {}
+
+static uint8_t reply[256];
+static int replyLen;
+
+static void receive(uint8_t c) {
+  UDR0 = c;
+  USART0_RX_vect();
+}
+
+static void request(uint8_t cmd, const uint8_t *payload = 0, uint8_t size = 0) {
+  uint8_t c = size ^ cmd;
+  receive('$'); receive('M'); receive('<'); receive(size); receive(cmd);
+  for (uint8_t i = 0; i < size; i++) {
+    receive(payload[i]);
+    c ^= payload[i];
+  }
+  receive(c);
+}
+
+// the UART takes up to n bytes (all of them if n < 0) as long as the interrupt is enabled, added to reply
+static int transmit(int n) {
+  int sent = 0;
+  while (n-- && (UCSR0B & (1 << UDRIE0))) {
+    uint32_t w = UDR0.written;
+    USART0_UDRE_vect();
+    if (UDR0.written != w) {
+      if (replyLen < (int)sizeof(reply)) reply[replyLen++] = UDR0;
+      sent++;
+    }
+  }
+  return sent;
+}
+
+static void drain() {
+  replyLen = 0;
+  transmit(-1);
+}
+
+// the reply to cmd at reply[*p], *p is moved after it
+static bool frameOK(int *p, uint8_t cmd) {
+  int len = replyLen - *p;
+  const uint8_t *r = reply + *p;
+  if (len < 6 || memcmp(r, "$M>", 3) || r[4] != cmd || len < r[3] + 6) return false;
+  uint8_t c = 0;
+  for (int i = 3; i < r[3] + 5; i++) c ^= r[i];
+  if (c != r[r[3] + 5]) return false;
+  *p += r[3] + 6;
+  return true;
+}
+
+static bool replyOK(uint8_t cmd) {
+  int p = 0;
+  return frameOK(&p, cmd) && p == replyLen;
+}
+
+// instructions of serialCom() and of the drain, the child stopping itself around each of them
+static void steps(uint8_t cmd, long *com, long *isr) {
+  long n[4] = {0, 0, 0, 0};
+  pid_t pid = fork();
+  if (pid == 0) {
+    ptrace(PTRACE_TRACEME, 0, 0, 0);
+    request(cmd);
+    raise(SIGSTOP);
+    raise(SIGSTOP);  // nothing in between: the cost of the stops themselves
+    serialCom();
+    raise(SIGSTOP);
+    drain();
+    raise(SIGSTOP);
+    _exit(0);
+  }
+  int status, seg = 0;
+  waitpid(pid, &status, 0);
+  while (1) {
+    if (ptrace(PTRACE_SINGLESTEP, pid, 0, 0) < 0) break;
+    waitpid(pid, &status, 0);
+    if (WIFEXITED(status) || WIFSIGNALED(status)) break;
+    if (WSTOPSIG(status) == SIGSTOP) {
+      if (++seg > 3) break;
+    } else {
+      n[seg]++;
+    }
+  }
+  *com = n[1] - n[0];
+  *isr = n[2] - n[0];
+}
+
+static double bench(uint8_t cmd) {
+  double best = 1e30;
+  for (int k = 0; k < RUNS; k++) {
+    request(cmd);
+    auto t0 = std::chrono::steady_clock::now();
+    serialCom();
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count();
+    drain();
+    if (ns < best) best = ns;
+  }
+  return best;
+}
+
+static const struct { const char *name; uint8_t cmd; } requests[] = {
+  {"MSP_ATTITUDE", MSP_ATTITUDE}, {"MSP_IDENT", MSP_IDENT}, {"MSP_STATUS", MSP_STATUS}, {"MSP_RAW_IMU", MSP_RAW_IMU},
+  {"MSP_RC", MSP_RC}, {"MSP_MOTOR", MSP_MOTOR}, {"MSP_PID", MSP_PID}, {"MSP_BOXNAMES", MSP_BOXNAMES},
+};
+#define REQUESTS (int)(sizeof(requests) / sizeof(requests[0]))
+
+// all the requests at once, one serialCom() per loop and LINK_BYTES sent between two loops (115200 baud, 2.8ms loop):
+// every reply must come, in order. Returns the loops it took, 0 if a reply is missing
+#define LINK_BYTES 32
+static int burst() {
+  int loops = 0, idle = 0, p = 0;
+  for (int r = 0; r < REQUESTS; r++) request(requests[r].cmd);
+  replyLen = 0;
+  while (idle < 3 && loops < 100) {
+    serialCom();
+    idle = transmit(LINK_BYTES) ? 0 : idle + 1;
+    loops++;
+  }
+  for (int r = 0; r < REQUESTS; r++)
+    if (!frameOK(&p, requests[r].cmd)) return 0;
+  return p == replyLen ? loops - idle : 0;
+}
+
+#if defined(MSP_SET_STREAM)
+// a reply queued while streamed frames wait in the bulk queue: returns the bytes sent before it, the bulk frame
+// which was being sent when it was queued and the size of that frame
+static int afterStreams(int *frame) {
+  static const uint8_t streams[][3] = {{MSP_RAW_IMU, 1, 0}, {MSP_RC, 1, 0}};
+  for (unsigned i = 0; i < sizeof(streams) / sizeof(streams[0]); i++) {
+    request(MSP_SET_STREAM, streams[i], 3);
+    serialCom();
+    drain();
+  }
+  hostMicros += 2000;  // both are due
+  serialCom();
+  replyLen = 0;
+  transmit(1);         // the first frame is being sent
+  request(MSP_ATTITUDE);
+  serialCom();
+  transmit(-1);
+  uint8_t stop[3] = {0, 0, 0};
+  request(MSP_SET_STREAM, stop, 3);
+  serialCom();
+  *frame = reply[3] + 6;
+  for (int p = 0; p + 5 < replyLen; p++)
+    if (!memcmp(reply + p, "$M>", 3) && reply[p + 4] == MSP_ATTITUDE) return p;
+  return -1;
+}
+#endif
+
+int main() {
+  int failures = 0;
+
+  printf("%-14s %5s %12s %12s %10s\n", "request", "reply", "serialCom()", "TX ISR/byte", "ns");
+  for (int r = 0; r < REQUESTS; r++) {
+    request(requests[r].cmd);
+    serialCom();
+    drain();
+    if (!replyOK(requests[r].cmd)) {
+      fprintf(stderr, "%s: bad reply (%d bytes)\n", requests[r].name, replyLen);
+      failures++;
+      continue;
+    }
+    int len = replyLen;
+    long com, isr;
+    steps(requests[r].cmd, &com, &isr);
+    printf("%-14s %5d %12ld %12.1f %10.1f\n", requests[r].name, len, com, (double)isr / (len + 1), bench(requests[r].cmd));
+  }
+
+  int loops = burst();
+  if (loops) {
+    printf("\nall at once: answered in %d loops at %d bytes per loop\n", loops, LINK_BYTES);
+  } else {
+    fprintf(stderr, "all at once: a reply is missing (%d bytes)\n", replyLen);
+    failures++;
+  }
+#if defined(MSP_SET_STREAM)
+  int frame, before = afterStreams(&frame);
+  if (before >= 0 && before <= frame) {
+    printf("reply queued behind streams: %d bytes sent before it, the %d byte frame being sent\n", before, frame);
+  } else {
+    fprintf(stderr, "reply queued behind streams: %d bytes sent before it, more than the %d byte frame being sent\n", before, frame);
+    failures++;
+  }
+#endif
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,355 @@
+/*
+ * nmeabench: host benchmark and check of the NMEA parser of MultiWii/GPS.cpp: GPS_NMEA_newFrame of the live GPS.cpp,
+ * built with a serial NMEA GPS on the host stand-ins of host/, against a copy of the baseline parser (GP talker,
+ * fields copied to a string and converted at the comma). Both are called directly, GPS_newFrame is the same
+ * wrapper around either.
+ *
+ *   g++ -O2 -Ihost -ffunction-sections -fdata-sections -Wl,--gc-sections -o nmeabench nmeabench.cpp
+ *   ./nmeabench [capture.nmea ...]
+ *
+ * Without a file, two captures are built in the layout of a u-blox M8 at its default NMEA output (RMC, VTG, GGA,
+ * GSA, GSV, GLL at 1Hz): "gn" with GPS + GLONASS (GN talker, two GSA, GPGSV and GLGSV), "gp" with GPS only (GP
+ * talker). They are synthetic: the values are known, the parsers must find the ones of the last GGA and RMC.
+ * A file is any raw NMEA log of a receiver (e.g. a serial capture), it is only parsed and timed.
+ * Prints the good GGA frames found by each parser, the best of 31 runs in bytes/us, and the instructions run per
+ * byte over the first STEP_BYTES bytes, counted by single stepping the parse loop (Linux ptrace, the loop itself
+ * included). The host has a branch predictor the AVR doesn't: a parser with more data dependent branches loses
+ * more time here than its instruction count says. Host numbers, not AVR cycle counts.
+ */
+#include <stdio.h>
+#include <ctype.h>
+#include <string>
+#include <chrono>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/ptrace.h>
+#include <sys/wait.h>
+
+#define __AVR_ATmega2560__
+#include "Arduino.h"
+#include "../MultiWii/config.h"
+#undef I2C_GPS
+#undef UBLOX
+#undef MTK_BINARY16
+#undef MTK_BINARY19
+#undef INIT_MTK_GPS
+#undef GPS_SERIAL
+#undef GPS_BAUD
+#define GPS_SERIAL 2
+#define GPS_BAUD   57600
+#define NMEA
+#include "../MultiWii/GPS.cpp"
+
+#define STEP_BYTES 16384
+
+// the rest of the firmware, as far as GPS_NMEA_newFrame uses it
+flags_struct_t f;
+int32_t  GPS_coord[2];
+int32_t  GPS_home[2];
+int32_t  GPS_hold[2];
+uint8_t  GPS_numSat;
+uint16_t GPS_distanceToHome;
+int16_t  GPS_directionToHome;
+uint16_t GPS_altitude;
+uint16_t GPS_speed;
+uint16_t GPS_ground_course;
+uint8_t  GPS_Present;
+uint16_t GPS_hdop;
+gps_conf_struct GPS_conf;
+
+/************ old: copy of the baseline GPS.cpp ************/
+namespace baseline {
+#define FRAME_GGA  1
+#define FRAME_RMC  2
+
+uint16_t grab_fields(char* src, uint8_t mult) {  // convert string to uint16
+  uint8_t i;
+  uint16_t tmp = 0;
+
+  for(i=0; src[i]!=0; i++) {
+    if(src[i] == '.') {
+      i++;
+      if(mult==0)   break;
+      else  src[i+mult] = 0;
+      }
+    tmp *= 10;
+    if(src[i] >='0' && src[i] <='9') tmp += src[i]-'0';
+    }
+  return tmp;
+  }
+
+uint8_t hex_c(uint8_t n) {    // convert '0'..'9','A'..'F' to 0..15
+  n -= '0';
+  if(n>9)  n -= 7;
+  n &= 0x0F;
+  return n;
+  }
+
+#define DIGIT_TO_VAL(_x)        (_x - '0')
+uint32_t GPS_coord_to_degrees(char* s) {
+  char *p, *q;
+  uint8_t deg = 0, min = 0;
+  unsigned int frac_min = 0;
+  uint8_t i;
+
+  // scan for decimal point or end of field
+  for (p = s; isdigit(*p); p++) ;
+  q = s;
+
+  // convert degrees
+  while ((p - q) > 2) {
+    if (deg)
+      deg *= 10;
+    deg += DIGIT_TO_VAL(*q++);
+    }
+  // convert minutes
+  while (p > q) {
+    if (min)
+      min *= 10;
+    min += DIGIT_TO_VAL(*q++);
+    }
+  // convert fractional minutes
+  // expect up to four digits, result is in
+  // ten-thousandths of a minute
+  if (*p == '.') {
+    q = p + 1;
+    for (i = 0; i < 4; i++) {
+      frac_min *= 10;
+      if (isdigit(*q))
+        frac_min += *q++ - '0';
+      }
+    }
+  return deg * 10000000UL + (min * 1000000UL + frac_min*100UL) / 6;
+  }
+
+bool old_NMEA_newFrame(char c) {
+  uint8_t frameOK = 0;
+  static uint8_t param = 0, offset = 0, parity = 0;
+  static char string[15];
+  static uint8_t checksum_param, frame = 0;
+
+  if (c == '$') {
+    param = 0; offset = 0; parity = 0;
+    } else if (c == ',' || c == '*') {
+      string[offset] = 0;
+      if (param == 0) { //frame identification
+        frame = 0;
+        if (string[0] == 'G' && string[1] == 'P' && string[2] == 'G' && string[3] == 'G' && string[4] == 'A') frame = FRAME_GGA;
+        if (string[0] == 'G' && string[1] == 'P' && string[2] == 'R' && string[3] == 'M' && string[4] == 'C') frame = FRAME_RMC;
+        } else if (frame == FRAME_GGA) {
+          if      (param == 2)                     {GPS_coord[LAT] = GPS_coord_to_degrees(string);}
+          else if (param == 3 && string[0] == 'S') GPS_coord[LAT] = -GPS_coord[LAT];
+          else if (param == 4)                     {GPS_coord[LON] = GPS_coord_to_degrees(string);}
+          else if (param == 5 && string[0] == 'W') GPS_coord[LON] = -GPS_coord[LON];
+          else if (param == 6)                     {f.GPS_FIX = (string[0]  > '0');}
+          else if (param == 7)                     {GPS_numSat = grab_fields(string,0);}
+          else if (param == 9)                     {GPS_altitude = grab_fields(string,0);}  // altitude in meters added by Mis
+        } else if (frame == FRAME_RMC) {
+          if      (param == 7)                     {GPS_speed = ((uint32_t)grab_fields(string,1)*5144L)/1000L;}  //gps speed in cm/s will be used for navigation
+          else if (param == 8)                     {GPS_ground_course = grab_fields(string,1); }                 //ground course deg*10
+          }
+        param++; offset = 0;
+        if (c == '*') checksum_param=1;
+        else parity ^= c;
+    } else if (c == '\r' || c == '\n') {
+      if (checksum_param) { //parity checksum
+        uint8_t checksum = hex_c(string[0]);
+        checksum <<= 4;
+        checksum += hex_c(string[1]);
+        if (checksum == parity) frameOK = 1;
+        }
+      checksum_param=0;
+      } else {
+        if (offset < 15) string[offset++] = c;
+        if (!checksum_param) parity ^= c;
+      }
+    if (frame) GPS_Present = 1;
+    return frameOK && (frame==FRAME_GGA);
+  }
+}
+
+/************ built in captures ************/
+struct expect {
+  int32_t lat, lon, latOld, lonOld;
+  uint16_t alt, speed, course, hdop;
+  uint8_t sats;
+};
+
+static void sentence(std::string &out, const char *body) {
+  uint8_t sum = 0;
+  char tail[8];
+  for (const char *p = body; *p; p++) sum ^= *p;
+  snprintf(tail, sizeof(tail), "*%02X\r\n", sum);
+  out += '$';
+  out += body;
+  out += tail;
+}
+
+// ddmm.mmmmm from degrees and 1e-5 minutes, with the expected values of both parsers
+static void coord(char *s, size_t len, int deg, int32_t min5, int degDigits, int32_t *exp, int32_t *expOld) {
+  snprintf(s, len, "%0*d%02d.%05d", degDigits, deg, min5 / 100000, min5 % 100000);
+  *exp = deg * 10000000L + min5 * 5 / 3;
+  *expOld = deg * 10000000L + ((min5 / 100000) * 1000000L + (min5 % 100000) / 10 * 100L) / 6;
+}
+
+// u-blox M8 default NMEA output, 1Hz; gn: GPS + GLONASS with the GN talker, otherwise GPS only with the GP talker
+static std::string buildCapture(bool gn, int epochs, expect *e) {
+  std::string out;
+  char b[160], lat[16], lon[16];
+  const char *t = gn ? "GN" : "GP";
+  int32_t lat5 = 17 * 100000 + 11437, lon5 = 33 * 100000 + 91522;
+  for (int i = 0; i < epochs; i++) {
+    int hh = 8 + i / 3600 % 16, mm = i / 60 % 60, ss = i % 60;
+    int32_t speed = 4 + (i * 37) % 25000;          // 1e-3 knots
+    int32_t course = (i * 913) % 36000;            // 1e-2 deg
+    int32_t alt = 4996 + (i * 7) % 300;            // 0.1 m
+    int32_t hdop = 80 + (i * 3) % 120;             // 1e-2
+    uint8_t sats = gn ? 12 + i % 8 : 7 + i % 5;
+    lat5 += 3 + i % 5;
+    lon5 += 5 + i % 3;
+    coord(lat, sizeof(lat), 47, lat5, 2, &e->lat, &e->latOld);
+    coord(lon, sizeof(lon), 8, lon5, 3, &e->lon, &e->lonOld);
+    e->speed = (uint32_t)(speed / 100) * 5144L / 1000L;
+    e->course = course / 10;
+    e->alt = alt / 10;
+    e->hdop = hdop;
+    e->sats = sats;
+
+    snprintf(b, sizeof(b), "%sRMC,%02d%02d%02d.00,A,%s,N,%s,E,%d.%03d,%d.%02d,091202,,,A", t, hh, mm, ss, lat, lon, speed / 1000, speed % 1000, course / 100, course % 100);
+    sentence(out, b);
+    snprintf(b, sizeof(b), "%sVTG,%d.%02d,T,,M,%d.%03d,N,%d.%03d,K,A", t, course / 100, course % 100, speed / 1000, speed % 1000, speed * 1852 / 1000000, speed * 1852 / 1000 % 1000);
+    sentence(out, b);
+    snprintf(b, sizeof(b), "%sGGA,%02d%02d%02d.00,%s,N,%s,E,1,%02d,%d.%02d,%d.%d,M,48.0,M,,", t, hh, mm, ss, lat, lon, sats, hdop / 100, hdop % 100, alt / 10, alt % 10);
+    sentence(out, b);
+    snprintf(b, sizeof(b), "%sGSA,A,3,23,29,07,08,09,18,26,28,,,,,1.94,%d.%02d,1.54", t, hdop / 100, hdop % 100);
+    sentence(out, b);
+    if (gn) {
+      snprintf(b, sizeof(b), "GNGSA,A,3,65,67,80,81,82,88,66,,,,,,1.94,%d.%02d,1.54", hdop / 100, hdop % 100);
+      sentence(out, b);
+    }
+    sentence(out, "GPGSV,3,1,10,23,38,230,44,29,71,156,47,07,29,116,41,08,09,081,36");
+    sentence(out, "GPGSV,3,2,10,10,07,189,,05,05,220,,09,34,274,42,18,25,309,44");
+    sentence(out, "GPGSV,3,3,10,26,82,187,47,28,43,056,46");
+    if (gn) {
+      sentence(out, "GLGSV,3,1,09,65,52,021,41,66,22,085,37,67,15,141,33,80,47,323,43");
+      sentence(out, "GLGSV,3,2,09,81,66,253,45,82,19,302,39,88,36,062,42,72,02,024,");
+      sentence(out, "GLGSV,3,3,09,87,08,349,");
+    }
+    snprintf(b, sizeof(b), "%sGLL,%s,N,%s,E,%02d%02d%02d.00,A,A", t, lat, lon, hh, mm, ss);
+    sentence(out, b);
+  }
+  return out;
+}
+
+/************ bench ************/
+typedef bool (*parser_f)(char);
+
+static void resetGPS() {
+  memset(&f, 0, sizeof(f));
+  GPS_coord[LAT] = GPS_coord[LON] = 0;
+  GPS_numSat = GPS_Present = 0;
+  GPS_altitude = GPS_speed = GPS_ground_course = GPS_hdop = 0;
+}
+
+static long parse(parser_f p, const std::string &d) {
+  long frames = 0;
+  for (size_t i = 0; i < d.size(); i++) frames += p(d[i]);
+  return frames;
+}
+
+// best of 31 runs in bytes/us, the two parsers taking turns so that they see the same host noise
+static void bench(const std::string &d, double *oldRate, double *newRate) {
+  parser_f p[2] = {baseline::old_NMEA_newFrame, GPS_NMEA_newFrame};
+  double best[2] = {1e30, 1e30};
+  for (int k = 0; k < 62; k++) {
+    auto t0 = std::chrono::steady_clock::now();
+    long frames = parse(p[k & 1], d);
+    __asm__ volatile("" : : "r"(frames) : "memory");
+    double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - t0).count();
+    if (us < best[k & 1]) best[k & 1] = us;
+  }
+  *oldRate = d.size() / best[0];
+  *newRate = d.size() / best[1];
+}
+
+// instructions per byte, the parser run in a child stepped one instruction at a time
+static double steps(parser_f p, const std::string &d) {
+  std::string part = d.substr(0, STEP_BYTES);
+  pid_t pid = fork();
+  if (pid == 0) {
+    ptrace(PTRACE_TRACEME, 0, 0, 0);
+    raise(SIGSTOP);
+    long frames = parse(p, part);
+    _exit(frames & 1);
+  }
+  int status;
+  long n = 0;
+  waitpid(pid, &status, 0);
+  while (!WIFEXITED(status) && !WIFSIGNALED(status)) {
+    if (ptrace(PTRACE_SINGLESTEP, pid, 0, 0) < 0) return 0;
+    waitpid(pid, &status, 0);
+    n++;
+  }
+  return (double)n / part.size();
+}
+
+static int failures;
+#define CHECK(c)                                                            \
+  do {                                                                      \
+    if (!(c)) {                                                             \
+      fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #c); \
+      failures++;                                                           \
+    }                                                                       \
+  } while (0)
+
+static void run(const char *name, const std::string &d, const expect *e, bool oldDecodes) {
+  long oldFrames, newFrames;
+  resetGPS();
+  oldFrames = parse(baseline::old_NMEA_newFrame, d);
+  if (e && oldDecodes) {
+    CHECK(abs(GPS_coord[LAT] - e->latOld) <= 1 && abs(GPS_coord[LON] - e->lonOld) <= 1);
+    CHECK(f.GPS_FIX && GPS_numSat == e->sats && GPS_altitude == e->alt);
+    CHECK(GPS_speed == e->speed && GPS_ground_course == e->course);
+  }
+  resetGPS();
+  newFrames = parse(GPS_NMEA_newFrame, d);
+  if (e) {
+    CHECK(GPS_coord[LAT] == e->lat && GPS_coord[LON] == e->lon);
+    CHECK(f.GPS_FIX && GPS_numSat == e->sats && GPS_altitude == e->alt && GPS_hdop == e->hdop);
+    CHECK(GPS_speed == e->speed && GPS_ground_course == e->course);
+  }
+  double oldRate, newRate;
+  bench(d, &oldRate, &newRate);
+  printf("%-16s %9zu %8ld %8ld %10.1f %10.1f %9.2f %9.2f\n", name, d.size(), oldFrames, newFrames, oldRate, newRate,
+         steps(baseline::old_NMEA_newFrame, d), steps(GPS_NMEA_newFrame, d));
+}
+
+int main(int argc, char **argv) {
+  printf("%-16s %9s %8s %8s %10s %10s %9s %9s\n", "capture", "bytes", "old GGA", "new GGA", "old B/us", "new B/us",
+         "old ins/B", "new ins/B");
+  if (argc > 1) {
+    for (int i = 1; i < argc; i++) {
+      FILE *fp = fopen(argv[i], "rb");
+      if (!fp) {
+        perror(argv[i]);
+        return 1;
+      }
+      std::string d;
+      char buf[4096];
+      size_t n;
+      while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) d.append(buf, n);
+      fclose(fp);
+      run(argv[i], d, NULL, false);
+    }
+    return 0;
+  }
+  expect egn, egp;
+  std::string gn = buildCapture(true, 3600, &egn), gp = buildCapture(false, 3600, &egp);
+  run("gn (built in)", gn, &egn, false);
+  run("gp (built in)", gp, &egp, true);
+  if (failures) {
+    fprintf(stderr, "%d check(s) failed\n", failures);
+    return 1;
+  }
+  return 0;
+}
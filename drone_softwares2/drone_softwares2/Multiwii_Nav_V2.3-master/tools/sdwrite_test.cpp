@@ -0,0 +1,553 @@
+/*
+ * sdwrite_test: host test of the SD card code of MultiWii/SDcard.cpp: init_SD() and the blackbox (allocation of
+ * the file, blackboxStart/blackboxLog/blackboxStop, slower clock after a write error) are built as they are, with
+ * the volume and file code of SdFat, on the host stand-ins of host/. Only the SPI layer (SdFat/Sd2Card.cpp) is
+ * replaced: the Sd2Card functions below keep the card in RAM, a FAT16 volume formatted by the test.
+ *
+ *   g++ -O2 -Wall -Wextra -Ihost -I../MultiWii -I../MultiWii/SdFat -ffunction-sections -fdata-sections \
+ *       -Wl,--gc-sections -o sdwrite_test sdwrite_test.cpp
+ *   ./sdwrite_test
+ *
+ * The card accepts a given fastest clock: faster, its blocks can't be read or written (a bad transfer). It can be
+ * told to reject the data of one block, and to stay busy for a number of isBusy() polls after each block of a
+ * multiple block write. The logs written are read back through the FAT and decoded with bblog.h. The FAT can be
+ * filled before the boot, to check how much of it one loop reads while the file is allocated.
+ * This checks the behaviour, not the speed: nothing here is a model of the time a card takes.
+ * The exit code is 0 when all the checks pass.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "bblog.h"
+
+#define __AVR_ATmega2560__
+#include "Arduino.h"
+#include "config.h"
+#define MWI_SDCARD
+#define CSPIN 53
+#define LOG_BLACKBOX 1
+#define LOG_BLACKBOX_BLOCKS 256UL
+#define LOG_PERMANENT
+
+// SdStream.h doesn't build for a 64 bit host: the text logs of SDcard.cpp write nothing here
+#define SdStream_h
+#define ArduinoStream_h
+#include "SdBaseFile.h"
+struct ofstream {
+  void open(const char *, uint8_t) {}
+  template <class T> ofstream &operator<<(T) { return *this; }
+  void flush() {}
+  void close() {}
+};
+struct ifstream {
+  explicit ifstream(const char *) {}
+  int get() { return -1; }
+};
+inline ofstream &endl(ofstream &s) { return s; }
+struct HostSerial : Print {
+  size_t write(uint8_t) { return 1; }
+} Serial;
+
+#include "SdVolume.cpp"
+#include "SdBaseFile.cpp"
+#include "SdFile.cpp"
+#include "SdFat.cpp"
+#include "SDcard.cpp"
+
+// the rest of the firmware, as far as SDcard.cpp uses it here
+flags_struct_t f;
+int16_t debug[4];
+uint32_t currentTime;
+uint16_t cycleTime;
+imu_t imu;
+alt_t alt;
+att_t att;
+plog_t plog;
+int16_t axisPID[3];
+int16_t motor[8];
+int16_t rcCommand[4];
+
+#define VOLUME_BLOCKS 32768     // 16MB, FAT16 with 2KB clusters
+#define DATA_START 97            // boot block, 2 FATs of 32 blocks, root directory of 32 blocks
+#define NONE 0xFFFFFFFF
+
+/************ the card ************/
+static struct {
+  std::vector<uint8_t> mem;
+  uint8_t present;
+  uint8_t maxRate;        // fastest clock (lowest id) the card and the wiring accept
+  uint8_t rate;           // clock set by init or setSckRate
+  uint32_t rejectAt;      // block whose data is rejected once
+  uint8_t busyPolls;      // isBusy() polls answered busy after each block of a multiple block write
+  uint8_t busy;
+  bool streaming;         // in a multiple block write
+  bool reading;           // in a multiple block read
+  uint32_t next;          // next block of either
+  uint32_t waits;         // writeData() while busy: the caller waits for the card
+  uint32_t lowest, highest;  // blocks written by the multiple block writes
+  uint32_t transfers;     // blocks read or written one by one (FAT, directory)
+} card;
+
+bool Sd2Card::init(uint8_t sckRateID, uint8_t chipSelectPin) {  // the clock only matters for the transfers after
+  chipSelectPin_ = chipSelectPin;
+  spiRate_ = card.rate = sckRateID;
+  type_ = SD_CARD_TYPE_SD2;
+  card.streaming = card.reading = false;
+  card.busy = 0;
+  if (!card.present) {
+    error(SD_CARD_ERROR_CMD0);
+    return false;
+  }
+  return true;
+}
+
+bool Sd2Card::setSckRate(uint8_t sckRateID) {
+  spiRate_ = card.rate = sckRateID;
+  return true;
+}
+
+bool Sd2Card::isBusy() {
+  if (card.busy == 0) return false;
+  card.busy--;
+  return true;
+}
+
+bool Sd2Card::readBlock(uint32_t block, uint8_t *dst) {
+  if (card.streaming || spiRate_ < card.maxRate || block >= VOLUME_BLOCKS) {
+    error(SD_CARD_ERROR_READ);
+    return false;
+  }
+  memcpy(dst, &card.mem[block * 512], 512);
+  card.transfers++;
+  return true;
+}
+
+bool Sd2Card::readStart(uint32_t block) {
+  if (card.streaming || spiRate_ < card.maxRate) {
+    error(SD_CARD_ERROR_READ);
+    return false;
+  }
+  card.reading = true;
+  card.next = block;
+  return true;
+}
+
+bool Sd2Card::readData(uint8_t *dst) {
+  if (!card.reading || !readBlock(card.next, dst)) return false;
+  card.next++;
+  return true;
+}
+
+bool Sd2Card::readStop() {
+  card.reading = false;
+  return true;
+}
+
+bool Sd2Card::writeBlock(uint32_t block, const uint8_t *src) {
+  if (card.streaming || spiRate_ < card.maxRate || block >= VOLUME_BLOCKS) {
+    error(SD_CARD_ERROR_CMD24);
+    return false;
+  }
+  memcpy(&card.mem[block * 512], src, 512);
+  card.transfers++;
+  return true;
+}
+
+bool Sd2Card::writeStart(uint32_t block, uint32_t eraseCount) {
+  if (card.streaming || card.reading || block + eraseCount > VOLUME_BLOCKS) {
+    error(SD_CARD_ERROR_CMD25);
+    return false;
+  }
+  card.streaming = true;
+  card.next = block;
+  return true;
+}
+
+bool Sd2Card::writeData(const uint8_t *src) {
+  if (!card.streaming || card.next >= VOLUME_BLOCKS) {
+    error(SD_CARD_ERROR_WRITE_MULTIPLE);
+    return false;
+  }
+  if (card.busy) {
+    card.waits++;
+    card.busy = 0;
+  }
+  if (spiRate_ < card.maxRate || card.next == card.rejectAt) {  // data response: rejected
+    card.rejectAt = NONE;
+    error(SD_CARD_ERROR_WRITE_MULTIPLE);
+    return false;
+  }
+  memcpy(&card.mem[card.next * 512], src, 512);
+  if (card.next < card.lowest) card.lowest = card.next;
+  if (card.next > card.highest) card.highest = card.next;
+  card.next++;
+  card.busy = card.busyPolls;
+  return true;
+}
+
+bool Sd2Card::writeStop() {
+  if (!card.streaming) {
+    error(SD_CARD_ERROR_STOP_TRAN);
+    return false;
+  }
+  card.streaming = false;
+  card.busy = 0;
+  return true;
+}
+
+// an empty FAT16 volume without partition table, as SdVolume::init() reads it; the card accepts any clock
+static void format() {
+  card.mem.assign((size_t)VOLUME_BLOCKS * 512, 0);
+  fat_boot_t *b = (fat_boot_t *)&card.mem[0];
+  b->jump[0] = 0xEB;
+  b->bytesPerSector = 512;
+  b->sectorsPerCluster = 4;
+  b->reservedSectorCount = 1;
+  b->fatCount = 2;
+  b->rootDirEntryCount = 512;
+  b->totalSectors16 = 0;
+  b->totalSectors32 = VOLUME_BLOCKS;
+  b->mediaType = 0xF8;
+  b->sectorsPerFat16 = 32;   // 8192 entries for the (32768 - 97) / 4 clusters
+  b->bootSectorSig0 = 0x55;
+  b->bootSectorSig1 = 0xAA;
+  for (int i = 0; i < 2; i++) {
+    uint8_t *fat = &card.mem[(1 + i * 32) * 512];
+    fat[0] = 0xF8; fat[1] = 0xFF; fat[2] = 0xFF; fat[3] = 0xFF;
+  }
+  card.present = 1;
+  card.maxRate = SPI_FULL_SPEED;
+  card.rejectAt = NONE;
+  card.busyPolls = 0;
+  card.busy = 0;
+  card.streaming = card.reading = false;
+}
+
+// clusters first..last used by some file, in both FATs
+static void useClusters(uint32_t first, uint32_t last) {
+  for (int i = 0; i < 2; i++)
+    for (uint32_t c = first; c <= last; c++) {
+      uint8_t *e = &card.mem[(1 + i * 32) * 512 + c * 2];
+      e[0] = e[1] = 0xFF;
+    }
+}
+
+// the cluster of a block of the volume
+static uint32_t clusterOf(uint32_t block) { return (block - DATA_START) / 4 + 2; }
+
+/************ the firmware ************/
+// power on with the card in: SDcard.cpp starts again from its initial state
+static void boot() {
+  bbFile = SdFile();
+  bbState = BB_IDLE;
+  bbAlloc = BB_ALLOC_SCAN;
+  bbScanPos = 0;
+  bbNext = 0;
+  bbAllocFat = FatAlloc_t();
+  bbWriting = 0;
+  f.ARMED = 0;
+  init_SD();
+}
+
+// blackboxLog() while disarmed until the file is allocated, returns the loops it took or -1
+static int allocate() {
+  for (int n = 1; n <= 1000; n++) {
+    blackboxLog();
+    if (bbState == BB_READY) return n;
+    if (bbAlloc == BB_ALLOC_NONE) return -1;
+  }
+  return -1;
+}
+
+// the values of the loop i, in the order of the fields: small and large changes, negative values
+static void loopValues(uint32_t i, std::vector<uint32_t> &v) {
+  uint8_t k;
+  currentTime = 1000000 + i * 2800 + (i * 7919) % 97;
+  for (k = 0; k < 3; k++) imu.gyroData[k] = (int16_t)((i * (37 + 11 * k)) % 2001) - 1000;
+  for (k = 0; k < 3; k++) imu.accSmooth[k] = (int16_t)(k == 2 ? 512 : 0) + (int16_t)(i % 9) - 4;
+  for (k = 0; k < 4; k++) rcCommand[k] = (int16_t)(k == 3 ? 1000 + i % 1000 : (int)(i % 500) - 250);
+  for (k = 0; k < 3; k++) axisPID[k] = (int16_t)((i * 97 + k * 1000) % 801) - 400;
+  for (k = 0; k < 8; k++) motor[k] = 1100 + (i * (k + 1)) % 800;
+  att.angle[ROLL] = (int16_t)(i % 1800) - 900;
+  att.angle[PITCH] = -att.angle[ROLL] / 2;
+  att.heading = (int16_t)(i / 10 % 360) - 180;
+  alt.EstAlt = (int32_t)(i * 3) - 100000;
+  v.clear();
+  v.push_back(currentTime);
+  for (k = 0; k < 3; k++) v.push_back(imu.gyroData[k]);
+  for (k = 0; k < 3; k++) v.push_back(imu.accSmooth[k]);
+  for (k = 0; k < 4; k++) v.push_back(rcCommand[k]);
+  for (k = 0; k < 3; k++) v.push_back(axisPID[k]);
+  for (k = 0; k < NUMBER_MOTOR; k++) v.push_back(motor[k]);
+  v.push_back(att.angle[ROLL]);
+  v.push_back(att.angle[PITCH]);
+  v.push_back(att.heading);
+  v.push_back(alt.EstAlt);
+}
+
+struct Flight {
+  std::vector<std::vector<uint32_t> > frames;  // the frames blackboxLog() kept
+  uint32_t waits;                              // writeData() on a busy card, in the loops
+};
+
+// arms, logs 'loops' loops (or until the log stops) and disarms
+static Flight fly(uint32_t loops) {
+  Flight fl;
+  std::vector<uint32_t> v;
+  f.ARMED = 1;
+  cycleTime = 2800;
+  blackboxStart();
+  uint32_t waits = card.waits;
+  for (uint32_t i = 0; i < loops && bbState == BB_LOGGING; i++) {
+    loopValues(i, v);
+    uint16_t dropped = blackboxDropped;
+    blackboxLog();
+    if (blackboxDropped == dropped) fl.frames.push_back(v);
+  }
+  fl.waits = card.waits - waits;
+  f.ARMED = 0;
+  blackboxStop();
+  return fl;
+}
+
+static bool readFile(const char *name, std::vector<uint8_t> &data) {
+  SdFile file;
+  if (!file.open(name, O_READ)) return false;
+  data.resize(file.fileSize());
+  bool ok = true;
+  for (size_t pos = 0; ok && pos < data.size(); pos += 8192) {  // the AVR size_t: SdFat reads up to 255 blocks at once
+    int n = (int)min(data.size() - pos, (size_t)8192);
+    ok = file.read(&data[pos], n) == n;
+  }
+  file.close();
+  return ok;
+}
+
+static bool contiguous(const char *name, uint32_t *first, uint32_t *last) {
+  SdFile file;
+  if (!file.open(name, O_READ)) return false;
+  bool ok = file.contiguousRange(first, last);
+  file.close();
+  return ok;
+}
+
+// decodes the log, returns false if it is not a log or has a bad frame: only the last one may be cut by the end
+// of the file, when the log stopped in the middle of a flight
+static bool decode(const std::vector<uint8_t> &data, bblog::Header &h, std::vector<std::vector<uint32_t> > &frames) {
+  std::string err;
+  if (data.empty() || !bblog::parseHeader(&data[0], data.size(), h, err)) return false;
+  bblog::Decoder dec(h);
+  std::vector<uint32_t> v(h.names.size());
+  const uint8_t *p = &data[0] + h.dataStart, *end = &data[0] + data.size();
+  while (1) {
+    bblog::Decoder::Result r = dec.next(p, end, &v[0]);
+    if (r == bblog::Decoder::END) return true;
+    if (r == bblog::Decoder::BAD) return end - p < BB_FRAME_MAX && (*p == 'I' || *p == 'P');
+    frames.push_back(v);
+  }
+}
+
+// the decoded frames are the first ones logged: all of them when 'all'
+static bool sameFrames(const std::vector<std::vector<uint32_t> > &decoded, const Flight &fl, bool all) {
+  if (decoded.size() > fl.frames.size() || (all && decoded.size() != fl.frames.size())) return false;
+  for (size_t i = 0; i < decoded.size(); i++)
+    if (decoded[i] != fl.frames[i]) return false;
+  return true;
+}
+
+/************ tests ************/
+static int failures;
+#define CHECK(c)                                                     \
+  do {                                                               \
+    if (!(c)) {                                                      \
+      fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #c); \
+      failures++;                                                    \
+    }                                                                \
+  } while (0)
+
+static void testInitFallback() {
+  for (uint8_t i = 0; i < sizeof(sdSpiRates); i++) {
+    format();
+    card.maxRate = sdSpiRates[i];
+    boot();
+    CHECK(f.SDCARD == 1 && debug[1] == 0);
+    CHECK(sdSpiRate == i && card.rate == sdSpiRates[i]);  // the fastest clock the card accepts
+  }
+  format();
+  card.maxRate = SPI_EIGHTH_SPEED;  // too slow for any of them
+  boot();
+  CHECK(f.SDCARD == 0 && debug[1] == 999);
+  format();
+  card.present = 0;
+  boot();
+  CHECK(f.SDCARD == 0 && debug[1] == 999);
+  CHECK(allocate() == -1 && bbState == BB_IDLE);  // nothing without a card
+}
+
+static void testAllocation() {
+  format();
+  boot();
+  SdFile other;
+  const char *names[] = {"BB003.BIN", "NOTES.TXT", "BB007.BIN", "BBX12.BIN", "BB0071.BIN"};
+  for (unsigned i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+    CHECK(other.open(names[i], O_WRITE | O_CREAT));
+    other.close();
+  }
+  f.ARMED = 1;
+  blackboxLog();
+  CHECK(bbAlloc == BB_ALLOC_SCAN && bbScanPos == 0);  // not while armed
+  f.ARMED = 0;
+  int loops = allocate();
+  printf("allocation: %d loops for 5 directory entries\n", loops);
+  CHECK(loops > 0);
+  uint32_t first, last;
+  std::vector<uint8_t> data;
+  CHECK(readFile("BB008.BIN", data) && data.size() == LOG_BLACKBOX_BLOCKS * BB_BLOCK_SIZE);  // after the highest one
+  CHECK(contiguous("BB008.BIN", &first, &last) && first == bbFirst && last == bbEnd);
+  CHECK(bbEnd - bbFirst + 1 == LOG_BLACKBOX_BLOCKS);
+}
+
+// most of the FAT used: the file is found a few FAT blocks per loop, not in one of them
+static void testFragmentedFat() {
+  format();
+  for (uint32_t c = 2; c < 4000; c += 100) useClusters(c, c + 89);  // 10 free clusters out of 100: too short, free from 3992
+  boot();
+  int loops = 0;
+  uint32_t most = 0;
+  while (bbState == BB_IDLE && bbAlloc != BB_ALLOC_NONE && loops < 1000) {
+    uint32_t t = card.transfers;
+    blackboxLog();
+    if (card.transfers - t > most) most = card.transfers - t;
+    loops++;
+  }
+  CHECK(bbState == BB_READY);
+  CHECK(most <= 6);  // the 16 FAT blocks of the used part are never read in the same loop
+  uint32_t first, last;
+  CHECK(contiguous("BB000.BIN", &first, &last) && clusterOf(first) == 3992 && last - first + 1 == LOG_BLACKBOX_BLOCKS);
+  printf("fragmented FAT: %d loops, at most %u block transfers per loop\n", loops, most);
+}
+
+// another file takes a cluster of the free group while it is being linked: the file is found after it
+static void testTakenWhileLinking() {
+  format();
+  useClusters(2, 429);  // the group 430..493 is found 20 clusters before the end of the second step
+  boot();
+  bool linking = false;
+  for (int n = 0; n < 1000 && bbState == BB_IDLE && !linking; n++) {
+    blackboxLog();
+    linking = bbAllocFat.linking;
+  }
+  CHECK(linking && bbState == BB_IDLE);
+  SdFile other;
+  CHECK(other.open("OTHER.TXT", O_WRITE | O_CREAT) && other.write('x') == 1);
+  other.close();
+  CHECK(allocate() > 0);
+  uint32_t first, last, otherFirst, otherLast;
+  CHECK(contiguous("OTHER.TXT", &otherFirst, &otherLast) && clusterOf(otherFirst) == 430);
+  CHECK(contiguous("BB000.BIN", &first, &last) && first == bbFirst && clusterOf(first) == 431);
+  CHECK(last - first + 1 == LOG_BLACKBOX_BLOCKS);
+  CHECK(sd.vol()->freeClusterCount() == (int32_t)(sd.vol()->clusterCount() - 428 - 1 - 64));  // nothing left linked
+}
+
+static void testFlight() {
+  format();
+  boot();
+  CHECK(allocate() > 0);
+  uint32_t first = bbFirst;
+  card.busyPolls = 2;   // busy for the next two loops after each block
+  card.lowest = NONE;
+  card.highest = 0;
+  Flight fl = fly(1500);
+  CHECK(bbState == BB_IDLE && blackboxDropped == 0);
+  CHECK(fl.waits == 0);  // the loop never waited for the card
+  CHECK(card.lowest == first && card.highest < first + LOG_BLACKBOX_BLOCKS);
+
+  std::vector<uint8_t> data;
+  bblog::Header h;
+  std::vector<std::vector<uint32_t> > frames;
+  CHECK(readFile("BB000.BIN", data) && data.size() == (card.highest - first + 1) * BB_BLOCK_SIZE);  // trimmed
+  CHECK(decode(data, h, frames));
+  CHECK(h.names.size() == BB_FIELDS && h.divisor == LOG_BLACKBOX && h.intraInterval == LOG_BLACKBOX_INTRA);
+  CHECK(h.cycleTime == 2800 && h.names[0] == "time");
+  CHECK(sameFrames(frames, fl, true));
+  printf("flight: %u frames in %u blocks\n", (unsigned)frames.size(), (unsigned)(data.size() / BB_BLOCK_SIZE));
+
+  CHECK(allocate() > 0);  // the next flight gets the next file
+  std::vector<uint8_t> next;
+  CHECK(readFile("BB001.BIN", next) && next.size() == LOG_BLACKBOX_BLOCKS * BB_BLOCK_SIZE);
+}
+
+static void testBusyCard() {
+  format();
+  boot();
+  CHECK(allocate() > 0);
+  card.busyPolls = 40;  // slower than the log: both blocks fill up
+  Flight fl = fly(1500);
+  CHECK(blackboxDropped > 0 && fl.waits == 0);
+  std::vector<uint8_t> data;
+  bblog::Header h;
+  std::vector<std::vector<uint32_t> > frames;
+  CHECK(readFile("BB000.BIN", data) && decode(data, h, frames));
+  CHECK(sameFrames(frames, fl, true));  // an 'I' frame after each drop: the following ones decode right
+  printf("busy card: %u frames kept, %u dropped\n", (unsigned)frames.size(), blackboxDropped);
+}
+
+static void testRejectedWrite() {
+  format();
+  boot();
+  CHECK(allocate() > 0);
+  card.rejectAt = bbFirst + 20;
+  Flight fl = fly(1500);
+  CHECK(bbState == BB_IDLE && sdSpiRate == 1 && card.rate == SPI_HALF_SPEED);  // the next flight uses the slower clock
+  std::vector<uint8_t> data;
+  bblog::Header h;
+  std::vector<std::vector<uint32_t> > frames;
+  CHECK(readFile("BB000.BIN", data) && data.size() == 20 * BB_BLOCK_SIZE);  // up to the rejected block
+  CHECK(decode(data, h, frames) && !frames.empty() && sameFrames(frames, fl, false));
+
+  CHECK(allocate() > 0);
+  fl = fly(500);
+  CHECK(readFile("BB001.BIN", data) && decode(data, h, frames = std::vector<std::vector<uint32_t> >()));
+  CHECK(sameFrames(frames, fl, true) && sdSpiRate == 1);
+
+  for (int i = 0; i < 3; i++) {  // the header block rejected: nothing logged, never below the slowest clock
+    CHECK(allocate() > 0);
+    card.rejectAt = bbFirst;
+    fly(10);
+  }
+  CHECK(sdSpiRate == sizeof(sdSpiRates) - 1 && card.rate == SPI_QUARTER_SPEED);
+  CHECK(readFile("BB004.BIN", data) && data.empty());
+}
+
+static void testFileFull() {
+  format();
+  boot();
+  CHECK(allocate() > 0);
+  Flight fl = fly(100000);
+  CHECK(bbBlock == bbEnd + 1 && sdSpiRate == 0);
+  std::vector<uint8_t> data;
+  bblog::Header h;
+  std::vector<std::vector<uint32_t> > frames;
+  CHECK(readFile("BB000.BIN", data) && data.size() == LOG_BLACKBOX_BLOCKS * BB_BLOCK_SIZE);
+  CHECK(decode(data, h, frames) && sameFrames(frames, fl, false));
+  CHECK(fl.frames.size() - frames.size() < 2 * BB_BLOCK_SIZE / 10);  // only what was in RAM is lost
+  printf("full file: %u frames in %lu blocks\n", (unsigned)frames.size(), LOG_BLACKBOX_BLOCKS);
+}
+
+int main() {
+  testInitFallback();
+  testAllocation();
+  testFragmentedFat();
+  testTakenWhileLinking();
+  testFlight();
+  testBusyCard();
+  testRejectedWrite();
+  testFileFull();
+  if (failures) {
+    fprintf(stderr, "%d check(s) failed\n", failures);
+    return 1;
+  }
+  printf("all checks passed\n");
+  return 0;
+}
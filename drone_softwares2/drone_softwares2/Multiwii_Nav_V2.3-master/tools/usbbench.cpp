@@ -0,0 +1,144 @@
+/*
+ * usbbench: host count of the USB CDC calls of the MSP replies on a 32u4 board (PROMICRO): MultiWii.cpp,
+ * Serial.cpp and Protocol.cpp are built as they are, with the default config.h and __AVR_ATmega32U4__, on the
+ * host stand-ins of host/. The USB core functions are defined here: a request is read from USB_Recv(), the reply
+ * is collected from USB_Send().
+ *
+ *   g++ -O2 -Ihost -I../MultiWii -ffunction-sections -fdata-sections -Wl,--gc-sections -o usbbench usbbench.cpp
+ *   ./usbbench
+ *
+ * -I gives the firmware directory, as for mspbench.cpp: build a second binary on an older MultiWii/ to compare.
+ *
+ * Every reply is checked. Prints for some requests, and for all of them sent at once, the reply size, the loops
+ * (serialCom() calls) it took to answer, the USB_Send() and USB_Flush() calls and the instructions of the firmware
+ * in those serialCom() and in the idle one after, counted by single stepping (Linux ptrace). On the 32u4 each USB_Send() also costs the core its endpoint lock and ready wait, and
+ * each USB_Flush() of a partly filled bank sends a short packet: those are not in the counts, which are host
+ * numbers, not AVR cycles. Nothing here is timed on a board.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/ptrace.h>
+#include <sys/wait.h>
+
+#define __AVR_ATmega32U4__
+#include "Arduino.h"
+#include "config.h"
+#include "MultiWii.cpp"
+#include "Serial.cpp"
+#include "Protocol.cpp"
+
+// the rest of the firmware, as far as Protocol.cpp refers to it: none of it is reached by the requests below
+uint8_t PWM_PIN[8];
+void writeParams(uint8_t) {}
+void LoadDefaults() {}
+void configurationLoop() {}
+void toggle_telemetry(uint8_t) {}
+
+// the USB core
+static uint8_t rx[256];
+static int rxHead, rxTail;
+static uint8_t reply[1024];
+static int replyLen, sends, flushes;
+
+int USB_Send(uint8_t, const void *data, int len) {
+  if (replyLen + len <= (int)sizeof(reply)) memcpy(reply + replyLen, data, len);
+  replyLen += len;
+  sends++;
+  return len;
+}
+int USB_Recv(uint8_t) { return rxTail < rxHead ? rx[rxTail++] : -1; }
+uint8_t USB_Available(uint8_t) { return rxHead - rxTail; }
+void USB_Flush(uint8_t) { flushes++; }
+
+static const struct { const char *name; uint8_t cmd; } requests[] = {
+  {"MSP_ATTITUDE", MSP_ATTITUDE}, {"MSP_IDENT", MSP_IDENT}, {"MSP_STATUS", MSP_STATUS}, {"MSP_RAW_IMU", MSP_RAW_IMU},
+  {"MSP_RC", MSP_RC}, {"MSP_MOTOR", MSP_MOTOR}, {"MSP_PID", MSP_PID}, {"MSP_BOXNAMES", MSP_BOXNAMES},
+};
+#define REQUESTS (int)(sizeof(requests) / sizeof(requests[0]))
+
+// the requests first..last-1, read by the next serialCom()
+static void request(int first, int last) {
+  rxHead = rxTail = 0;
+  replyLen = sends = flushes = 0;
+  for (int r = first; r < last; r++) {
+    uint8_t frame[6] = {'$', 'M', '<', 0, requests[r].cmd, requests[r].cmd};
+    memcpy(rx + rxHead, frame, sizeof(frame));
+    rxHead += sizeof(frame);
+  }
+}
+
+// the replies to the requests first..last-1, one after the other
+static bool repliesOK(int first, int last) {
+  int p = 0;
+  for (int r = first; r < last; r++) {
+    if (replyLen - p < 6 || memcmp(reply + p, "$M>", 3) || reply[p + 4] != requests[r].cmd) return false;
+    int len = reply[p + 3] + 6;
+    if (replyLen - p < len) return false;
+    uint8_t c = 0;
+    for (int i = p + 3; i < p + len - 1; i++) c ^= reply[i];
+    if (c != reply[p + len - 1]) return false;
+    p += len;
+  }
+  return p == replyLen;
+}
+
+// serialCom() once per loop until one does nothing, returns the loops which read or sent something
+static int loops() {
+  int n = 0;
+  while (n < 100) {
+    int read = rxTail, sent = replyLen;
+    serialCom();
+    if (rxTail == read && replyLen == sent) break;
+    n++;
+  }
+  return n;
+}
+
+// instructions of the serialCom() calls, the child stopping itself around them
+static long steps(int first, int last) {
+  long n[3] = {0, 0, 0};
+  pid_t pid = fork();
+  if (pid == 0) {
+    ptrace(PTRACE_TRACEME, 0, 0, 0);
+    request(first, last);
+    raise(SIGSTOP);
+    raise(SIGSTOP);  // nothing in between: the cost of the stops themselves
+    loops();
+    raise(SIGSTOP);
+    _exit(0);
+  }
+  int status, seg = 0;
+  waitpid(pid, &status, 0);
+  while (1) {
+    if (ptrace(PTRACE_SINGLESTEP, pid, 0, 0) < 0) break;
+    waitpid(pid, &status, 0);
+    if (WIFEXITED(status) || WIFSIGNALED(status)) break;
+    if (WSTOPSIG(status) == SIGSTOP) {
+      if (++seg > 2) break;
+    } else {
+      n[seg]++;
+    }
+  }
+  return n[1] - n[0];
+}
+
+static int row(const char *name, int first, int last) {
+  request(first, last);
+  int n = loops();
+  if (!repliesOK(first, last)) {
+    fprintf(stderr, "%s: bad reply (%d bytes)\n", name, replyLen);
+    return 1;
+  }
+  printf("%-14s %5d %6d %10d %10d %12ld\n", name, replyLen, n, sends, flushes, steps(first, last));
+  return 0;
+}
+
+int main() {
+  int failures = 0;
+  printf("%-14s %5s %6s %10s %10s %12s\n", "request", "reply", "loops", "USB_Send", "USB_Flush", "serialCom()");
+  for (int r = 0; r < REQUESTS; r++) failures += row(requests[r].name, r, r + 1);
+  failures += row("all at once", 0, REQUESTS);
+  return failures ? 1 : 0;
+}